@@ -0,0 +1,355 @@
+
+/**
+ * @file
+ *
+ * Connection-storm benchmark for the distccd accept models.
+ *
+ * A pool of preforked workers accepts connections on either a single shared
+ * listening socket (the classic model) or on several SO_REUSEPORT sockets
+ * (distccd --listen-shards).  A crowd of client processes then opens
+ * connections as fast as it can, and we measure the time from the start of
+ * connect() until a worker has accepted the connection and read the first
+ * bytes of the request -- i.e. what a distcc client waits before the server
+ * starts working on its job.  The spread of connections over workers is
+ * reported too.
+ *
+ * Usage:
+ *   accept-storm [-w WORKERS] [-s SHARDS] [-c CLIENTS] [-n CONNS] [-u WORK_USEC] [-a]
+ *
+ * Both models are run one after the other with the same parameters, unless
+ * -s is given, in which case only that configuration is run (0 = shared).
+ * -a pins the workers of each socket to their own CPUs, like --pin-shards.
+ **/
+
+#include <unistd.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+
+#include <vector>
+#include <algorithm>
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+static int n_workers = 0, n_clients = 64, n_conns = 200, work_usec = 1000;
+static bool pin = false;
+
+static volatile sig_atomic_t stop_flag = 0;
+
+//---------------------------------------------------------------------------------------------
+
+static unsigned long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void die(const char *what)
+{
+	fprintf(stderr, "accept-storm: %s: %s\n", what, strerror(errno));
+	exit(1);
+}
+
+//---------------------------------------------------------------------------------------------
+
+static int listen_on(int port, bool reuse_port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == -1)
+		die("socket");
+
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1)
+		die("SO_REUSEPORT");
+
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *) &sa, sizeof(sa)) == -1)
+		die("bind");
+
+	// same backlog as distccd
+	if (listen(fd, 100) == -1)
+		die("listen");
+	return fd;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static int port_of(int fd)
+{
+	struct sockaddr_in sa;
+	socklen_t len = sizeof(sa);
+	if (getsockname(fd, (struct sockaddr *) &sa, &len) == -1)
+		die("getsockname");
+	return ntohs(sa.sin_port);
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void on_term(int)
+{
+	stop_flag = 1;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Accept connections until told to stop.  Each connection carries the client's connect() start
+// time; we answer with the accept latency after "working" for a while.
+
+static void worker(int listen_fd, unsigned *accepted)
+{
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_term;
+	sigaction(SIGTERM, &sa, 0); // no SA_RESTART: interrupt accept()
+
+	while (!stop_flag)
+	{
+		int fd = accept(listen_fd, 0, 0);
+		if (fd == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			die("accept");
+		}
+
+		unsigned long long t0, latency;
+		if (read(fd, &t0, sizeof(t0)) == sizeof(t0))
+		{
+			latency = now_ns() - t0;
+			++*accepted;
+			if (work_usec)
+				usleep(work_usec);
+			if (write(fd, &latency, sizeof(latency)) != sizeof(latency))
+				; // client went away; nothing to report
+		}
+		close(fd);
+	}
+
+	_exit(0);
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void client(int port, unsigned long long *latencies)
+{
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	for (int i = 0; i < n_conns; ++i)
+	{
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd == -1)
+			die("socket");
+
+		unsigned long long t0 = now_ns();
+		if (connect(fd, (struct sockaddr *) &sa, sizeof(sa)) == -1)
+			die("connect");
+		if (write(fd, &t0, sizeof(t0)) != sizeof(t0))
+			die("write");
+		if (read(fd, &latencies[i], sizeof(latencies[i])) != sizeof(latencies[i]))
+			die("read");
+		close(fd);
+	}
+
+	_exit(0);
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void pin_worker(int shard, int n_shards, int n_cpus)
+{
+	int first, count;
+	if (n_shards >= n_cpus)
+	{
+		first = shard % n_cpus;
+		count = 1;
+	}
+	else
+	{
+		first = shard * n_cpus / n_shards;
+		count = (shard + 1) * n_cpus / n_shards - first;
+	}
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	for (int cpu = first; cpu < first + count; ++cpu)
+		CPU_SET(cpu, &cpus);
+	sched_setaffinity(0, sizeof(cpus), &cpus);
+}
+
+//---------------------------------------------------------------------------------------------
+
+static double percentile(const std::vector<unsigned long long> &v, double p)
+{
+	size_t i = (size_t) (p / 100.0 * (v.size() - 1) + 0.5);
+	return v[i] / 1000.0;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Run one configuration; n_shards == 0 means a single shared socket.
+
+static void run(int n_shards, int n_cpus)
+{
+	size_t n_samples = (size_t) n_clients * n_conns;
+	size_t map_size = n_samples * sizeof(unsigned long long) + n_workers * sizeof(unsigned);
+	void *shared = mmap(0, map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED)
+		die("mmap");
+	unsigned long long *latencies = (unsigned long long *) shared;
+	unsigned *accepted = (unsigned *) (latencies + n_samples);
+
+	// don't let the children inherit pending output
+	fflush(stdout);
+
+	std::vector<int> fds;
+	fds.push_back(listen_on(0, n_shards > 0));
+	int port = port_of(fds[0]);
+	for (int i = 1; i < n_shards; ++i)
+		fds.push_back(listen_on(port, true));
+
+	std::vector<pid_t> workers;
+	for (int i = 0; i < n_workers; ++i)
+	{
+		int shard = i % fds.size();
+		pid_t pid = fork();
+		if (pid == -1)
+			die("fork");
+		if (pid == 0)
+		{
+			if (pin && n_shards > 0)
+				pin_worker(shard, n_shards, n_cpus);
+			worker(fds[shard], &accepted[i]);
+		}
+		workers.push_back(pid);
+	}
+
+	// give the workers a moment to block in accept()
+	usleep(200000);
+
+	unsigned long long t_start = now_ns();
+	for (int i = 0; i < n_clients; ++i)
+	{
+		pid_t pid = fork();
+		if (pid == -1)
+			die("fork");
+		if (pid == 0)
+			client(port, latencies + (size_t) i * n_conns);
+	}
+
+	int status;
+	for (int i = 0; i < n_clients; ++i)
+		if (wait(&status) == -1 || !WIFEXITED(status) || WEXITSTATUS(status))
+		{
+			fprintf(stderr, "accept-storm: a client failed\n");
+			exit(1);
+		}
+	double elapsed = (now_ns() - t_start) / 1e9;
+
+	for (size_t i = 0; i < workers.size(); ++i)
+		kill(workers[i], SIGTERM);
+	for (size_t i = 0; i < workers.size(); ++i)
+		waitpid(workers[i], &status, 0);
+	for (size_t i = 0; i < fds.size(); ++i)
+		close(fds[i]);
+
+	std::vector<unsigned long long> v(latencies, latencies + n_samples);
+	std::sort(v.begin(), v.end());
+	double sum = 0;
+	for (size_t i = 0; i < v.size(); ++i)
+		sum += v[i];
+
+	unsigned a_min = accepted[0], a_max = accepted[0];
+	double a_sum = 0, a_sq = 0;
+	for (int i = 0; i < n_workers; ++i)
+	{
+		a_min = std::min(a_min, accepted[i]);
+		a_max = std::max(a_max, accepted[i]);
+		a_sum += accepted[i];
+		a_sq += (double) accepted[i] * accepted[i];
+	}
+	double a_mean = a_sum / n_workers;
+	double a_dev = sqrt(std::max(0.0, a_sq / n_workers - a_mean * a_mean));
+
+	if (n_shards)
+		printf("reuseport x%-2d%s", n_shards, pin ? " pinned " : "        ");
+	else
+		printf("shared socket        ");
+	printf("%8.0f conn/s  accept us: mean %8.1f  p50 %8.1f  p90 %8.1f  p99 %8.1f  max %9.1f  "
+		"per-worker: min %u max %u sd %.1f\n",
+		n_samples / elapsed, sum / v.size() / 1000.0, percentile(v, 50), percentile(v, 90),
+		percentile(v, 99), v.back() / 1000.0, a_min, a_max, a_dev);
+
+	munmap(shared, map_size);
+}
+
+//---------------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+	int n_shards = -1;
+	int c;
+	while ((c = getopt(argc, argv, "w:s:c:n:u:a")) != -1)
+	{
+		switch (c)
+		{
+		case 'w': n_workers = atoi(optarg); break;
+		case 's': n_shards = atoi(optarg); break;
+		case 'c': n_clients = atoi(optarg); break;
+		case 'n': n_conns = atoi(optarg); break;
+		case 'u': work_usec = atoi(optarg); break;
+		case 'a': pin = true; break;
+		default:
+			fprintf(stderr, "usage: accept-storm [-w WORKERS] [-s SHARDS] [-c CLIENTS] [-n CONNS] [-u WORK_USEC] [-a]\n");
+			return 1;
+		}
+	}
+
+	int n_cpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_cpus < 1)
+		n_cpus = 1;
+	if (n_workers < 1)
+		n_workers = n_cpus + 2; // distccd's default
+	if (n_clients < 1 || n_conns < 1 || n_shards > n_workers)
+	{
+		fprintf(stderr, "accept-storm: bad arguments\n");
+		return 1;
+	}
+
+	printf("%d workers, %d clients x %d connections, %d us per request, %d CPUs\n",
+		n_workers, n_clients, n_conns, work_usec, n_cpus);
+
+	if (n_shards >= 0)
+	{
+		run(n_shards, n_cpus);
+	}
+	else
+	{
+		run(0, n_cpus);
+		run(n_workers, n_cpus);
+	}
+
+	return 0;
+}
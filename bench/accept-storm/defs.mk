@@ -0,0 +1,10 @@
+MODULE=distcc-bench-accept-storm
+MODULE_DIR=$(VROOT)/distcc/bench/accept-storm
+
+include $(MK)/module/start
+
+MODULE_PRODUCT=prog
+
+MODULE_TARGET_NAME=accept-storm
+
+include $(MK)/module/end
@@ -0,0 +1,10 @@
+MODULE=distcc-bench-slot-affinity
+MODULE_DIR=$(VROOT)/distcc/bench/slot-affinity
+
+include $(MK)/module/start
+
+MODULE_PRODUCT=prog
+
+MODULE_TARGET_NAME=slot-affinity
+
+include $(MK)/module/end
@@ -0,0 +1,342 @@
+/**
+ * @file
+ *
+ * Compile-slot placement benchmark for distccd --slot-affinity.
+ *
+ * A fixed number of compile slots run a stream of memory-bound jobs, each in a
+ * freshly forked process, the way distccd starts a compiler per job.  A job
+ * allocates and fills a working set, then walks it in random order, which is
+ * roughly what a template-heavy C++ compile does to the memory system.  The
+ * same jobs are run with the slots unpinned, pinned to groups of cores, pinned
+ * to NUMA nodes, and pinned to NUMA nodes with their memory bound to the node,
+ * and the throughput and job times of each are reported.
+ *
+ * Usage:
+ *   slot-affinity [-j SLOTS] [-n JOBS] [-m MB] [-p PASSES] [-o MODE]
+ *
+ * MODE is one of none, cores, numa, numa-mem; without -o, all are run.
+ **/
+
+#include <unistd.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <vector>
+#include <algorithm>
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+static int n_slots = 0, n_jobs = 0, job_mb = 128, n_passes = 4;
+
+enum Mode { mode_none, mode_cores, mode_numa, mode_numa_mem };
+static const char *mode_names[] = { "none", "cores", "numa", "numa-mem" };
+
+// CPUs of each NUMA node that has any, and the node numbers
+static std::vector<std::vector<int> > node_cpus;
+static std::vector<int> nodes;
+
+//---------------------------------------------------------------------------------------------
+
+static unsigned long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void die(const char *what)
+{
+	fprintf(stderr, "slot-affinity: %s: %s\n", what, strerror(errno));
+	exit(1);
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Read a kernel CPU list like "0-15,32-47"
+
+static std::vector<int> read_cpu_list(const char *path)
+{
+	std::vector<int> cpus;
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return cpus;
+
+	int first, last;
+	char sep;
+	while (fscanf(f, "%d", &first) == 1)
+	{
+		last = first;
+		if (fscanf(f, "%c", &sep) == 1 && sep == '-')
+		{
+			if (fscanf(f, "%d", &last) != 1)
+				break;
+			if (fscanf(f, "%c", &sep) != 1)
+				sep = '\n';
+		}
+		for (int cpu = first; cpu <= last; ++cpu)
+			cpus.push_back(cpu);
+		if (sep != ',')
+			break;
+	}
+
+	fclose(f);
+	return cpus;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void read_topology()
+{
+	std::vector<std::pair<int, std::vector<int> > > found;
+	DIR *dir = opendir("/sys/devices/system/node");
+	struct dirent *de;
+	while (dir && (de = readdir(dir)) != NULL)
+	{
+		int node;
+		char rest;
+		if (sscanf(de->d_name, "node%d%c", &node, &rest) != 1)
+			continue;
+
+		char path[320];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", de->d_name);
+		std::vector<int> cpus = read_cpu_list(path);
+		if (!cpus.empty())
+			found.push_back(std::make_pair(node, cpus));
+	}
+	if (dir)
+		closedir(dir);
+	std::sort(found.begin(), found.end());
+
+	for (size_t i = 0; i < found.size(); ++i)
+	{
+		nodes.push_back(found[i].first);
+		node_cpus.push_back(found[i].second);
+	}
+
+	if (nodes.empty())
+	{
+		std::vector<int> online = read_cpu_list("/sys/devices/system/cpu/online");
+		if (online.empty())
+			for (int cpu = 0; cpu < (int) sysconf(_SC_NPROCESSORS_ONLN); ++cpu)
+				online.push_back(cpu);
+		nodes.push_back(-1);
+		node_cpus.push_back(online);
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Same placement as distccd (server/affinity.cpp)
+
+static void place(Mode mode, int slot)
+{
+	std::vector<int> cpus;
+	int mem_node = -1;
+
+	if (mode == mode_numa || mode == mode_numa_mem)
+	{
+		int i = slot % nodes.size();
+		cpus = node_cpus[i];
+		if (mode == mode_numa_mem)
+			mem_node = nodes[i];
+	}
+	else if (mode == mode_cores)
+	{
+		std::vector<int> all;
+		for (size_t i = 0; i < node_cpus.size(); ++i)
+			all.insert(all.end(), node_cpus[i].begin(), node_cpus[i].end());
+		int n_cpus = all.size();
+		if (n_slots >= n_cpus)
+			cpus.push_back(all[slot % n_cpus]);
+		else
+			cpus.assign(all.begin() + slot * n_cpus / n_slots, all.begin() + (slot + 1) * n_cpus / n_slots);
+	}
+
+	if (!cpus.empty())
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (size_t i = 0; i < cpus.size(); ++i)
+			CPU_SET(cpus[i], &set);
+		if (sched_setaffinity(0, sizeof(set), &set) == -1)
+			die("sched_setaffinity");
+	}
+
+	if (mem_node >= 0)
+	{
+		enum { mpol_bind = 2, max_nodes = 1024 };
+		unsigned long mask[max_nodes / (8 * sizeof(unsigned long))];
+		memset(mask, 0, sizeof(mask));
+		mask[mem_node / (8 * sizeof(unsigned long))] |= 1UL << (mem_node % (8 * sizeof(unsigned long)));
+		if (syscall(SYS_set_mempolicy, mpol_bind, mask, max_nodes) == -1)
+			die("set_mempolicy");
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
+// The stand-in for a compiler: fill a working set, then chase pointers through it
+
+static void job(unsigned seed)
+{
+	size_t n = (size_t) job_mb * 1024 * 1024 / sizeof(size_t);
+	size_t *next = (size_t *) malloc(n * sizeof(size_t));
+	if (!next)
+		die("malloc");
+
+	// a single random cycle through all elements (Sattolo's algorithm)
+	for (size_t i = 0; i < n; ++i)
+		next[i] = i;
+	for (size_t i = n - 1; i > 0; --i)
+	{
+		seed = seed * 1103515245 + 12345;
+		size_t j = ((size_t) seed << 16 ^ (seed >> 8)) % i;
+		std::swap(next[i], next[j]);
+	}
+
+	size_t p = 0;
+	for (int pass = 0; pass < n_passes; ++pass)
+		for (size_t i = 0; i < n; ++i)
+			p = next[p];
+
+	free(next);
+	_exit(p == (size_t) -1); // keep the walk from being optimized away
+}
+
+//---------------------------------------------------------------------------------------------
+
+static double percentile(const std::vector<unsigned long long> &v, double p)
+{
+	size_t i = (size_t) (p / 100.0 * (v.size() - 1) + 0.5);
+	return v[i] / 1e9;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void run(Mode mode)
+{
+	std::vector<pid_t> slot_pid(n_slots, 0);
+	std::vector<unsigned long long> slot_start(n_slots, 0), times;
+
+	// don't let the children inherit pending output
+	fflush(stdout);
+
+	unsigned long long t_start = now_ns();
+	int started = 0, finished = 0;
+	while (finished < n_jobs)
+	{
+		for (int slot = 0; slot < n_slots && started < n_jobs; ++slot)
+		{
+			if (slot_pid[slot])
+				continue;
+
+			pid_t pid = fork();
+			if (pid == -1)
+				die("fork");
+			if (pid == 0)
+			{
+				place(mode, slot);
+				job(started + 1);
+			}
+			slot_pid[slot] = pid;
+			slot_start[slot] = now_ns();
+			++started;
+		}
+
+		int status;
+		pid_t pid = wait(&status);
+		if (pid == -1)
+			die("wait");
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+		{
+			fprintf(stderr, "slot-affinity: a job failed\n");
+			exit(1);
+		}
+
+		for (int slot = 0; slot < n_slots; ++slot)
+			if (slot_pid[slot] == pid)
+			{
+				times.push_back(now_ns() - slot_start[slot]);
+				slot_pid[slot] = 0;
+			}
+		++finished;
+	}
+	double elapsed = (now_ns() - t_start) / 1e9;
+
+	std::sort(times.begin(), times.end());
+	double sum = 0;
+	for (size_t i = 0; i < times.size(); ++i)
+		sum += times[i];
+
+	printf("%-9s %8.2f jobs/s  job s: mean %7.3f  p50 %7.3f  p90 %7.3f  max %7.3f\n",
+		mode_names[mode], n_jobs / elapsed, sum / times.size() / 1e9, percentile(times, 50),
+		percentile(times, 90), times.back() / 1e9);
+}
+
+//---------------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+	int only = -1;
+	int c;
+	while ((c = getopt(argc, argv, "j:n:m:p:o:")) != -1)
+	{
+		switch (c)
+		{
+		case 'j': n_slots = atoi(optarg); break;
+		case 'n': n_jobs = atoi(optarg); break;
+		case 'm': job_mb = atoi(optarg); break;
+		case 'p': n_passes = atoi(optarg); break;
+		case 'o':
+			for (int m = mode_none; m <= mode_numa_mem; ++m)
+				if (!strcmp(optarg, mode_names[m]))
+					only = m;
+			if (only != -1)
+				break;
+			// fall through
+		default:
+			fprintf(stderr, "usage: slot-affinity [-j SLOTS] [-n JOBS] [-m MB] [-p PASSES] [-o none|cores|numa|numa-mem]\n");
+			return 1;
+		}
+	}
+
+	read_topology();
+
+	int n_cpus = 0;
+	for (size_t i = 0; i < node_cpus.size(); ++i)
+		n_cpus += node_cpus[i].size();
+	if (n_slots < 1)
+		n_slots = n_cpus + 2; // distccd's default
+	if (n_jobs < 1)
+		n_jobs = 4 * n_slots;
+	if (job_mb < 1 || n_passes < 1)
+	{
+		fprintf(stderr, "slot-affinity: bad arguments\n");
+		return 1;
+	}
+
+	printf("%d slots, %d jobs of %dMB x %d passes, %d CPUs in %d NUMA nodes\n",
+		n_slots, n_jobs, job_mb, n_passes, n_cpus, (int) nodes.size());
+
+	if (only != -1)
+	{
+		run((Mode) only);
+	}
+	else
+	{
+		for (int m = mode_none; m <= mode_numa_mem; ++m)
+			run((Mode) m);
+	}
+
+	return 0;
+}
@@ -42,6 +42,11 @@
 #include <time.h>
 
 #include <sys/stat.h>
+#ifdef _WIN32
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
 
 #include "common/distcc.h"
 #include "common/trace.h"
@@ -49,6 +54,7 @@
 #include "common/exitcode.h"
 #include "common/lock.h"
 #include "common/hosts.h"
+#include "common/toolchain.h"
 
 #include "client/timefile.h"
 
@@ -63,6 +69,10 @@ using namespace rvfc;
 
 const int dcc_backoff_period = 60; // seconds
 
+// A server found to have another compiler than ours is passed over for this long, in case
+// it gets upgraded
+const int dcc_wrong_toolchain_period = 3600; // seconds
+
 //---------------------------------------------------------------------------------------------
 // Remember that this host is working OK.
 // For the moment this just means removing any backoff timer scored against it.
@@ -101,6 +111,80 @@ int dcc_hostdef::check_backoff() const
     return 0;
 }
 
+//---------------------------------------------------------------------------------------------
+// The server refused a job and expects to stay busy for @p wait_secs.
+// The busy timefile is dated into the future, until the time the server should have room again.
+
+void dcc_hostdef::note_busy(unsigned wait_secs)
+{
+	if (mark_timefile("busy"))
+		return;
+
+	Path filename = make_lock_filename("busy", 0);
+	struct utimbuf times;
+	times.actime = times.modtime = time(NULL) + wait_secs;
+	if (utime(+filename, &times) == -1)
+		rs_log_warning("failed to set time of %s: %s", +filename, strerror(errno));
+}
+
+//---------------------------------------------------------------------------------------------
+
+int dcc_hostdef::check_busy() const
+{
+    int ret;
+    time_t mtime;
+
+	if (!accept_busy)
+		return 0;
+
+    if ((ret = check_timefile("busy", mtime)))
+        return ret;
+
+    if (difftime(mtime, time(NULL)) > 0) 
+	{
+        rs_trace("%s is still busy", +hostdef_string);
+        return EXIT_BUSY;
+    }
+
+    return 0;
+}
+
+//---------------------------------------------------------------------------------------------
+// The server's compiler is not the same as ours, @p toolchain.
+// There is a timefile for each of our toolchains, so other compilers may still go there.
+
+static string dcc_toolchain_lockname(const string &toolchain)
+{
+	return "toolchain-" + dcc_toolchain_key(toolchain);
+}
+
+void dcc_hostdef::note_wrong_toolchain(const string &toolchain)
+{
+	mark_timefile(dcc_toolchain_lockname(toolchain));
+}
+
+//---------------------------------------------------------------------------------------------
+
+int dcc_hostdef::check_toolchain(const string &toolchain) const
+{
+	int ret;
+	time_t mtime;
+
+	if (!send_toolchain || toolchain.empty())
+		return 0;
+
+	if ((ret = check_timefile(dcc_toolchain_lockname(toolchain), mtime)))
+		return ret;
+
+	if (difftime(time(NULL), mtime) < (double) dcc_wrong_toolchain_period)
+	{
+		rs_trace("%s has another compiler than ours", +hostdef_string);
+		return EXIT_WRONG_TOOLCHAIN;
+	}
+
+	return 0;
+}
+
 //---------------------------------------------------------------------------------------------
 // Walk through @p hostlist and remove any hosts that are marked unavailable
  
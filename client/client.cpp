@@ -15,7 +15,7 @@ namespace distcc
 
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
-Client::Client(const ClientConfig &config) : config(config)
+Client::Client(const ClientConfig &config) : config(config), pumped(false)
 {
 #ifdef __linux__
 	dcc_client_catch_signals();
@@ -23,7 +23,7 @@ Client::Client(const ClientConfig &config) : config(config)
 #endif
 
 	atexit(dcc_cleanup_tempfiles);
-	atexit(dcc_remove_state_file);
+	atexit(dcc_remove_state);
 
 	dcc_state_dir = config.state_dir(); //@@ global var for state files mechanism
 	lock_dir = config.lock_dir(); // @@ global var for dcc_hostdef lock file
@@ -7,7 +7,9 @@
 
 #include "common/distcc.h"
 #include "common/arg.h"
+#include "common/exec.h"
 #include "client/config.h"
+#include "client/includes.h"
 
 #include "rvfc/defs.h"
 
@@ -24,6 +26,20 @@ class Client
 
 	int sg_level; // recursion safeguard
 
+	// If set, retrieve_results keeps copies of the compiler's messages here for the cache
+	File cache_err, cache_out;
+
+	// What the compilation cost the server, if the host reports it
+	JobUsage server_usage;
+
+	// Fingerprint of our compiler, if some host takes only jobs for its own (toolchain option)
+	string toolchain;
+
+	// What the source includes, and whether the job going out now is preprocessed by the
+	// server from it (pump option) rather than sent preprocessed
+	IncludeClosure closure;
+	bool pumped;
+
 	static void catch_signals();
 
 	void configure_trace_level();
@@ -41,12 +57,14 @@ public:
 	int build_somewhere(Arguments &args, int sg_level, int &status);
 	int build_somewhere_timed(Arguments &args, int sg_level, int &status);
 	int build_fallback(Arguments &args, dcc_hostdef *host);
+	string cache_key(const Arguments &args_stripped, const File &cpp_fname);
 
 	int support_masquerade(const Arguments &args, const string &progname, int &did_masquerade);
 
 	int cpp_maybe(Arguments &args, File &cpp_fname, proc_t &cpp_pid);
 
 	int retrieve_results(fd_t net_fd, int &status, Arguments &args, dcc_hostdef &host);
+	int echo_messages();
 
 	dcc_hostdef lock_local(int &cpu_lock_fd);
 };
@@ -36,6 +36,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 #include <errno.h>
 
 #include <sys/stat.h>
@@ -82,6 +83,13 @@ dcc_exitcode dcc_x_flags(fd_t fd, unsigned flag)
 
 //---------------------------------------------------------------------------------------------
 
+dcc_exitcode dcc_x_job_id(fd_t fd, const string &job_id)
+{
+	return dcc_x_token_string(fd, "JOBI", job_id);
+}
+
+//---------------------------------------------------------------------------------------------
+
 dcc_exitcode dcc_x_view_name(fd_t fd, const string &view)
 {
 	return dcc_x_token_string(fd, "VIEW", view);
@@ -115,6 +123,66 @@ dcc_exitcode dcc_x_argv(fd_t fd, const Arguments &args)
     return EXIT_OK;
 }
 
+//---------------------------------------------------------------------------------------------
+// Read the server's answer to CMD_FLAGS_ACCEPT_BUSY.
+// Returns EXIT_BUSY if the server refused the job, with its estimated wait in @p wait_secs.
+
+dcc_exitcode dcc_r_admission(fd_t ifd, unsigned &wait_secs)
+{
+	char token[5];
+	dcc_exitcode ret;
+
+	wait_secs = 0;
+	if ((ret = dcc_r_sometoken_int(ifd, token, wait_secs)))
+		return ret;
+
+	if (!strcmp(token, "ADMT"))
+		return EXIT_OK;
+
+	if (!strcmp(token, "BUSY"))
+	{
+		rs_trace("server is busy, estimated wait %us", wait_secs);
+		return EXIT_BUSY;
+	}
+
+	rs_log_error("protocol derailment: expected token \"ADMT\" or \"BUSY\", got \"%s\"", token);
+	return EXIT_PROTOCOL_ERROR;
+}
+
+//---------------------------------------------------------------------------------------------
+// Read the server's answer to the digest of our input: HAVE means we needn't send it
+
+dcc_exitcode dcc_r_have_input(fd_t ifd, bool &have)
+{
+	char token[5];
+	unsigned val;
+	dcc_exitcode ret;
+
+	if ((ret = dcc_r_sometoken_int(ifd, token, val)))
+		return ret;
+
+	have = !strcmp(token, "HAVE");
+	if (have || !strcmp(token, "NEED"))
+		return EXIT_OK;
+
+	rs_log_error("protocol derailment: expected token \"HAVE\" or \"NEED\", got \"%s\"", token);
+	return EXIT_PROTOCOL_ERROR;
+}
+
+//---------------------------------------------------------------------------------------------
+// Read what the compilation cost the server
+
+dcc_exitcode dcc_r_usage(fd_t ifd, JobUsage &usage)
+{
+	string s;
+	dcc_exitcode ret;
+	if ((ret = dcc_r_token_string(ifd, "RUSG", s)))
+		return ret;
+
+	usage.parse(s);
+	return EXIT_OK;
+}
+
 //---------------------------------------------------------------------------------------------
 // Read the "DONE" token from the network that introduces a response
 
@@ -147,6 +215,51 @@ dcc_exitcode dcc_r_cc_status(fd_t ifd, int &status)
     return ret;
 }
 
+//---------------------------------------------------------------------------------------------
+
+static int 
+dcc_echo_file(const File &file, int out_fd)
+{
+	int ret = 0;
+	fd_t in_fd = dcc_fd(open(+file.path(), O_RDONLY|O_BINARY), 0);
+	if (in_fd.fd == -1)
+		return 0; // nothing was sent
+	struct stat st;
+	if (fstat(in_fd.fd, &st) == 0 && st.st_size > 0)
+		ret = dcc_pump_readwrite(dcc_fd(out_fd, 0), in_fd, st.st_size);
+	close(in_fd.fd);
+	return ret;
+}
+
+//---------------------------------------------------------------------------------------------
+// Receive the compiler's messages onto out_fd.  If copy is given, they're received into it 
+// first, so that they can be cached too, and with an out_fd of -1 they're only kept there.
+
+static int 
+dcc_r_messages(fd_t net_fd, const char *token, int out_fd, File copy, enum dcc_compress compr)
+{
+	if (!copy)
+		return dcc_r_token_bulk(net_fd, token, dcc_fd(out_fd, 0), compr);
+
+	int ret;
+	unsigned len;
+	if ((ret = dcc_r_token_file(net_fd, token, copy, len, compr)))
+		return ret;
+
+	return out_fd == -1 ? 0 : dcc_echo_file(copy, out_fd);
+}
+
+//---------------------------------------------------------------------------------------------
+// Pass on the messages that retrieve_results held back
+
+int Client::echo_messages()
+{
+	int ret;
+	if ((ret = dcc_echo_file(cache_err, STDERR_FILENO)))
+		return ret;
+	return dcc_echo_file(cache_out, STDOUT_FILENO);
+}
+
 //---------------------------------------------------------------------------------------------
 // The second half of the client protocol: retrieve all results from the server
 
@@ -160,17 +273,30 @@ int Client::retrieve_results(fd_t net_fd, int &status, Arguments &args, dcc_host
 	// We've started to see the response, so the server is done compiling
 	dcc_note_state(DCC_PHASE_RECEIVE);
 
+	// A job preprocessed on the server may be compiled here again: hold its messages until 
+	// we know whether it is
+	int err_fd = pumped ? -1 : STDERR_FILENO, out_fd = pumped ? -1 : STDOUT_FILENO;
+
     unsigned o_len, d_len, pdb_len;
 	if ((ret = dcc_r_cc_status(net_fd, status))
-		|| (ret = dcc_r_token_bulk(net_fd, "SERR", dcc_fd(STDERR_FILENO, 0), host.compr))
-		|| (ret = dcc_r_token_bulk(net_fd, "SOUT", dcc_fd(STDOUT_FILENO, 0), host.compr))
+		|| (ret = dcc_r_messages(net_fd, "SERR", err_fd, cache_err, host.compr))
+		|| (ret = dcc_r_messages(net_fd, "SOUT", out_fd, cache_out, host.compr))
 		|| (ret = dcc_r_token_file(net_fd, "DOTO", File(args.output_file), o_len, host.compr))
 		|| (ret = dcc_r_token_file(net_fd, "DOTD", File(args.dotd_file), d_len, host.compr))
-		|| (ret = dcc_r_token_file(net_fd, ".PDB", File(args.pdb_file), pdb_len, host.compr)))
+		|| (ret = dcc_r_token_file(net_fd, ".PDB", File(args.pdb_file), pdb_len, host.compr))
+		|| (host.want_usage && (ret = dcc_r_usage(net_fd, server_usage))))
 	{
         return ret;
 	}
 
+	// a length of -1 stands for a file that wasn't there
+	unsigned lens[] = { o_len, d_len, pdb_len };
+	unsigned long long received = 0;
+	for (int i = 0; i < 3; ++i)
+		if ((int) lens[i] != -1)
+			received += lens[i];
+	dcc_note_state_bytes(0, received);
+
     // compiler succeeded, output is invalid (empty or nonexistent file)
     if (status == 0 && (o_len == 0 || (int) o_len == -1))
 	{
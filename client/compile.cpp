@@ -44,8 +44,12 @@
 #include "common/lock.h"
 #include "common/timeval.h"
 #include "common/compiler.h"
+#include "common/hash.h"
+#include "common/objcache.h"
+#include "common/toolchain.h"
 
 #include "client/client.h"
+#include "client/includes.h"
 #include "client/implicit.h"
 #include "client/where.h"
 #include "client/compile.h"
@@ -92,6 +96,41 @@ int Client::compile_local(const Arguments &args)
 
 //---------------------------------------------------------------------------------------------
 
+static ObjectCache &dcc_client_cache(const ClientConfig &config)
+{
+	static ObjectCache *cache = 0;
+	if (!cache)
+	{
+		unsigned long long size = config.cache_size();
+		cache = new ObjectCache(size ? config.cache_dir() : Directory(), size);
+	}
+	return *cache;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Cache key of a compilation: the preprocessed source, the arguments that go to the server,
+// and the identity of the compiler.  We can only fingerprint our own compiler, and rely on
+// the servers having the same one (as distcc does anyway).
+
+string Client::cache_key(const Arguments &args_stripped, const File &cpp_fname)
+{
+	string compiler = dcc_compiler_fingerprint(args_stripped[0]);
+	if (compiler.empty())
+		return "";
+
+	Digest digest;
+	digest.update_field("distcc-cache-1");
+	digest.update_field(compiler);
+	for (Arguments::ConstIterator i = args_stripped.begin(); !!i; ++i)
+		digest.update_field(*i);
+	if (!digest.update_file(cpp_fname))
+		return "";
+	return digest.hex();
+}
+
+//---------------------------------------------------------------------------------------------
+
 /**
  * Execute the commands in argv remotely or locally as appropriate.
  *
@@ -113,6 +152,9 @@ int Client::compile_local(const Arguments &args)
  * preprocessor.  This function can succeed (in running the compiler) even if
  * the compiler itself fails.  If either the compiler or preprocessor fails,
  * @p status is guaranteed to hold a failure value.
+ *
+ * If the local cache is enabled, cpp is run to completion before looking for
+ * a host, so that a cached result can be used without involving one at all.
  **/
 
 int
@@ -147,24 +189,108 @@ Client::build_somewhere(Arguments &args, int sg_level, int &status)
 	{
 		HostDefs hosts;
 		int cpu_lock_fd;
-		host.reset(new dcc_hostdef(hosts.lock_one(cpu_lock_fd)));
-		
-		if (host->mode == DCC_MODE_LOCAL)
-		{
-			// We picked localhost and already have a lock on it so no need to lock it now
-			return compile_local(args);
-		}
-
 		int ret;
 		proc_t cpp_pid;
 		File cpp_fname;
-		if ((ret = cpp_maybe(args, cpp_fname, cpp_pid) != 0))
-			throw "cpp failed";
+		Arguments args_stripped, args_pumped;
+		bool cpp_started = false, closure_tried = false;
+		string key;
 
-		Arguments args_stripped = args;
-		dcc_compiler->strip_local_args(args_stripped, config.on_server);
+		ObjectCache &cache = dcc_client_cache(config);
+		if (!!cache && !config.on_server && !args.pdb_file)
+		{
+			if ((ret = cpp_maybe(args, cpp_fname, cpp_pid)) != 0)
+				throw "cpp failed";
+			cpp_started = true;
+
+			args_stripped = args;
+			dcc_compiler->strip_local_args(args_stripped, config.on_server);
+
+			if (!!cpp_pid)
+			{
+				if ((ret = dcc_collect_child("cpp", cpp_pid, status)))
+					throw "cpp failed";
+				cpp_pid = proc_t();
+				// no point in compiling anywhere
+				if (status)
+					return dcc_critique_status(status, "cpp", args.input_file, "localhost", true);
+			}
+
+			key = cache_key(args_stripped, cpp_fname);
+			if (!key.empty())
+			{
+				if (cache.fetch(key, status, File(args.output_file), File(args.dotd_file),
+					dcc_fd(STDERR_FILENO, 0), dcc_fd(STDOUT_FILENO, 0)))
+				{
+					rs_log(RS_LOG_INFO|RS_LOG_NONAME, "%s: result taken from cache", +args.input_file);
+					return 0;
+				}
+
+				cache_err = dcc_make_tmpnam("distcc", ".stderr");
+				cache_out = dcc_make_tmpnam("distcc", ".stdout");
+			}
+		}
+
+		if (hosts.want_toolchain())
+			toolchain = dcc_toolchain_fingerprint(args[0]);
 
-		if ((ret = compile_remote(args_stripped, cpp_fname, cpp_pid, *host, status)) != 0) 
+		for (;;)
+		{
+			host.reset(new dcc_hostdef(hosts.lock_one(cpu_lock_fd, toolchain)));
+			
+			if (host->mode == DCC_MODE_LOCAL)
+			{
+				// We picked localhost and already have a lock on it so no need to lock it now
+				return compile_local(args);
+			}
+
+			// A host with the pump option preprocesses the source itself, from the headers
+			// we find it includes, unless it's already being preprocessed here for another
+			pumped = false;
+			if (host->pump && !cpp_started && !config.on_server && dcc_compiler->scans_includes())
+			{
+				if (!closure_tried)
+				{
+					closure_tried = true;
+					if (dcc_include_closure(args, closure))
+						args_pumped = dcc_pump_args(args, closure);
+				}
+				pumped = args_pumped.count() > 0;
+			}
+
+			if (!cpp_started && !pumped)
+			{
+				if ((ret = cpp_maybe(args, cpp_fname, cpp_pid) != 0))
+					throw "cpp failed";
+				cpp_started = true;
+
+				args_stripped = args;
+				dcc_compiler->strip_local_args(args_stripped, config.on_server);
+			}
+
+			// The messages are held until we know whether to compile here again
+			if (pumped && !cache_err)
+			{
+				cache_err = dcc_make_tmpnam("distcc", ".stderr");
+				cache_out = dcc_make_tmpnam("distcc", ".stdout");
+			}
+
+			// lock_one only hands out a busy host when all of them are:
+			// rather than bouncing between them, queue up on this one
+			if (host->check_busy())
+				host->accept_busy = false;
+
+			ret = compile_remote(pumped ? args_pumped : args_stripped, cpp_fname, cpp_pid, *host, status);
+			if (ret != EXIT_BUSY && ret != EXIT_WRONG_TOOLCHAIN)
+				break;
+
+			// The server turned us away before we sent anything: release its slot and pick 
+			// another host (lock_one passes over the busy one for a while, and over one with
+			// another compiler altogether)
+			dcc_unlock(cpu_lock_fd);
+		}
+
+		if (ret != 0) 
 		{
 			// Returns zero if we successfully ran the compiler, even if the compiler itself bombed out
 			throw "remote compilation failed";
@@ -174,6 +300,23 @@ Client::build_somewhere(Arguments &args, int sg_level, int &status)
 
 		dcc_unlock(cpu_lock_fd);
 
+		if (pumped)
+		{
+			// The server may have missed a header we didn't see included, or found one of 
+			// its own: its errors may not be ours
+			if (status != 0)
+			{
+				rs_log(RS_LOG_INFO|RS_LOG_NONAME, "%s failed on %s from the headers sent; compiling here",
+					+args.input_file, +host->hostname);
+				lock_local(cpu_lock_fd);
+				return compile_local(args);
+			}
+			echo_messages();
+		}
+
+		if (!key.empty())
+			cache.store(key, status, File(args.output_file), File(args.dotd_file), cache_err, cache_out);
+
 		ret = dcc_critique_status(status, "compile", args.input_file, host->hostname, true);
 		if (ret < 128)
 			// either worked, or remote compile just simply failed,
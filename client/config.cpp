@@ -1,6 +1,8 @@
 
 #include "common/config.h"
 
+#include <stdlib.h>
+
 #include "rvfc/text/defs.h"
 
 #include "common/distcc.h"
@@ -100,6 +102,27 @@ Directory ClientConfig::state_dir() const
 	return cached = subdir("state");
 }
 
+//---------------------------------------------------------------------------------------------
+
+Directory ClientConfig::cache_dir() const
+{
+	char *dir = getenv("DISTCC_CACHE_DIR");
+	if (dir && *dir)
+		return Path(dir);
+	return top_dir().subdir("cache");
+}
+
+//---------------------------------------------------------------------------------------------
+// Size limit of the local compilation cache in bytes; zero (the default) turns it off
+
+unsigned long long ClientConfig::cache_size() const
+{
+	char *size = getenv("DISTCC_CACHE_SIZE");
+	if (!size)
+		return 0;
+	return strtoull(size, 0, 10) << 20;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
 } // namespace distcc
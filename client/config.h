@@ -47,6 +47,9 @@ public:
 	Directory subdir(const string &name) const;
 	Directory lock_dir() const;
 	Directory state_dir() const;
+
+	Directory cache_dir() const;
+	unsigned long long cache_size() const;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -42,6 +42,7 @@
 #include "common/exitcode.h"
 #include "common/trace.h"
 #include "common/util.h"
+#include "common/stats.h"
 
 #include "client/dopt.h"
 #include "client/config.h"
@@ -85,6 +86,8 @@ static void dcc_show_usage()
 "Options:\n"
 "    -?, --help                 explain usage and exit\n"
 "    -V, --version              show version and exit\n"
+"    --stats                    show times of job phases and throughput, and exit\n"
+"    --stats-reset              start the statistics afresh, and exit\n"
 "  Networking:\n"
 "    -p, --port PORT            TCP port to listen on\n"
 "  Debug and trace:\n"
@@ -107,6 +110,9 @@ static void dcc_show_usage()
 "   DISTCC_LOG                 send messages to file, not stderr\n"
 "   DISTCC_SSH                 command to run to open SSH connections\n"
 "   DISTCC_DIR                 directory for host list and locks\n"
+"   DISTCC_CACHE_SIZE=MB       keep up to MB megabytes of compilation results\n"
+"   DISTCC_CACHE_DIR           cache directory, default $DISTCC_DIR/cache\n"
+"   DISTCC_TIMELINE=DIR        append a trace of job phases to files in DIR\n"
 "\n"
 "Server specification:\n"
 "A list of servers is taken from the environment variable $DISTCC_HOSTS, or\n"
@@ -226,6 +232,16 @@ bool ClientConfig::parse_options(const Arguments &args)
 		return false;
     }
 
+	if (args[1].equalsto_one_of("--stats", "--stats-reset", 0))
+	{
+		dcc_state_dir = state_dir();
+		if (args[1] == "--stats")
+			dcc_stats_report(stdout);
+		else if (dcc_stats_reset())
+			rs_log_error("failed to reset statistics");
+		return false;
+	}
+
 	cc_args = args;
 	Arguments::ConstIterator j = args.find("--");
 	if (!j)
@@ -42,7 +42,7 @@
   OLDSTYLE_TCP_HOST = HOSTID[/LIMIT][:PORT][OPTIONS]
   HOSTID = HOSTNAME | IPV4
   OPTIONS = ,OPTION[OPTIONS]
-  OPTION = lzo
+  OPTION = lzo | busy | dedup | usage | timeline | toolchain | ship | pump
  *
  * Any amount of whitespace may be present between hosts.
  *
@@ -57,6 +57,49 @@
  * The TCP port defaults to 3632 and should not normally need to be
  * overridden.
  *
+ * The busy option may be given for servers running with --max-queue.
+ * Such a server says right away whether it accepts the job, and if it
+ * doesn't, the client goes elsewhere and avoids that server for as long
+ * as the server expects to remain busy.
+ *
+ * With the dedup option, the client sends the digest of the preprocessed
+ * source ahead of it, and skips sending the source if the server still
+ * has it from an earlier job (distccd --input-cache).
+ *
+ * With the usage option, the server reports the CPU time, peak memory
+ * and running time of each compilation, which are logged with the
+ * job's timings.  Servers older than this option don't understand it.
+ *
+ * With the timeline option, the client tells the server the id of each
+ * job while $DISTCC_TIMELINE is set, so that the server's spans of the
+ * job can be merged with ours (distcc-trace-merge).  Our own spans are
+ * written for every host.  Servers older than this option don't
+ * understand it.
+ *
+ * With the toolchain option, the client sends a fingerprint of its
+ * compiler (the version and target it reports, and a digest of the
+ * driver), and the server compiles only if its own compiler has the
+ * same fingerprint.  Otherwise the client goes to another host and
+ * passes over this one for an hour when using that compiler; if no
+ * host is left, it compiles locally.  Servers older than this option
+ * don't understand it either.
+ *
+ * The ship option goes further: a server lacking our compiler is sent
+ * a copy (the driver, cc1, cc1plus, as and their libraries other than
+ * the C library), if it takes compilers (distccd --toolchain-dir).
+ * The copy is packed up once and kept in the state directory, and the
+ * server keeps what it unpacked for later jobs.  The C library of the
+ * server must be no older than ours.
+ *
+ * With the pump option, gcc jobs aren't preprocessed here: the client
+ * sends the source and every header it may include, found by reading
+ * them, and the server preprocesses and compiles them in a copy of our
+ * directory tree.  The server keeps the headers (distccd --header-cache),
+ * so each is sent once.  A job the server fails to compile is compiled
+ * here again, so that the errors are our own.  Sources that include a
+ * header by a macro we can't follow are preprocessed here as usual.
+ * The server's compiler should be ours (toolchain option).
+ *
  * IPv6 literals are not supported yet.  They will need to be
  * surrounded by square brackets because they may contain a colon,
  * which would otherwise be ambiguous.  This is consistent with other
@@ -0,0 +1,886 @@
+/**
+ * @file
+ *
+ * The headers a source includes, found by reading them, for jobs preprocessed on the server
+ * (host option "pump").
+ **/
+
+#include "common/config.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include <sys/stat.h>
+
+#include <map>
+#include <set>
+
+#include "common/distcc.h"
+#include "common/trace.h"
+#include "common/exec.h"
+#include "common/rpc1.h"
+#include "common/bulk.h"
+#include "common/hash.h"
+#include "common/state.h"
+#include "common/objcache.h"
+#include "common/compiler.h"
+#include "common/cc-options.h"
+
+#include "client/includes.h"
+
+#include "rvfc/text/defs.h"
+#include "rvfc/filesys/defs.h"
+
+namespace distcc
+{
+
+using namespace rvfc::Text;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef __linux__
+
+static bool dcc_read_whole_file(const string &path, string &contents)
+{
+	FILE *f = fopen(+path, "rb");
+	if (!f)
+		return false;
+
+	char buf[65536];
+	size_t n;
+	contents.clear();
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		contents.append(buf, n);
+	bool ok = !ferror(f);
+	fclose(f);
+	return ok;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// @p path without "." and ".." components and repeated slashes, as if no directory on the
+// way were a link
+
+static string dcc_normalize_path(const string &path)
+{
+	vector<string> parts;
+	for (size_t i = 0, j; i < path.length(); i = j + 1)
+	{
+		j = path.find('/', i);
+		if (j == string::npos)
+			j = path.length();
+		string part = path.substr(i, j - i);
+		if (part.empty() || part == ".")
+			continue;
+		if (part == "..")
+		{
+			if (!parts.empty())
+				parts.pop_back();
+			continue;
+		}
+		parts.push_back(part);
+	}
+
+	string norm;
+	for (size_t i = 0; i < parts.size(); ++i)
+		norm += "/" + parts[i];
+	return norm.empty() ? string("/") : norm;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static string dcc_dir_of(const string &path)
+{
+	size_t slash = path.rfind('/');
+	return slash == 0 ? string("/") : path.substr(0, slash);
+}
+
+//---------------------------------------------------------------------------------------------
+
+static bool dcc_is_ident_char(char c)
+{
+	return isalnum((unsigned char) c) || c == '_';
+}
+
+//---------------------------------------------------------------------------------------------
+
+static const char *dcc_skip_blanks(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+		++p;
+	return p;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static string dcc_read_ident(const char *&p, const char *end)
+{
+	const char *start = p;
+	while (p < end && dcc_is_ident_char(*p))
+		++p;
+	return string(start, p - start);
+}
+
+//---------------------------------------------------------------------------------------------
+
+// A header name, "x" or <x>, at @p p.  Returns its opening character, or 0 if there's none.
+
+static char dcc_read_header_name(const char *&p, const char *end, string &name)
+{
+	if (p >= end || (*p != '"' && *p != '<'))
+		return 0;
+
+	char delim = *p, close = delim == '"' ? '"' : '>';
+	const char *start = ++p;
+	while (p < end && *p != close)
+		++p;
+	if (p >= end)
+		return 0;
+	name.assign(start, p++ - start);
+	return name.empty() ? 0 : delim;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Whether only blanks or a comment follow @p p on its line
+
+static bool dcc_at_line_end(const char *p, const char *end)
+{
+	p = dcc_skip_blanks(p, end);
+	return p == end || *p == '\r' || (p + 1 < end && p[0] == '/' && (p[1] == '/' || p[1] == '*'));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+// A header named by #include, #include_next, #import or __has_include
+
+struct HeaderRef
+{
+	char delim;    // '"' or '<', or 0 if named by the macro in name
+	string name;
+	bool next;     // #include_next
+};
+
+//---------------------------------------------------------------------------------------------
+
+// Reads the source and whatever it includes, depth first, each file once.  Conditionals are
+// ignored, so every header that some branch names is taken.  A header included by a macro is
+// looked up once everything else has been read, when every definition of the macro that
+// names a header (#define NAME "x", NAME <x> or NAME OTHER) has been seen.
+
+class IncludeScanner
+{
+	IncludeClosure &_closure;
+	string _cwd;
+
+	// Where "x" is looked for after the includer's directory, and then <x>
+	vector<string> _quote_dirs, _bracket_dirs;
+
+	std::set<string> _seen;                 // files taken, by the path the compiler opens
+	std::map<string, string> _digests;      // ... and by their normalized path
+	std::map<string, bool> _exists;
+	std::map<string, std::set<string> > _macros;
+	size_t _macro_values;
+
+	struct Computed
+	{
+		string includer_dir;
+		HeaderRef ref;
+	};
+	vector<Computed> _computed;
+
+	bool exists(const string &path);
+	bool resolve(const string &macro, vector<HeaderRef> &refs, int depth);
+	void define(const string &name, const string &value);
+	void scan(const string &contents, vector<HeaderRef> &refs);
+
+public:
+	IncludeScanner(IncludeClosure &closure, const string &cwd) : _closure(closure), _cwd(cwd), _macro_values(0) {}
+
+	string absolute(const string &path) const { return path[0] == '/' ? path : _cwd + "/" + path; }
+
+	void quote_dir(const string &dir) { _quote_dirs.push_back(absolute(dir)); }
+	void bracket_dir(const string &dir) { _bracket_dirs.push_back(absolute(dir)); }
+	void define_arg(const string &def);
+
+	bool add(const string &path);
+	bool include(const string &includer_dir, const HeaderRef &ref);
+	bool finish();
+};
+
+//---------------------------------------------------------------------------------------------
+
+bool IncludeScanner::exists(const string &path)
+{
+	std::map<string, bool>::iterator i = _exists.find(path);
+	if (i != _exists.end())
+		return i->second;
+
+	struct stat st;
+	bool found = stat(+path, &st) == 0 && S_ISREG(st.st_mode);
+	_exists[path] = found;
+	return found;
+}
+
+//---------------------------------------------------------------------------------------------
+
+void IncludeScanner::define(const string &name, const string &value)
+{
+	if (_macros[name].insert(value).second)
+		++_macro_values;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// -DNAME="x" or -DNAME=<x>, as the preprocessor would see them
+
+void IncludeScanner::define_arg(const string &def)
+{
+	size_t eq = def.find('=');
+	if (eq != string::npos)
+		define(def.substr(0, eq), def.substr(eq + 1));
+}
+
+//---------------------------------------------------------------------------------------------
+
+void IncludeScanner::scan(const string &contents, vector<HeaderRef> &refs)
+{
+	const char *p = contents.data(), *end = p + contents.size();
+	for (const char *line = p; line < end; line = p + 1)
+	{
+		const char *eol = (const char *) memchr(line, '\n', end - line);
+		if (!eol)
+			eol = end;
+		p = eol;
+
+		const char *q = dcc_skip_blanks(line, eol);
+		if (q == eol || *q != '#')
+			continue;
+		q = dcc_skip_blanks(q + 1, eol);
+		string directive = dcc_read_ident(q, eol);
+		q = dcc_skip_blanks(q, eol);
+
+		HeaderRef ref;
+		ref.next = directive == "include_next";
+
+		if (directive == "include" || directive == "include_next" || directive == "import")
+		{
+			if ((ref.delim = dcc_read_header_name(q, eol, ref.name)) == 0)
+			{
+				ref.name = dcc_read_ident(q, eol);
+				if (ref.name.empty())
+					continue;
+			}
+			refs.push_back(ref);
+		}
+		else if (directive == "define")
+		{
+			// only object-like macros can name a header
+			string name = dcc_read_ident(q, eol);
+			if (name.empty() || (q < eol && *q == '('))
+				continue;
+			q = dcc_skip_blanks(q, eol);
+			const char *value = q;
+			string header;
+			if (!dcc_read_header_name(q, eol, header) && dcc_read_ident(q, eol).empty())
+				continue;
+			if (dcc_at_line_end(q, eol))
+				define(name, string(value, q - value));
+		}
+		else if (directive == "if" || directive == "elif")
+		{
+			// __has_include(<x>) and __has_include_next(<x>)
+			string rest(q, eol - q);
+			for (size_t at = 0; (at = rest.find("__has_include", at)) != string::npos; )
+			{
+				const char *h = rest.c_str() + at + strlen("__has_include");
+				const char *hend = rest.c_str() + rest.length();
+				ref.next = !strncmp(h, "_next", 5);
+				if (ref.next)
+					h += 5;
+				h = dcc_skip_blanks(h, hend);
+				if (h < hend && *h == '(')
+					h = dcc_skip_blanks(h + 1, hend);
+				if ((ref.delim = dcc_read_header_name(h, hend, ref.name)) != 0)
+					refs.push_back(ref);
+				at = h - rest.c_str();
+			}
+		}
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Take @p path (as the compiler would open it) and whatever it includes
+
+bool IncludeScanner::add(const string &path)
+{
+	if (!_seen.insert(path).second)
+		return true;
+
+	// The server makes every directory on the way a real one, so a link followed by ".."
+	// would lead somewhere else there
+	string norm = dcc_normalize_path(path);
+	if (norm != path)
+	{
+		struct stat st, norm_st;
+		if (stat(+path, &st) == -1 || stat(+norm, &norm_st) == -1
+			|| st.st_dev != norm_st.st_dev || st.st_ino != norm_st.st_ino)
+		{
+			rs_log_info("%s is not %s; preprocessing here", +path, +norm);
+			return false;
+		}
+	}
+
+	std::map<string, string>::const_iterator known = _digests.find(norm);
+	if (known != _digests.end())
+	{
+		_closure.files.push_back(path);
+		_closure.digests.push_back(known->second);
+		return true;
+	}
+
+	string contents;
+	if (!dcc_read_whole_file(path, contents))
+	{
+		// the compiler won't get any further with it than we do
+		rs_trace("failed to read %s: %s", +path, strerror(errno));
+		return true;
+	}
+
+	string digest = Digest().update(contents).hex();
+	_digests[norm] = digest;
+	_closure.files.push_back(path);
+	_closure.digests.push_back(digest);
+	_closure.size += contents.size();
+
+	vector<HeaderRef> refs;
+	scan(contents, refs);
+	contents = string();
+
+	string dir = dcc_dir_of(path);
+	for (size_t i = 0; i < refs.size(); ++i)
+	{
+		if (!include(dir, refs[i]))
+			return false;
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+
+bool IncludeScanner::include(const string &includer_dir, const HeaderRef &ref)
+{
+	if (!ref.delim)
+	{
+		// the file including itself
+		if (ref.name == "__FILE__")
+			return true;
+
+		Computed computed = { includer_dir, ref };
+		_computed.push_back(computed);
+		return true;
+	}
+
+	// the compiler on the server would read it outside the mirrored tree
+	if (ref.name[0] == '/')
+	{
+		rs_log_info("header %s is included by its absolute path; preprocessing here", +ref.name);
+		return false;
+	}
+
+	vector<string> dirs;
+	if (ref.delim == '"')
+	{
+		dirs.push_back(includer_dir);
+		dirs.insert(dirs.end(), _quote_dirs.begin(), _quote_dirs.end());
+	}
+	dirs.insert(dirs.end(), _bracket_dirs.begin(), _bracket_dirs.end());
+
+	// #include_next takes the next one after the includer's, which is one of these
+	for (size_t i = 0; i < dirs.size(); ++i)
+	{
+		string path = dirs[i] + "/" + ref.name;
+		if (!exists(path))
+			continue;
+		if (!add(path))
+			return false;
+		if (!ref.next)
+			break;
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// The headers @p macro may name, through other macros if need be.  Returns false if one of
+// its definitions names something else, or it has none.
+
+bool IncludeScanner::resolve(const string &macro, vector<HeaderRef> &refs, int depth)
+{
+	std::map<string, std::set<string> >::const_iterator m = _macros.find(macro);
+	if (m == _macros.end() || depth > 16)
+		return false;
+
+	for (std::set<string>::const_iterator v = m->second.begin(); v != m->second.end(); ++v)
+	{
+		const char *p = +*v, *end = p + v->length();
+		HeaderRef ref;
+		ref.next = false;
+		if ((ref.delim = dcc_read_header_name(p, end, ref.name)) != 0)
+			refs.push_back(ref);
+		else if (!resolve(*v, refs, depth + 1))
+			return false;
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Look up the headers included by macros, until no more definitions turn up
+
+bool IncludeScanner::finish()
+{
+	for (;;)
+	{
+		size_t known = _macro_values;
+		for (size_t i = 0; i < _computed.size(); ++i)
+		{
+			Computed c = _computed[i];
+			vector<HeaderRef> refs;
+			if (!resolve(c.ref.name, refs, 0))
+				continue;
+			for (size_t j = 0; j < refs.size(); ++j)
+			{
+				refs[j].next = c.ref.next;
+				if (!include(c.includer_dir, refs[j]))
+					return false;
+			}
+		}
+		if (_macro_values == known)
+			break;
+	}
+
+	for (size_t i = 0; i < _computed.size(); ++i)
+	{
+		vector<HeaderRef> refs;
+		if (!resolve(_computed[i].ref.name, refs, 0))
+		{
+			rs_log_info("header included by macro %s; preprocessing here", +_computed[i].ref.name);
+			return false;
+		}
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+// The compiler's own include directories are what it prints for -v.  They only depend on the
+// compiler, the language and a few options, so each client remembers them in
+// <state dir>/include-dirs, one line "<key>\t<dir>\t<dir>..." for each combination seen;
+// the file is only appended to, like the one of toolchains.
+
+static string dcc_include_dirs_file()
+{
+	return !dcc_state_dir ? string("") : stringf("%s/include-dirs", +dcc_state_dir.path());
+}
+
+//---------------------------------------------------------------------------------------------
+
+static bool dcc_lookup_include_dirs(const string &key, vector<string> &dirs)
+{
+	string fname = dcc_include_dirs_file();
+	FILE *f = fname.empty() ? 0 : fopen(+fname, "r");
+	if (!f)
+		return false;
+
+	string prefix = key + "\t";
+	bool found = false;
+	char buf[16384];
+	while (fgets(buf, sizeof(buf), f))
+	{
+		size_t len = strlen(buf);
+		if (len == 0 || buf[len - 1] != '\n' || strncmp(buf, +prefix, prefix.size()))
+			continue;
+
+		found = true;
+		dirs.clear();
+		string line(buf + prefix.size(), len - prefix.size() - 1);
+		for (size_t i = 0, j; i < line.length(); i = j + 1)
+		{
+			j = line.find('\t', i);
+			if (j == string::npos)
+				j = line.length();
+			if (j > i)
+				dirs.push_back(line.substr(i, j - i));
+		}
+	}
+	fclose(f);
+	return found;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void dcc_remember_include_dirs(const string &key, const vector<string> &dirs)
+{
+	string fname = dcc_include_dirs_file();
+	if (fname.empty())
+		return;
+
+	string line = key + "\t";
+	for (size_t i = 0; i < dirs.size(); ++i)
+		line += (i ? "\t" : "") + dirs[i];
+	line += "\n";
+
+	// one write to a file opened for appending, so concurrent clients don't mix their lines
+	int fd = open(+fname, O_WRONLY | O_APPEND | O_CREAT, 0666);
+	if (fd == -1)
+	{
+		rs_trace("failed to open %s: %s", +fname, strerror(errno));
+		return;
+	}
+	if (write(fd, line.data(), line.size()) != (ssize_t) line.size())
+		rs_log_warning("failed to write %s: %s", +fname, strerror(errno));
+	close(fd);
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Run "cc -x LANG -E -v -" with the options of @p args that move the include directories,
+// and read them from what it prints
+
+static bool dcc_system_include_dirs(const Arguments &args, const string &lang, vector<string> &dirs)
+{
+	string path;
+	string key = dcc_compiler_stamp(args[0], path);
+	if (key.empty())
+		return false;
+
+	Arguments probe;
+	probe << args[0];
+	for (Arguments::ConstIterator i = args.begin(); !!(++i); )
+	{
+		const text &a = *i;
+		bool next = a == "-isysroot" || a == "-target";
+		if (!next && !a.startswith("-m") && !a.startswith("--sysroot") && !a.startswith("-nostdinc")
+			&& !a.startswith("-stdlib=") && !a.startswith("--target="))
+		{
+			continue;
+		}
+		probe << a;
+		key += " " + a;
+		if (next && !!(++i))
+		{
+			probe << *i;
+			key += " " + *i;
+		}
+	}
+	probe << "-x" << lang << "-E" << "-v" << "-";
+
+	// the compiler adds the directories in these
+	static const char *vars[] = { "CPATH", "C_INCLUDE_PATH", "CPLUS_INCLUDE_PATH", "OBJC_INCLUDE_PATH", 0 };
+	key += " " + lang;
+	for (int v = 0; vars[v]; ++v)
+	{
+		const char *value = getenv(vars[v]);
+		if (value)
+			key += stringf(" %s=%s", vars[v], value);
+	}
+	for (size_t i = 0; i < key.length(); ++i)
+		if (key[i] == '\t' || key[i] == '\n')
+			key[i] = ' ';
+
+	static std::map<string, vector<string> > known;
+	std::map<string, vector<string> >::const_iterator k = known.find(key);
+	if (k != known.end())
+	{
+		dirs = k->second;
+		return true;
+	}
+	if (dcc_lookup_include_dirs(key, dirs))
+	{
+		known[key] = dirs;
+		return true;
+	}
+
+	File err = dcc_make_tmpnam("distcc", ".stderr");
+	File null(DEV_NULL);
+	proc_t pid;
+	int status;
+	if (dcc_spawn_child(probe, pid, 0, &null, &null, &err) || dcc_collect_child("cpp", pid, status) || status)
+	{
+		rs_log_warning("failed to find the include directories of %s", +args[0]);
+		return false;
+	}
+
+	string output;
+	if (!dcc_read_whole_file(err.path(), output))
+		return false;
+
+	size_t begin = output.find("#include <...> search starts here:");
+	size_t end = output.find("End of search list.");
+	if (begin == string::npos || end == string::npos || end < begin)
+	{
+		rs_log_warning("%s doesn't list its include directories", +args[0]);
+		return false;
+	}
+
+	dirs.clear();
+	begin = output.find('\n', begin) + 1;
+	for (size_t i = begin, j; i < end; i = j + 1)
+	{
+		j = output.find('\n', i);
+		string dir = output.substr(i, j - i);
+		size_t first = dir.find_first_not_of(" \t");
+		if (first == string::npos)
+			continue;
+		dir = dir.substr(first);
+		size_t framework = dir.find(" (framework directory)");
+		if (framework != string::npos)
+			dir.erase(framework);
+
+		// gcc gives them as "<prefix>/lib/gcc/<target>/<version>/../../../../include"
+		char real[PATH_MAX];
+		if (realpath(+dir, real))
+			dirs.push_back(real);
+	}
+
+	rs_trace("%s has %d include directories for %s", +args[0], (int) dirs.size(), +lang);
+	known[key] = dirs;
+	dcc_remember_include_dirs(key, dirs);
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static string dcc_source_language(const Arguments &args)
+{
+	string ext = dcc_compiler->preproc_exten(dcc_find_extension(args.input_file));
+	if (ext == ".i")
+		return "c";
+	if (ext == ".ii")
+		return "c++";
+	if (ext == ".mi")
+		return "objective-c";
+	if (ext == ".mii")
+		return "objective-c++";
+	return "";
+}
+
+//---------------------------------------------------------------------------------------------
+
+bool dcc_include_closure(const Arguments &args, IncludeClosure &closure)
+{
+	closure = IncludeClosure();
+
+	string lang = dcc_source_language(args);
+	if (lang.empty() || dcc_compiler->is_preprocessed(args.input_file))
+		return false;
+
+	char cwd[PATH_MAX];
+	if (!getcwd(cwd, sizeof(cwd)))
+	{
+		rs_log_warning("getcwd failed: %s", strerror(errno));
+		return false;
+	}
+	closure.cwd = cwd;
+	IncludeScanner scanner(closure, cwd);
+
+	// Options that read files we don't look for, or find headers in ways the server can't be shown
+	static const char *refused[] = { "@", "-B", "-I-", "-fplugin", "-fprofile-use", "-fauto-profile",
+		"-fmodule", "-iprefix", "-iwithprefix", "-imultilib", "-ivfsoverlay", 0 };
+
+	const OptionTable &options = dcc_compiler->options();
+	vector<string> isystem, idirafter, preincludes;
+	bool stdinc = true, predef = true;
+	for (Arguments::ConstIterator i = args.begin(); !!(++i); )
+	{
+		const text &a = *i;
+		bool refuse = a.startswith("-Wp,") && a.contains(",-M"); // the dependencies would stay on the server
+		for (int r = 0; refused[r] && !refuse; ++r)
+			refuse = a.startswith(refused[r]);
+		if (refuse)
+		{
+			rs_log_info("%s: can't tell what it includes; preprocessing here", +a);
+			return false;
+		}
+		if (a == "-nostdinc")
+			stdinc = false;
+		if (a == "-ffreestanding")
+			predef = false;
+
+		const CompilerOption *opt = options.find(a);
+		if (!opt || !opt->is(CompilerOption::Opt_Path | CompilerOption::Opt_Cpp))
+			continue;
+
+		string value;
+		if (!opt->separate(a))
+			value = opt->value(a);
+		else if (!!(++i))
+			value = *i;
+		else
+			return false;
+
+		string name = opt->name;
+		if (name == "-D")
+			scanner.define_arg(value);
+		else if (name == "-I")
+			scanner.bracket_dir(value);
+		else if (name == "-iquote")
+			scanner.quote_dir(value);
+		else if (name == "-isystem")
+			isystem.push_back(value);
+		else if (name == "-idirafter")
+			idirafter.push_back(value);
+		else if (name == "-include" || name == "-imacros")
+			preincludes.push_back(value);
+	}
+
+	if (!dcc_system_include_dirs(args, lang, closure.system_dirs))
+		return false;
+
+	// -I, -isystem, the compiler's own, -idirafter
+	for (size_t i = 0; i < isystem.size(); ++i)
+		scanner.bracket_dir(isystem[i]);
+	for (size_t i = 0; i < closure.system_dirs.size(); ++i)
+		scanner.bracket_dir(closure.system_dirs[i]);
+	for (size_t i = 0; i < idirafter.size(); ++i)
+		scanner.bracket_dir(idirafter[i]);
+
+	if (stdinc && predef)
+	{
+		for (size_t i = 0; i < closure.system_dirs.size() && closure.preinclude.empty(); ++i)
+		{
+			string path = closure.system_dirs[i] + "/stdc-predef.h";
+			if (access(+path, R_OK) == 0)
+				closure.preinclude = path;
+		}
+		if (!closure.preinclude.empty() && !scanner.add(closure.preinclude))
+			return false;
+	}
+
+	// -include FILE is looked for in the working directory first, then like #include "FILE"
+	for (size_t i = 0; i < preincludes.size(); ++i)
+	{
+		HeaderRef ref = { '"', preincludes[i], false };
+		string path = scanner.absolute(preincludes[i]);
+		if (access(+path, R_OK) == 0 ? !scanner.add(path) : !scanner.include(cwd, ref))
+			return false;
+	}
+
+	if (!scanner.add(scanner.absolute(args.input_file)) || !scanner.finish())
+		return false;
+
+	rs_trace("%s includes %d files, %llu bytes", +args.input_file, (int) closure.files.size(), closure.size);
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+
+#else // ! __linux__
+
+bool dcc_include_closure(const Arguments &args, IncludeClosure &closure)
+{
+	return false;
+}
+
+#endif // ! __linux__
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+Arguments dcc_pump_args(const Arguments &args, const IncludeClosure &closure)
+{
+	Arguments pump;
+	pump << args[0];
+	if (!closure.preinclude.empty())
+		pump << "-include" << closure.preinclude;
+	for (Arguments::ConstIterator i = args.begin(); !!(++i); )
+		pump << *i;
+
+	pump.input_file = args.input_file;
+	pump.output_file = args.output_file;
+	pump.pdb_file = args.pdb_file;
+
+	// Otherwise -MD writes the dependencies next to the output, which is on the server
+	pump.dotd_file = args.dotd_file;
+	if (!pump.dotd_file && (!!args.find("-MD") || !!args.find("-MMD")))
+	{
+		string out = args.output_file;
+		size_t dot = out.rfind('.');
+		if (dot != string::npos && out.find('/', dot) == string::npos)
+			out.erase(dot);
+		pump.dotd_file = out + ".d";
+		pump << "-MF" << pump.dotd_file;
+	}
+
+	// The server searches our directories, not its own
+	pump << "-nostdinc";
+	for (size_t i = 0; i < closure.system_dirs.size(); ++i)
+		pump << "-isystem" << closure.system_dirs[i];
+
+	pump.trace("pump command");
+	return pump;
+}
+
+//---------------------------------------------------------------------------------------------
+
+int dcc_x_closure(fd_t to_net_fd, fd_t from_net_fd, const IncludeClosure &closure, dcc_hostdef &host,
+	off_t &sent)
+{
+	int ret;
+	if ((ret = dcc_x_token_string(to_net_fd, "CDIR", closure.cwd))
+		|| (ret = dcc_x_token_int(to_net_fd, "NFIL", (unsigned) closure.files.size())))
+	{
+		return ret;
+	}
+
+	for (size_t i = 0; i < closure.files.size(); ++i)
+	{
+		if ((ret = dcc_x_token_string(to_net_fd, "NAME", closure.files[i]))
+			|| (ret = dcc_x_token_string(to_net_fd, "FDIG", closure.digests[i])))
+		{
+			return ret;
+		}
+	}
+
+	// The server answers with a '1' for each file it already has
+	string have;
+	tcp_cork_sock(to_net_fd, 0);
+	if ((ret = dcc_r_token_string(from_net_fd, "FHAV", have)))
+		return ret;
+	tcp_cork_sock(to_net_fd, 1);
+	if (have.length() != closure.files.size())
+	{
+		rs_log_error("protocol derailment: %d answers for %d files", (int) have.length(), (int) closure.files.size());
+		return EXIT_PROTOCOL_ERROR;
+	}
+
+	sent = 0;
+	int missing = 0;
+	for (size_t i = 0; i < closure.files.size(); ++i)
+	{
+		if (have[i] == '1')
+			continue;
+		off_t size = 0;
+		if ((ret = dcc_x_file(to_net_fd, File(closure.files[i]), "FILE", host.compr, &size)))
+			return ret;
+		sent += size;
+		++missing;
+	}
+
+	rs_trace("%s lacked %d of %d files", +host.hostname, missing, (int) closure.files.size());
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
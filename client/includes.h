@@ -0,0 +1,66 @@
+
+#ifndef _distcc_client_includes_h_
+#define _distcc_client_includes_h_
+
+#include <string>
+#include <vector>
+
+#include "common/distcc.h"
+#include "common/arg.h"
+#include "common/hosts.h"
+
+namespace distcc
+{
+
+using std::string;
+using std::vector;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+// What a job preprocessed on the server needs (host option "pump"): the source and every
+// header it may include, by absolute path, with the digests of their contents.
+//
+// The headers are found by reading the files for #include lines, ignoring conditionals,
+// so there may be more of them than the compiler will read.  One that can't be found is
+// passed over: it's usually under a condition that doesn't hold.
+
+struct IncludeClosure
+{
+	// Where the compiler runs, and relative paths start
+	string cwd;
+
+	vector<string> files;
+	vector<string> digests;
+
+	// The compiler's own include directories, which the server is told to search instead of
+	// its own (-nostdinc -isystem DIR ...)
+	vector<string> system_dirs;
+
+	// The header gcc includes before the source on its own (stdc-predef.h), which it no
+	// longer finds with -nostdinc, so it's named on the server's command line instead
+	string preinclude;
+
+	// Bytes read to find the headers
+	unsigned long long size;
+
+	IncludeClosure() : size(0) {}
+};
+
+// Find what compiling @p args reads.  Returns false if it can't tell (a header included by a
+// macro it can't follow, an option it doesn't know how to mirror), in which case the
+// source is preprocessed here as usual.
+bool dcc_include_closure(const Arguments &args, IncludeClosure &closure);
+
+// The command for the server: @p args searching the system directories of @p closure, and
+// naming the dependency file (dotd_file) if -MD leaves it to the compiler
+Arguments dcc_pump_args(const Arguments &args, const IncludeClosure &closure);
+
+// Send CDIR and the files of @p closure (NFIL), and the contents of those the server lacks
+int dcc_x_closure(fd_t to_net_fd, fd_t from_net_fd, const IncludeClosure &closure, dcc_hostdef &host,
+	off_t &sent);
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
+
+#endif // _distcc_client_includes_h_
@@ -50,11 +50,16 @@
 #include "common/exec.h"
 #include "common/lock.h"
 #include "common/bulk.h"
+#include "common/hash.h"
+#include "common/timeline.h"
+#include "common/toolchain.h"
 
 #include "client/client.h"
 #include "client/clinet.h"
 #include "client/compile.h"
 #include "client/dopt.h"
+#include "client/includes.h"
+#include "client/toolenv.h"
 
 #include "rvfc/text/defs.h"
 #include "rvfc/filesys/defs.h"
@@ -133,16 +138,31 @@ dcc_wait_for_cpp(const proc_t &cpp_pid, int &status, const File &input_fname)
 // We wait for it to complete before reading its output.
 
 static int
-dcc_send_header(fd_t net_fd, const Arguments &args, dcc_hostdef &host, bool on_server, const string &session)
+dcc_send_header(fd_t net_fd, const Arguments &args, dcc_hostdef &host, bool on_server, bool pumped,
+	const string &session, const string &toolchain)
 {
     int ret;
-	unsigned flags = on_server ? CMD_FLAGS_ON_SERVER : 0;
+	unsigned flags = on_server ? CMD_FLAGS_ON_SERVER : pumped ? CMD_FLAGS_PUMP : 0;
+	if (host.accept_busy)
+		flags |= CMD_FLAGS_ACCEPT_BUSY;
+	if (host.send_digest && !on_server && !pumped)
+		flags |= CMD_FLAGS_DOTI_DIGEST;
+	if (host.want_usage)
+		flags |= CMD_FLAGS_RUSAGE;
+	if (host.send_job_id && dcc_timeline_enabled())
+		flags |= CMD_FLAGS_JOB_ID;
+	if (host.send_toolchain && !toolchain.empty())
+		flags |= CMD_FLAGS_TOOLCHAIN;
+	if (host.ship_toolchain && !toolchain.empty())
+		flags |= CMD_FLAGS_SHIP_TOOLCHAIN;
 
     tcp_cork_sock(net_fd, 1);
 
 	if ((ret = dcc_x_req_header(net_fd, host.protover))
 		|| (ret = dcc_x_session_name(net_fd, +session))
 		|| (ret = dcc_x_flags(net_fd, flags))
+		|| ((flags & CMD_FLAGS_JOB_ID) && (ret = dcc_x_job_id(net_fd, dcc_timeline_job_id())))
+		|| ((flags & CMD_FLAGS_TOOLCHAIN) && (ret = dcc_x_toolchain(net_fd, toolchain)))
         || (ret = dcc_x_argv(net_fd, args)))
 	{
         return ret;
@@ -151,6 +171,69 @@ dcc_send_header(fd_t net_fd, const Arguments &args, dcc_hostdef &host, bool on_s
     return 0;
 }
 
+//---------------------------------------------------------------------------------------------
+// The server lacks our compiler: send it over if the server takes compilers, and read which
+// one it has now into @p theirs
+
+static int
+dcc_ship_toolchain(fd_t to_net_fd, fd_t from_net_fd, const string &compiler_name, const string &toolchain,
+	dcc_hostdef &host, string &theirs)
+{
+	int ret;
+	unsigned take;
+	if ((ret = dcc_r_token_int(from_net_fd, "SHIP", take)) || !take)
+		return ret;
+
+	// an empty digest tells the server we couldn't pack it up
+	File archive = dcc_toolchain_archive(compiler_name, toolchain);
+	string digest = !archive ? string("") : dcc_hash_file(archive);
+
+	tcp_cork_sock(to_net_fd, 1);
+	if ((ret = dcc_x_token_string(to_net_fd, "ENVD", digest)))
+		return ret;
+	if (!digest.empty())
+	{
+		rs_log_info("sending compiler %s to %s", +toolchain, +host.hostname);
+		// already compressed
+		if ((ret = dcc_x_file(to_net_fd, archive, "ENVA", DCC_COMPRESS_NONE, 0)))
+			return ret;
+	}
+	tcp_cork_sock(to_net_fd, 0);
+
+	return dcc_r_toolchain(from_net_fd, theirs);
+}
+
+//---------------------------------------------------------------------------------------------
+// Send the preprocessed source, unless the server already has it
+
+static int
+dcc_x_input(fd_t to_net_fd, fd_t from_net_fd, const File &cpp_fname, dcc_hostdef &host, off_t &doti_size)
+{
+	int ret;
+	if (host.send_digest)
+	{
+		string digest = dcc_hash_file(cpp_fname);
+		bool have;
+
+		// the server needs to see the digest now to answer
+		if ((ret = dcc_x_token_string(to_net_fd, "DIGI", digest)))
+			return ret;
+		tcp_cork_sock(to_net_fd, 0);
+		if ((ret = dcc_r_have_input(from_net_fd, have)))
+			return ret;
+		tcp_cork_sock(to_net_fd, 1);
+
+		if (have)
+		{
+			rs_trace("%s already has %s", +host.hostname, +cpp_fname.path());
+			doti_size = 0;
+			return 0;
+		}
+	}
+
+	return dcc_x_file(to_net_fd, cpp_fname, "DOTI", host.compr, &doti_size);
+}
+
 //---------------------------------------------------------------------------------------------
 
 /**
@@ -181,6 +264,10 @@ dcc_send_header(fd_t net_fd, const Arguments &args, dcc_hostdef &host, bool on_s
  * Returns 0 on success, otherwise error.  Returning nonzero does not
  * necessarily imply the remote compiler itself succeeded, only that
  * there were no communications problems.
+ *
+ * Returns EXIT_BUSY if the server refused the job as too busy, or
+ * EXIT_WRONG_TOOLCHAIN if its compiler is not ours; nothing has been sent
+ * yet then, and cpp is left running for the next attempt.
  */
 
 int
@@ -212,12 +299,65 @@ Client::compile_remote(Arguments &args, const File &cpp_fname,
 	// This waits for cpp and puts its status in *status.  If cpp failed, then
 	// the connection will have been dropped and we need not bother trying to
 	// get any response from the server.
-    ret = dcc_send_header(to_net_fd, args, host, config.on_server, config.session);
+    ret = dcc_send_header(to_net_fd, args, host, config.on_server, pumped, config.session, toolchain);
+
+	if (ret == 0 && host.accept_busy)
+	{
+		// The server answers as soon as it has seen our flags.
+		// If it's saturated, give up on it now: the caller will try another host.
+		unsigned wait_secs;
+		tcp_cork_sock(to_net_fd, 0);
+		if ((ret = dcc_r_admission(from_net_fd, wait_secs)))
+		{
+			if (ret == EXIT_BUSY)
+			{
+				rs_log_info("%s is busy, estimated wait %us", +host.hostname, wait_secs);
+				host.note_busy(wait_secs);
+			}
+			if (dcc_fd_cmp(to_net_fd, from_net_fd))
+				dcc_close(to_net_fd);
+			dcc_close(from_net_fd);
+			goto out;
+		}
+		tcp_cork_sock(to_net_fd, 1);
+	}
+
+	if (ret == 0 && host.send_toolchain && !toolchain.empty())
+	{
+		// The server tells which compiler it would run before we send the input.
+		// If it isn't ours, the object would differ from a local build: send ours, with 
+		// the ship option, or go elsewhere.
+		string theirs;
+		tcp_cork_sock(to_net_fd, 0);
+		ret = dcc_r_toolchain(from_net_fd, theirs);
+		if (ret == 0 && theirs != toolchain && host.ship_toolchain)
+			ret = dcc_ship_toolchain(to_net_fd, from_net_fd, args[0], toolchain, host, theirs);
+		if (ret == 0 && theirs != toolchain)
+		{
+			rs_log_warning("%s has compiler %s, not %s; not using it for %s",
+				+host.hostname, theirs.empty() ? "(none)" : +theirs, +toolchain, +args[0]);
+			host.note_wrong_toolchain(toolchain);
+			ret = EXIT_WRONG_TOOLCHAIN;
+		}
+		if (ret)
+		{
+			if (dcc_fd_cmp(to_net_fd, from_net_fd))
+				dcc_close(to_net_fd);
+			dcc_close(from_net_fd);
+			goto out;
+		}
+		tcp_cork_sock(to_net_fd, 1);
+	}
 
-	if (!config.on_server)
+	if (pumped)
+	{
+		if ((ret = dcc_x_closure(to_net_fd, from_net_fd, closure, host, doti_size)))
+			goto out;
+	}
+	else if (!config.on_server)
 	{
 		if ((ret = dcc_wait_for_cpp(cpp_pid, status, args.input_file))
-			|| (ret = dcc_x_file(to_net_fd, cpp_fname, "DOTI", host.compr, &doti_size)))
+			|| (ret = dcc_x_input(to_net_fd, from_net_fd, cpp_fname, host, doti_size)))
 			goto out;
 	}
 	else
@@ -243,6 +383,7 @@ Client::compile_remote(Arguments &args, const File &cpp_fname,
 	// OK, now all of the source has at least made it into the
 	// client's TCP transmission queue, sometime soon the server will
 	// start compiling it.
+	dcc_note_state_bytes(doti_size, 0);
 	dcc_note_state(DCC_PHASE_COMPILE, File(), host.hostname);
 
     if (dcc_fd_cmp(to_net_fd, from_net_fd)) 
@@ -271,6 +412,13 @@ Client::compile_remote(Arguments &args, const File &cpp_fname,
 		rs_log(RS_LOG_INFO|RS_LOG_NONAME,
 			"%lu bytes from %s compiled on %s in %.4fs, rate %.0fkB/s",
 			(unsigned long) doti_size, +args.input_file, +host.hostname, secs, rate);
+		if (host.want_usage && ret == 0)
+		{
+			rs_log(RS_LOG_INFO|RS_LOG_NONAME,
+				"%s on %s: compiler ran %.3fs, user %.3fs, sys %.3fs, max rss %lukB",
+				+args.input_file, +host.hostname, server_usage.wall_msecs / 1000.0,
+				server_usage.user_msecs / 1000.0, server_usage.sys_msecs / 1000.0, server_usage.max_rss_kb);
+		}
     }
 
 out:
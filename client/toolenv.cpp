@@ -0,0 +1,266 @@
+/**
+ * @file
+ *
+ * Packing up the compiler, for hosts that don't have it.
+ **/
+
+#include "common/config.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/file.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/stat.h>
+
+#include <vector>
+#include <set>
+#include <algorithm>
+
+#include "common/distcc.h"
+#include "common/trace.h"
+#include "common/exec.h"
+#include "common/state.h"
+#include "common/objcache.h"
+#include "common/toolchain.h"
+
+#include "client/toolenv.h"
+
+#include "rvfc/text/defs.h"
+
+namespace distcc
+{
+
+using namespace rvfc::Text;
+using std::vector;
+using std::set;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef __linux__
+
+// What the command writes to stdout, or an empty string if it fails
+
+static string dcc_output_of(const Arguments &args)
+{
+	File out = dcc_make_tmpnam("distcc", ".out");
+	File null(DEV_NULL);
+	proc_t pid;
+	int status;
+	if (dcc_spawn_child(args, pid, 0, &null, &out, &null)
+		|| dcc_collect_child(args[0], pid, status) || status)
+	{
+		return "";
+	}
+
+	string s;
+	FILE *f = fopen(+out.path(), "r");
+	if (!f)
+		return "";
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		s.append(buf, n);
+	fclose(f);
+	return s;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static string dcc_dirname(const string &path)
+{
+	size_t slash = path.rfind('/');
+	return slash == 0 || slash == string::npos ? string("/") : path.substr(0, slash);
+}
+
+//---------------------------------------------------------------------------------------------
+
+// The C library comes with the system, and must match its dynamic loader: it's left out
+
+static bool dcc_system_library(const string &path)
+{
+	static const char *const system_libs[] =
+	{
+		"ld-linux", "ld64.so", "libc.so", "libm.so", "libdl.so", "libpthread.so", "librt.so", 0
+	};
+	size_t slash = path.rfind('/');
+	string name = slash == string::npos ? path : path.substr(slash + 1);
+	for (int i = 0; system_libs[i]; ++i)
+		if (!name.compare(0, strlen(system_libs[i]), system_libs[i]))
+			return true;
+	return false;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Add the shared libraries @p program needs to @p files, as ldd finds them
+
+static void dcc_add_libraries(const string &program, set<string> &files, ToolchainEnv &env)
+{
+	Arguments ldd;
+	ldd.append("ldd");
+	ldd.append(program);
+	string out = dcc_output_of(ldd);
+
+	// "\tlibgmp.so.10 => /lib/x86_64-linux-gnu/libgmp.so.10 (0x00007f...)"
+	for (size_t p = 0; (p = out.find("=> /", p)) != string::npos; )
+	{
+		p += 3;
+		size_t end = out.find_first_of(" \n", p);
+		string lib = out.substr(p, end == string::npos ? string::npos : end - p);
+		if (dcc_system_library(lib) || !files.insert(lib).second)
+			continue;
+
+		string dir = dcc_dirname(lib);
+		if (std::find(env.lib.begin(), env.lib.end(), dir) == env.lib.end())
+			env.lib.push_back(dir);
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Make the archive at @p fname: the driver, the programs it runs for a compilation, and
+// their libraries
+
+static bool dcc_make_toolchain_archive(const string &compiler_name, const string &toolchain, const string &fname)
+{
+	ToolchainEnv env;
+	env.fingerprint = toolchain;
+	if (dcc_compiler_stamp(compiler_name, env.driver).empty() || env.driver[0] != '/')
+	{
+		rs_log_warning("can't find %s to send it", +compiler_name);
+		return false;
+	}
+
+	set<string> files;
+	files.insert(env.driver);
+
+	static const char *const programs[] = { "cc1", "cc1plus", "as", 0 };
+	for (int i = 0; programs[i]; ++i)
+	{
+		Arguments print;
+		print.append(env.driver);
+		print.append(stringf("-print-prog-name=%s", programs[i]));
+		string prog = dcc_output_of(print);
+		while (!prog.empty() && (prog[prog.size() - 1] == '\n' || prog[prog.size() - 1] == '\r'))
+			prog.erase(prog.size() - 1);
+
+		// gcc names the programs it has with it; others, like as, are looked for on the PATH
+		string path;
+		if (prog.empty() || dcc_compiler_stamp(prog, path).empty())
+			continue;
+		files.insert(path);
+		if (prog.find('/') == string::npos)
+			env.path.push_back(dcc_dirname(path));
+	}
+
+	vector<string> programs_found(files.begin(), files.end());
+	for (size_t i = 0; i < programs_found.size(); ++i)
+		dcc_add_libraries(programs_found[i], files, env);
+
+	// the manifest goes at the top of the archive
+	string dir = stringf("%s/distcc-env-%ld", +dcc_get_tmp_top(), (long) getpid());
+	string manifest = dir + "/" + ToolchainEnv::manifest_name;
+	mkdir(+dir, 0700);
+	FILE *f = fopen(+manifest, "w");
+	if (!f)
+	{
+		rs_log_warning("failed to create %s: %s", +manifest, strerror(errno));
+		rmdir(+dir);
+		return false;
+	}
+	string contents = env.to_string();
+	fwrite(contents.data(), 1, contents.size(), f);
+	fclose(f);
+
+	// -h: the libraries are named by their links, and stored under those names
+	Arguments tar;
+	tar.append("tar");
+	tar.append("-czhf");
+	tar.append(fname);
+	tar.append("-C");
+	tar.append("/");
+	for (set<string>::iterator i = files.begin(); i != files.end(); ++i)
+		tar.append(i->substr(1));
+	tar.append("-C");
+	tar.append(dir);
+	tar.append(ToolchainEnv::manifest_name);
+
+	proc_t pid;
+	int status = 0;
+	File null(DEV_NULL);
+	int ret = dcc_spawn_child(tar, pid, 0, &null, 0, 0);
+	if (!ret)
+		ret = dcc_collect_child("tar", pid, status);
+
+	unlink(+manifest);
+	rmdir(+dir);
+
+	if (ret || status)
+	{
+		rs_log_warning("failed to pack up %s", +env.driver);
+		return false;
+	}
+	rs_log_info("packed up %s (%d files) as %s", +env.driver, (int) files.size(), +fname);
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+
+File dcc_toolchain_archive(const string &compiler_name, const string &toolchain)
+{
+	if (!dcc_state_dir)
+		return File();
+
+	string dir = stringf("%s/envs", +dcc_state_dir.path());
+	mkdir(+dir, 0777);
+	string fname = stringf("%s/%s.tar.gz", +dir, +dcc_toolchain_key(toolchain));
+
+	struct stat st;
+	if (stat(+fname, &st) == 0)
+		return File(fname);
+
+	// Packing up takes a few seconds; the others building at the same time wait for it
+	string lock_name = fname + ".lock";
+	int lock_fd = open(+lock_name, O_WRONLY | O_CREAT, 0666);
+	if (lock_fd == -1 || flock(lock_fd, LOCK_EX) == -1)
+	{
+		rs_log_warning("failed to lock %s: %s", +lock_name, strerror(errno));
+		if (lock_fd != -1)
+			close(lock_fd);
+		return File();
+	}
+
+	bool ok = stat(+fname, &st) == 0;
+	if (!ok)
+	{
+		string temp = stringf("%s.%ld", +fname, (long) getpid());
+		ok = dcc_make_toolchain_archive(compiler_name, toolchain, temp) && rename(+temp, +fname) == 0;
+		if (!ok)
+			unlink(+temp);
+	}
+	close(lock_fd);
+
+	return ok ? File(fname) : File();
+}
+
+//---------------------------------------------------------------------------------------------
+
+#else // ! __linux__
+
+File dcc_toolchain_archive(const string &compiler_name, const string &toolchain)
+{
+	return File();
+}
+
+#endif // ! __linux__
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
@@ -0,0 +1,29 @@
+
+#ifndef _distcc_client_toolenv_h_
+#define _distcc_client_toolenv_h_
+
+#include <string>
+
+#include "rvfc/filesys/defs.h"
+
+namespace distcc
+{
+
+using std::string;
+using rvfc::File;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+// The archive of our compiler with the fingerprint @p toolchain, for hosts that lack it
+// (host option "ship"; see ToolchainEnv).  It's made the first time it's needed and kept
+// in the directory "envs" of the state directory; clients wanting it at the same time
+// wait for the one making it.
+// Returns an empty File if the compiler couldn't be packed up.
+
+File dcc_toolchain_archive(const string &compiler_name, const string &toolchain);
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
+
+#endif // _distcc_client_toolenv_h_
@@ -139,22 +139,37 @@ void HostDefs::lock_pause()
 // This function does not return (except for errors) until a host has been selected.  
 // If necessary it sleeps until one is free.
 
+// Hosts known to have another compiler than @p toolchain (our own) are not considered;
+// if that leaves none, we throw, and the caller compiles locally.
+
 // @todo We don't need transmit locks for local operations.
 
-dcc_hostdef HostDefs::lock_one(int &cpu_lock_fd)
+dcc_hostdef HostDefs::lock_one(int &cpu_lock_fd, const string &toolchain)
 {
     int ret;
 
-	int num_hosts = _hosts.size();
-
     for (;;)
 	{
+		vector<dcc_hostdef*> compatible;
+		for (HostsList::iterator host_i = _hosts.begin(); host_i != _hosts.end(); ++host_i)
+			if (!host_i->check_toolchain(toolchain))
+				compatible.push_back(&*host_i);
+		if (compatible.empty())
+			throw "no host has our compiler";
+
+		// Pass over servers that recently turned us away as busy, unless they all did
+		vector<dcc_hostdef*> candidates;
+		for (size_t i = 0; i < compatible.size(); ++i)
+			if (!compatible[i]->check_busy())
+				candidates.push_back(compatible[i]);
+		if (candidates.empty())
+			candidates = compatible;
+
+		int num_hosts = candidates.size();
+
         for (int cpu = 0; cpu < 50; ++cpu) 
 		{
-			vector<dcc_hostdef*> hosts_tab(num_hosts);
-			int i = 0;
-			for (HostsList::iterator host_i = _hosts.begin(); host_i != _hosts.end(); ++host_i)
-				hosts_tab[i++] = &*host_i;
+			vector<dcc_hostdef*> hosts_tab = candidates;
 
             for (int m = num_hosts - 1; m >= 0; --m) 
 			{
@@ -188,6 +203,16 @@ dcc_hostdef HostDefs::lock_one(int &cpu_lock_fd)
 
 //---------------------------------------------------------------------------------------------
 
+bool HostDefs::want_toolchain() const
+{
+	for (HostsList::const_iterator host_i = _hosts.begin(); host_i != _hosts.end(); ++host_i)
+		if (host_i->send_toolchain)
+			return true;
+	return false;
+}
+
+//---------------------------------------------------------------------------------------------
+
 // Lock localhost. Used to get the right balance of jobs when some of them must be local.
 
 dcc_hostdef Client::lock_local(int &cpu_lock_fd)
@@ -0,0 +1,406 @@
+/**
+ * @file
+ *
+ * Logger that writes from a background thread.
+ *
+ * Messages are formatted by the caller into a ring buffer of bounded size, and written out
+ * by a flusher thread, so that logging doesn't wait for the disk.  Any number of threads may
+ * log; space is claimed with a compare-and-swap, and no lock is taken.  When the buffer is
+ * full, messages are dropped and counted, and the count is logged once there's room again.
+ *
+ * The flusher doesn't survive fork(), so after a fork the logger writes synchronously (like
+ * rs_logger_file()) until rs_async_log_start() is called again in the new process.
+ * What was queued but not yet written when the process forked is written by the parent only.
+ **/
+
+#include "config.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+
+#include "trace.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef __linux__
+
+// Each message is a header and the text, padded to a multiple of the header size.
+// A message never wraps around the end of the buffer; the space up to the end is taken by a
+// padding record instead.  Free space is kept zeroed, so ready is clear until the message is.
+
+struct rs_async_record
+{
+	unsigned len;
+	int fd;                 // -1 for padding
+	volatile unsigned ready;
+	unsigned unused;
+};
+
+enum
+{
+	rs_record_align = sizeof(rs_async_record),
+	rs_flush_msecs = 20,    // how long messages may sit in the buffer
+	rs_max_iov = 64
+};
+
+static char *ring = 0;
+static size_t ring_size = 0;
+
+// Byte offsets since the start; they only grow
+static volatile unsigned long long ring_head = 0, ring_tail = 0;
+
+static volatile int async_active = 0;
+static volatile unsigned long async_dropped = 0, reported_dropped = 0;
+static int wake_pipe[2] = { -1, -1 };
+
+// The file descriptors written to, for rs_async_log_flush()
+static int seen_fds[8];
+static volatile int n_seen_fds = 0;
+
+//---------------------------------------------------------------------------------------------
+
+static size_t rs_record_space(size_t len)
+{
+	return (sizeof(rs_async_record) + len + rs_record_align - 1) / rs_record_align * rs_record_align;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void rs_async_wake()
+{
+	char c = 0;
+	(void) write(wake_pipe[1], &c, 1);
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void rs_write_fully(int fd, const char *buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = write(fd, buf, len);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return; // nowhere to complain to
+		buf += n;
+		len -= n;
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void rs_note_fd(int fd)
+{
+	for (int i = 0; i < n_seen_fds; ++i)
+		if (seen_fds[i] == fd)
+			return;
+	if (n_seen_fds < (int) (sizeof(seen_fds) / sizeof(seen_fds[0])))
+	{
+		seen_fds[n_seen_fds] = fd;
+		__sync_synchronize();
+		++n_seen_fds;
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Write out what's ready, a batch of consecutive messages to the same file at a time
+
+static void rs_async_drain()
+{
+	unsigned long long tail = ring_tail;
+
+	for (;;)
+	{
+		struct iovec iov[rs_max_iov];
+		int n_iov = 0, fd = -1;
+		size_t total = 0;
+		unsigned long long end = tail;
+
+		while (n_iov < rs_max_iov)
+		{
+			rs_async_record *r = (rs_async_record *) (ring + (end & (ring_size - 1)));
+			if (!__atomic_load_n(&r->ready, __ATOMIC_ACQUIRE))
+				break;
+			if (r->fd != -1)
+			{
+				if (fd != -1 && r->fd != fd)
+					break;
+				fd = r->fd;
+				iov[n_iov].iov_base = (char *) (r + 1);
+				iov[n_iov].iov_len = r->len;
+				total += r->len;
+				++n_iov;
+			}
+			end += rs_record_space(r->len);
+		}
+
+		if (end == tail)
+			break;
+
+		if (n_iov)
+		{
+			ssize_t n;
+			do
+				n = writev(fd, iov, n_iov);
+			while (n == -1 && errno == EINTR);
+
+			// finish a short write piece by piece
+			size_t done = n > 0 ? n : 0;
+			for (int i = 0; i < n_iov && done < total; ++i)
+			{
+				if (done >= iov[i].iov_len)
+				{
+					done -= iov[i].iov_len;
+					total -= iov[i].iov_len;
+					continue;
+				}
+				rs_write_fully(fd, (char *) iov[i].iov_base + done, iov[i].iov_len - done);
+				total -= iov[i].iov_len;
+				done = 0;
+			}
+			rs_note_fd(fd);
+		}
+
+		// Free the space: zeroed, so that new messages start out not ready
+		while (tail != end)
+		{
+			rs_async_record *r = (rs_async_record *) (ring + (tail & (ring_size - 1)));
+			size_t space = rs_record_space(r->len);
+			memset(r, 0, space);
+			tail += space;
+		}
+		__atomic_store_n(&ring_tail, tail, __ATOMIC_RELEASE);
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void rs_report_dropped()
+{
+	unsigned long dropped = async_dropped;
+	if (dropped == reported_dropped || !n_seen_fds)
+		return;
+
+	char buf[200];
+	snprintf(buf, sizeof(buf), "%s[%d] Warning: log buffer full, %lu messages dropped\n",
+		rs_program_name, (int) getpid(), dropped - reported_dropped);
+	rs_write_fully(seen_fds[0], buf, strlen(buf));
+	reported_dropped = dropped;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void *rs_async_flusher(void *)
+{
+	struct pollfd pfd;
+	pfd.fd = wake_pipe[0];
+	pfd.events = POLLIN;
+
+	for (;;)
+	{
+		rs_async_drain();
+		rs_report_dropped();
+
+		if (poll(&pfd, 1, rs_flush_msecs) > 0)
+		{
+			char buf[64];
+			while (read(wake_pipe[0], buf, sizeof(buf)) > 0)
+				;
+		}
+	}
+	return 0;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void rs_async_after_fork()
+{
+	// the flusher wasn't forked along
+	async_active = 0;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void rs_async_at_exit()
+{
+	rs_async_log_flush(0);
+}
+
+//---------------------------------------------------------------------------------------------
+
+int rs_async_log_start(size_t buffer_size)
+{
+	static bool registered = false;
+
+	if (async_active)
+		return 1;
+
+	size_t size = 64 << 10; // room for the longest messages
+	while (size < buffer_size)
+		size *= 2;
+
+	// Start afresh: anything left over belongs to the parent
+	if (ring)
+		munmap(ring, ring_size);
+	if (wake_pipe[0] != -1)
+	{
+		close(wake_pipe[0]);
+		close(wake_pipe[1]);
+	}
+	ring_head = ring_tail = 0;
+	async_dropped = reported_dropped = 0;
+	n_seen_fds = 0;
+
+	void *p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+	{
+		ring = 0;
+		rs_log_warning("failed to allocate log buffer: %s", strerror(errno));
+		return 0;
+	}
+	ring = (char *) p;
+	ring_size = size;
+
+	if (pipe2(wake_pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+	{
+		wake_pipe[0] = wake_pipe[1] = -1;
+		rs_log_warning("failed to create pipe: %s", strerror(errno));
+		return 0;
+	}
+
+	if (!registered)
+	{
+		pthread_atfork(0, 0, rs_async_after_fork);
+		atexit(rs_async_at_exit);
+		registered = true;
+	}
+
+	pthread_t thread;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	int err = pthread_create(&thread, &attr, rs_async_flusher, 0);
+	pthread_attr_destroy(&attr);
+	if (err)
+	{
+		rs_log_warning("failed to start log flusher: %s", strerror(err));
+		return 0;
+	}
+
+	async_active = 1;
+	return 1;
+}
+
+//---------------------------------------------------------------------------------------------
+
+void rs_async_log_flush(int do_fsync)
+{
+	if (!async_active)
+		return;
+
+	unsigned long long head = ring_head;
+	rs_async_wake();
+	while (__atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) < head)
+		poll(0, 0, 1);
+
+	if (do_fsync)
+		for (int i = 0; i < n_seen_fds; ++i)
+			fdatasync(seen_fds[i]);
+}
+
+//---------------------------------------------------------------------------------------------
+
+unsigned long rs_async_log_dropped()
+{
+	return async_dropped;
+}
+
+//---------------------------------------------------------------------------------------------
+
+void
+rs_logger_async(int flags, const char *file, int line, char const *fmt, va_list va,
+	void *private_ptr, int log_fd)
+{
+	if (!async_active)
+	{
+		rs_logger_file(flags, file, line, fmt, va, private_ptr, log_fd);
+		return;
+	}
+
+	char buf[4096];
+	rs_format_msg(buf, sizeof(buf) - 1, flags, file, line, fmt, va);
+	size_t len = strlen(buf);
+	buf[len++] = '\n';
+
+	// Claim the space; padding first if the message doesn't fit before the end
+	size_t space = rs_record_space(len), pad;
+	unsigned long long head;
+	for (;;)
+	{
+		head = ring_head;
+		unsigned long long tail = __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE);
+		size_t offset = head & (ring_size - 1);
+		pad = offset + space > ring_size ? ring_size - offset : 0;
+		if (head + pad + space - tail > ring_size)
+		{
+			__sync_add_and_fetch(&async_dropped, 1);
+			return;
+		}
+		if (__sync_bool_compare_and_swap(&ring_head, head, head + pad + space))
+			break;
+	}
+
+	if (pad)
+	{
+		rs_async_record *r = (rs_async_record *) (ring + (head & (ring_size - 1)));
+		r->len = pad - sizeof(rs_async_record);
+		r->fd = -1;
+		__atomic_store_n(&r->ready, 1, __ATOMIC_RELEASE);
+		head += pad;
+	}
+
+	rs_async_record *r = (rs_async_record *) (ring + (head & (ring_size - 1)));
+	r->len = len;
+	r->fd = log_fd;
+	memcpy(r + 1, buf, len);
+	__atomic_store_n(&r->ready, 1, __ATOMIC_RELEASE);
+
+	// Don't wait for the flusher to come round if the buffer is filling up
+	if (head + space - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) > ring_size / 2)
+		rs_async_wake();
+}
+
+//---------------------------------------------------------------------------------------------
+
+#else // ! __linux__
+
+// No flusher thread; messages are written as they come
+
+int rs_async_log_start(size_t buffer_size) { return 0; }
+void rs_async_log_flush(int do_fsync) {}
+unsigned long rs_async_log_dropped() { return 0; }
+
+void
+rs_logger_async(int flags, const char *file, int line, char const *fmt, va_list va,
+	void *private_ptr, int log_fd)
+{
+	rs_logger_file(flags, file, line, fmt, va, private_ptr, log_fd);
+}
+
+#endif // ! __linux__
+
+///////////////////////////////////////////////////////////////////////////////////////////////
@@ -45,6 +45,7 @@
 #ifdef __linux__
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #endif
 
 #include <stdio.h>
@@ -241,6 +242,40 @@ failed:
 
 //---------------------------------------------------------------------------------------------
 
+// Transmit a block of memory the way dcc_x_file() transmits a file
+
+int dcc_x_buf(fd_t ofd, const char *buf, size_t len, const char *token, enum dcc_compress compression)
+{
+	rs_trace("send %lu bytes with token %s", (unsigned long) len, token);
+
+	if (compression == DCC_COMPRESS_NONE || len == 0)
+	{
+		int ret;
+		if ((ret = dcc_x_token_int(ofd, token, len)))
+			return ret;
+		return len ? dcc_writex(ofd, buf, len) : 0;
+	}
+
+	if (compression == DCC_COMPRESS_LZO1X) 
+	{
+		char *out_buf = NULL;
+		size_t out_len;
+		int ret;
+		if (!(ret = dcc_compress_lzo1x_alloc(buf, len, &out_buf, &out_len))
+			&& !(ret = dcc_x_token_int(ofd, token, out_len)))
+		{
+			ret = dcc_writex(ofd, out_buf, out_len);
+		}
+		free(out_buf);
+		return ret;
+	}
+
+	rs_log_error("invalid compression");
+	return EXIT_PROTOCOL_ERROR;
+}
+
+//---------------------------------------------------------------------------------------------
+
 // Receive a file stream from the network into a local file.  
 //
 // Can handle compression.
@@ -341,6 +376,117 @@ int dcc_r_file_timed(fd_t ifd, File &fname, unsigned size, enum dcc_compress com
 
 //---------------------------------------------------------------------------------------------
 
+#ifdef __linux__
+
+static bool dcc_write_all(int fd, const char *buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t n = write(fd, buf, len);
+		if (n == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+// Open the writing end of a fifo once @p reader (or one of its children) has opened it for 
+// reading.  Returns -1 if the reader exits or doesn't get around to it.
+
+static int dcc_open_fifo(const string &fifo_name, pid_t reader)
+{
+	const int timeout_msecs = 30000, poll_msecs = 5;
+
+	for (int waited = 0; waited < timeout_msecs; waited += poll_msecs)
+	{
+		int fd = open(+fifo_name, O_WRONLY | O_NONBLOCK);
+		if (fd != -1)
+		{
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+			return fd;
+		}
+		if (errno != ENXIO)
+		{
+			rs_log_error("failed to open fifo %s: %s", +fifo_name, strerror(errno));
+			return -1;
+		}
+
+		// Look, but leave the exit status for dcc_collect_child
+		siginfo_t info;
+		info.si_pid = 0;
+		if (waitid(P_PID, reader, &info, WEXITED | WNOHANG | WNOWAIT) == -1 || info.si_pid)
+		{
+			rs_trace("%d exited without opening %s", (int) reader, +fifo_name);
+			return -1;
+		}
+		usleep(poll_msecs * 1000);
+	}
+
+	rs_log_warning("gave up waiting for %d to open %s", (int) reader, +fifo_name);
+	return -1;
+}
+
+//---------------------------------------------------------------------------------------------
+
+/**
+ * Receive @p len bytes of uncompressed input from the network and feed them to a 
+ * compiler reading @p fifo_name as they arrive, so that the compiler parses while the 
+ * rest is still in transit.
+ *
+ * A copy of everything is written to @p copy_fd, and all of the input is read from the 
+ * network even if the compiler stops reading.  On return @p fed says whether the compiler 
+ * took all of it; if not, the caller can run it again on the copy.
+ **/
+
+int dcc_r_fifo(fd_t ifd, const string &fifo_name, size_t len, int copy_fd, pid_t reader, bool &fed)
+{
+	fed = false;
+	int fifo_fd = reader > 0 ? dcc_open_fifo(fifo_name, reader) : -1;
+
+	int ret = 0;
+	char buf[65536];
+	while (len > 0)
+	{
+		size_t n = len < sizeof(buf) ? len : sizeof(buf);
+		if ((ret = dcc_readx(ifd, buf, n)))
+			break;
+
+		if (!dcc_write_all(copy_fd, buf, n))
+		{
+			rs_log_error("failed to write input copy: %s", strerror(errno));
+			ret = EXIT_IO_ERROR;
+			break;
+		}
+
+		// EPIPE: the compiler has gone away
+		if (fifo_fd != -1 && !dcc_write_all(fifo_fd, buf, n))
+		{
+			rs_trace("compiler stopped reading %s: %s", +fifo_name, strerror(errno));
+			close(fifo_fd);
+			fifo_fd = -1;
+		}
+		len -= n;
+	}
+
+	if (fifo_fd != -1)
+	{
+		// end of file for the compiler
+		close(fifo_fd);
+		fed = !ret;
+	}
+	return ret;
+}
+
+#endif // __linux__
+
+//---------------------------------------------------------------------------------------------
+
 int dcc_r_token_file(fd_t ifd, const char *token, File &file, 
 	unsigned &size, enum dcc_compress compr)
 {
@@ -24,10 +24,13 @@ namespace distcc
 {
 
 int dcc_x_file(fd_t ofd, const File &fname, const char *token, enum dcc_compress compression, off_t *);
+int dcc_x_buf(fd_t ofd, const char *buf, size_t len, const char *token, enum dcc_compress compression);
 
 int dcc_r_file(fd_t ifd, File &filename, unsigned, enum dcc_compress);
 int dcc_r_file_timed(fd_t ifd, File &fname, unsigned size, enum dcc_compress);
-int dcc_r_fifo(fd_t ifd, const string &fifo_name, size_t len);
+#ifdef __linux__
+int dcc_r_fifo(fd_t ifd, const string &fifo_name, size_t len, int copy_fd, pid_t reader, bool &fed);
+#endif
 
 int dcc_r_token_file(fd_t ifd, const char *token, File &fname, unsigned int &size, enum dcc_compress compr);
 int dcc_r_token_bulk(fd_t in_fd, const char *token, fd_t out_fd, enum dcc_compress compr);
@@ -19,6 +19,7 @@
 #include "exitcode.h"
 
 #include "compiler.h"
+#include "cc-options.h"
 
 namespace distcc
 {
@@ -64,6 +65,39 @@ bool DiabCompiler::is_object(const string &filename) const
 // Diab stuff
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
+typedef CompilerOption Opt;
+
+static const CompilerOption diab_options[] =
+{
+	{ "-E",                          Opt::Arg_None,   Opt::Opt_Local, "-E call for cpp must be local" },
+
+	// Generate dependencies as a side effect. They should work with the way we call cpp.
+	{ "-Xmake-dependency-savefile=", Opt::Arg_Joined, Opt::Opt_Cpp | Opt::Opt_DotD },
+	{ "-Xmake-dependency",           Opt::Arg_Joined, Opt::Opt_Cpp },
+
+	{ "-c",                          Opt::Arg_None,   Opt::Opt_Compile },
+	{ "-S",                          Opt::Arg_None,   Opt::Opt_Assemble },
+	{ "-o",                          Opt::Arg_Either, Opt::Opt_Output },
+
+	// Something like "-DNDEBUG", or "-D NDEBUG"
+	{ "-D",                          Opt::Arg_Either, Opt::Opt_Cpp },
+	{ "-U",                          Opt::Arg_Either, Opt::Opt_Cpp },
+	{ "-I",                          Opt::Arg_Either, Opt::Opt_Cpp },
+	{ "-L",                          Opt::Arg_Either, Opt::Opt_Cpp },
+	{ "-l",                          Opt::Arg_Either, Opt::Opt_Cpp },
+
+	{ 0 }
+};
+
+static const OptionTable diab_option_table(diab_options);
+
+const OptionTable &DiabCompiler::options() const
+{
+	return diab_option_table;
+}
+
+//---------------------------------------------------------------------------------------------
+
 // Parse arguments, extract ones we care about, and also work out whether it will be 
 // possible to distribute this invocation remotely.
 //
@@ -85,42 +119,35 @@ void DiabCompiler::scan_args(Arguments &args, bool on_server)
     if (args[0][0] == '-') 
 	{
         rs_log_error("unrecognized distcc option: %s", +args[0]);
-        throw "GccCompiler::scan_args: bad arguments";
+        throw "DiabCompiler::scan_args: bad arguments";
     }
 
 	for (Arguments::Iterator i = args; !!i; ++i)
 	{
-		text a = *i;
-		text::regex::match m;
+		const text &a = *i;
 
         if (a[0] == '-') 
 		{
-            if (a == "-E") 
-			{
-                rs_trace("-E call for cpp must be local");
-                throw "GccCompiler::scan_args: error";
-            }
-			else if (a.match("-Xmake-dependency-savefile=(.+)", m))
+			const CompilerOption *opt = diab_option_table.find(a);
+			if (!opt)
+				continue;
+
+			if (opt->is(Opt::Opt_Local))
 			{
-				args.dotd_file = (string) m[1];
+                rs_log_info("%s: %s", +a, opt->why);
+                throw "DiabCompiler::scan_args: error";
 			}
-			else if (a.startswith("-Xmake-dependency"))
-			{
-                // Generate dependencies as a side effect. They should work with the way we call cpp.
-            }
-			else if (a == "-c") 
-			{
+
+			if (opt->is(Opt::Opt_Compile))
                 seen_opt_c = true;
-            }
-			else if (a == "-o")
-			{
-                // Whatever follows must be the output
-                args.found_output_file(*++i);
-            }
-			else if (a.match("-o(.+)", m))
-			{
-				args.found_output_file(m[1]);
-            }
+			if (opt->is(Opt::Opt_Assemble))
+                seen_opt_s = true;
+
+			string value = opt->argument(i);
+			if (opt->is(Opt::Opt_Output))
+				args.found_output_file(value);
+			else if (opt->is(Opt::Opt_DotD))
+				args.dotd_file = value;
         } 
 		else 
 		{
@@ -204,9 +231,8 @@ int DiabCompiler::set_action_opt(Arguments &args, const string &new_c)
     
 	for (Arguments::Iterator i = args; !!i; ++i)
 	{
-		const string a = *i;
-
-		if (a == "-c" || a == "-S")
+		const CompilerOption *opt = diab_option_table.find(*i);
+		if (opt && opt->is(Opt::Opt_Action))
 		{
             *i = new_c;
             gotone = true;
@@ -266,9 +292,7 @@ int DiabCompiler::set_output(Arguments &args, const Path &o_fname, const Path &d
 // Giving -L on a compile-only command line is a bit wierd, but it is observed to happen in 
 // Makefiles that are not strict about CFLAGS vs LDFLAGS, etc.
 //
-// NOTE: gcc-3.2's manual in the "preprocessor options" section describes some options, 
-// such as -d, that only take effect when passed directly to cpp.  When given to gcc they 
-// have different meanings.
+// The options that go are the ones marked Opt_Cpp in diab_options.
 
 void DiabCompiler::strip_local_args(Arguments &args, bool on_server)
 {
@@ -276,24 +300,14 @@ void DiabCompiler::strip_local_args(Arguments &args, bool on_server)
 		return;
 
     // skip through argv, copying all arguments but skipping ones that ought to be omitted
-	for (Arguments::Iterator i = args; !!i; ++i)
+	for (Arguments::Iterator i = args; !!i; )
 	{
-		text a = *i;
-		if (a.equalsto_one_of("-D", "-I", "-U", "-L", "-l", 0))
-		{
-			// skip next word, being option argument
-			i.remove(2);
-		}
-		else if (a.startswith_one_of("-D", "-U", "-I", "-l", "-L", 0))
-		{
-			// Something like "-DNDEBUG" or "-Wp,-MD,.deps/nsinstall.pp".  Just skip this word.
-			i.remove();
-		}
-		else if (a.startswith_one_of("-Xmake-dependency", 0))
-		{
-			i.remove();
-		}
-    }
+		const CompilerOption *opt = diab_option_table.find(*i);
+		if (opt && opt->is(Opt::Opt_Cpp))
+			i.remove(opt->words(*i)); // leaves i on the word after
+		else
+			++i;
+	}
     
 	args.trace("result");
 }
@@ -309,13 +323,14 @@ void DiabCompiler::strip_local_args(Arguments &args, bool on_server)
 
 void DiabCompiler::strip_dasho(Arguments &args)
 {
-	for (Arguments::Iterator i = args; !!i; ++i)
+	for (Arguments::Iterator i = args; !!i; )
 	{
-		text a = *i;
-		if (a == "-o")
-			i.remove(2); // skip "-o  FILE"
-        else if (a.startswith("-o"))
-			i.remove(); // skip "-oFILE"
+		// skip "-o  FILE" or "-oFILE"
+		const CompilerOption *opt = diab_option_table.find(*i);
+		if (opt && opt->is(Opt::Opt_Output))
+			i.remove(opt->words(*i));
+		else
+			++i;
 	}
 }
 
@@ -18,6 +18,7 @@
 #include "util.h"
 #include "exitcode.h"
 #include "compiler.h"
+#include "cc-options.h"
 
 namespace distcc
 {
@@ -149,6 +150,78 @@ bool GccCompiler::is_object(const string &sfile) const
 // GCC stuff
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
+typedef CompilerOption Opt;
+
+// NOTE: gcc-3.2's manual in the "preprocessor options" section describes some options, 
+// such as -d, that only take effect when passed directly to cpp.  When given to gcc they 
+// have different meanings.
+
+static const CompilerOption gcc_options[] =
+{
+	{ "-E",                 Opt::Arg_None,   Opt::Opt_Local,  "-E call for cpp must be local" },
+
+	// These two generate dependencies as a side effect. They should work with the way we call cpp.
+	{ "-MD",                Opt::Arg_None,   Opt::Opt_Cpp },
+	{ "-MMD",               Opt::Arg_None,   Opt::Opt_Cpp },
+	// These just modify the behavior of other -M* options and do nothing by themselves
+	{ "-MG",                Opt::Arg_None,   Opt::Opt_Cpp },
+	{ "-MP",                Opt::Arg_None,   Opt::Opt_Cpp },
+	// as above but with extra argument
+	{ "-MF",                Opt::Arg_Next,   Opt::Opt_Cpp | Opt::Opt_DotD },
+	{ "-MT",                Opt::Arg_Next,   Opt::Opt_Cpp },
+	{ "-MQ",                Opt::Arg_Next,   Opt::Opt_Cpp },
+	// -M(anything else) causes the preprocessor to produce a list of make-style dependencies 
+	// on header files, either to stdout or to a local file.  It implies -E, so only the 
+	// preprocessor is run, not the compiler.  There would be no point trying to distribute 
+	// it even if we could.
+	{ "-M",                 Opt::Arg_Joined, Opt::Opt_Local,  "implies -E (maybe) and must be local" },
+
+	// Assembler options that would produce output files must be local.
+	// Writing listings to stdout could be supported but it might be hard to parse reliably.
+	{ "-Wa,",               Opt::Arg_Joined, Opt::Opt_Assembler },
+	{ "-specs=",            Opt::Arg_Joined, Opt::Opt_Local,  "must be local" },
+	{ "-fprofile-arcs",     Opt::Arg_None,   Opt::Opt_Local,  "compiler will emit profile info; must be local" },
+	{ "-ftest-coverage",    Opt::Arg_None,   Opt::Opt_Local,  "compiler will emit profile info; must be local" },
+	{ "-frepo",             Opt::Arg_None,   Opt::Opt_Local,  "compiler will emit .rpo files; must be local" },
+	{ "-x",                 Opt::Arg_Joined, Opt::Opt_Local,  "gcc's -x handling is complex; running locally" },
+
+	{ "-c",                 Opt::Arg_None,   Opt::Opt_Compile },
+	{ "-S",                 Opt::Arg_None,   Opt::Opt_Assemble },
+	{ "-o",                 Opt::Arg_Either, Opt::Opt_Output },
+
+	// Something like "-DNDEBUG" or "-Wp,-MD,.deps/nsinstall.pp", or "-D NDEBUG"
+	{ "-D",                 Opt::Arg_Either, Opt::Opt_Cpp },
+	{ "-U",                 Opt::Arg_Either, Opt::Opt_Cpp },
+	{ "-I",                 Opt::Arg_Either, Opt::Opt_Cpp | Opt::Opt_Path },
+	{ "-L",                 Opt::Arg_Either, Opt::Opt_Cpp },
+	{ "-l",                 Opt::Arg_Either, Opt::Opt_Cpp },
+	{ "-Wp,",               Opt::Arg_Joined, Opt::Opt_Cpp },
+	{ "-Wl,",               Opt::Arg_Joined, Opt::Opt_Cpp },
+	{ "-include",           Opt::Arg_Either, Opt::Opt_Cpp | Opt::Opt_Path },
+	{ "-imacros",           Opt::Arg_Either, Opt::Opt_Cpp | Opt::Opt_Path },
+	{ "-iquote",            Opt::Arg_Either, Opt::Opt_Cpp | Opt::Opt_Path },
+	{ "-isystem",           Opt::Arg_Either, Opt::Opt_Cpp | Opt::Opt_Path },
+	{ "-idirafter",         Opt::Arg_Either, Opt::Opt_Cpp | Opt::Opt_Path },
+	{ "-iprefix",           Opt::Arg_Next,   Opt::Opt_Cpp },
+	{ "-iwithprefix",       Opt::Arg_Next,   Opt::Opt_Cpp },
+	{ "-iwithprefixbefore", Opt::Arg_Next,   Opt::Opt_Cpp },
+	// Options that only affect cpp
+	{ "-undef",             Opt::Arg_None,   Opt::Opt_Cpp },
+	{ "-nostdinc",          Opt::Arg_None,   Opt::Opt_Cpp },
+	{ "-nostdinc++",        Opt::Arg_None,   Opt::Opt_Cpp },
+
+	{ 0 }
+};
+
+static const OptionTable gcc_option_table(gcc_options);
+
+const OptionTable &GccCompiler::options() const
+{
+	return gcc_option_table;
+}
+
+//---------------------------------------------------------------------------------------------
+
 // Parse arguments, extract ones we care about, and also work out whether it will be 
 // possible to distribute this invocation remotely.
 //
@@ -175,90 +248,36 @@ void GccCompiler::scan_args(Arguments &args, bool on_server)
 
 	for (Arguments::Iterator i = args; !!i; ++i)
 	{
-		text a = *i;
-		text::regex::match m;
+		const text &a = *i;
 
         if (a[0] == '-') 
 		{
-            if (a == "-E") 
-			{
-                rs_trace("-E call for cpp must be local");
-                throw "GccCompiler::scan_args: error";
-            }
-			else if (a.equalsto_one_of("-MD", "-MMD", 0)) 
-			{
-                // These two generate dependencies as a side effect. They should work with the way we call cpp.
-            }
-			else if (a.equalsto_one_of("-MG", "-MP", 0)) 
-			{
-                // These just modify the behavior of other -M* options and do nothing by themselves
-            }
-			else if (a == "-MF")
-			{
-                // as above but with extra argument
-				args.dotd_file = *++i;
-            }
-			else if (a.equalsto_one_of("-MT", "-MQ", 0)) 
-			{
-                // as above but with extra argument
-                ++i;
-            }
-			else if (a[1] == 'M') 
-			{
-                // -M(anything else) causes the preprocessor to produce a list of make-style 
-				// dependencies on header files, either to stdout or to a local file.
-                // It implies -E, so only the preprocessor is run, not the compiler.  
-				// There would be no point trying to distribute it even if we could.
-                rs_trace("%s implies -E (maybe) and must be local", +a);
-                throw "GccCompiler::scan_args: error";
-            }
-			else if (a.startswith("-Wa,")) 
-			{
-                // Look for assembler options that would produce output files and must be local.
-                // Writing listings to stdout could be supported but it might be hard to parse reliably.
-				if (a.contains(",-a") || a.contains("--MD"))
-				{
-                    rs_trace("%s must be local", +a);
-                    throw "GccCompiler::scan_args: error";
-                }
-            } 
-			else if (a.startswith("-specs=")) 
-			{
-                rs_trace("%s must be local", +a);
-                throw "GccCompiler::scan_args: error";
-            } 
-			else if (a == "-S")
-			{
-                seen_opt_s = true;
-            }
-			else if (a == "-fprofile-arcs" || a == "-ftest-coverage") 
-			{
-                rs_log_info("compiler will emit profile info; must be local");
-                throw "GccCompiler::scan_args: error";
-            }
-			else if (a == "-frepo")
-			{
-                rs_log_info("compiler will emit .rpo files; must be local");
-                throw "GccCompiler::scan_args: error";
-            }
-			else if (a.startswith("-x")) 
+			const CompilerOption *opt = gcc_option_table.find(a);
+			if (!opt)
+				continue;
+
+			if (opt->is(Opt::Opt_Local))
 			{
-                rs_log_info("gcc's -x handling is complex; running locally");
+                rs_log_info("%s: %s", +a, opt->why);
                 throw "GccCompiler::scan_args: error";
-            }
-			else if (a == "-c") 
+			}
+			if (opt->is(Opt::Opt_Assembler) && (a.contains(",-a") || a.contains("--MD")))
 			{
+				rs_trace("%s must be local", +a);
+				throw "GccCompiler::scan_args: error";
+			}
+
+			if (opt->is(Opt::Opt_Compile))
                 seen_opt_c = true;
-            }
-			else if (a == "-o")
-			{
-                // Whatever follows must be the output
-                args.found_output_file(*++i);
-            }
-			else if (a.match("-o(.+)", m))
-			{
-				args.found_output_file(m[1]);
-            }
+			if (opt->is(Opt::Opt_Assemble))
+                seen_opt_s = true;
+
+			// an option's argument in the next word is never an input file
+			string value = opt->argument(i);
+			if (opt->is(Opt::Opt_Output))
+				args.found_output_file(value);
+			else if (opt->is(Opt::Opt_DotD))
+				args.dotd_file = value;
         } 
 		else 
 		{
@@ -350,9 +369,8 @@ int GccCompiler::set_action_opt(Arguments &args, const string &new_c)
     
 	for (Arguments::Iterator i = args; !!i; ++i)
 	{
-		const string a = *i;
-
-		if (a == "-c" || a == "-S")
+		const CompilerOption *opt = gcc_option_table.find(*i);
+		if (opt && opt->is(Opt::Opt_Action))
 		{
             *i = new_c;
             gotone = true;
@@ -362,7 +380,7 @@ int GccCompiler::set_action_opt(Arguments &args, const string &new_c)
 
     if (!gotone)
 	{
-        rs_log_error("failed to find -c or -FA");
+        rs_log_error("failed to find -c or -S");
         return EXIT_DISTCC_FAILED;
     }
 
@@ -412,9 +430,7 @@ int GccCompiler::set_output(Arguments &args, const Path &o_fname, const Path &do
 // Giving -L on a compile-only command line is a bit wierd, but it is observed to happen in 
 // Makefiles that are not strict about CFLAGS vs LDFLAGS, etc.
 //
-// NOTE: gcc-3.2's manual in the "preprocessor options" section describes some options, 
-// such as -d, that only take effect when passed directly to cpp.  When given to gcc they 
-// have different meanings.
+// The options that go are the ones marked Opt_Cpp in gcc_options.
 
 void GccCompiler::strip_local_args(Arguments &args, bool on_server)
 {
@@ -422,27 +438,13 @@ void GccCompiler::strip_local_args(Arguments &args, bool on_server)
 		return;
 
     // skip through argv, copying all arguments but skipping ones that ought to be omitted
-	for (Arguments::Iterator i = args; !!i; ++i)
+	for (Arguments::Iterator i = args; !!i; )
 	{
-		text a = *i;
-
-		if (a.equalsto_one_of(
-			"-D", "-I", "-U", "-L", "-l", "-MF", "-MT", "-MQ", "-include", "-imacros", 
-			"-iprefix", "-iwithprefix", "-isystem", "-iwithprefixbefore", "-idirafter", 0))
-		{
-			// skip next word, being option argument
-			i.remove(2);
-		}
-		else if (a.startswith_one_of("-Wp,", "-Wl,", "-D", "-U", "-I", "-l", "-L", 0))
-		{
-			// Something like "-DNDEBUG" or "-Wp,-MD,.deps/nsinstall.pp".  Just skip this word.
-			i.remove();
-		}
-		else if (a.equalsto_one_of("-undef", "-nostdinc", "-nostdinc++", "-MD", "-MMD", "-MG", "-MP", 0))
-		{
-			// Options that only affect cpp; skip
-			i.remove();
-		}
+		const CompilerOption *opt = gcc_option_table.find(*i);
+		if (opt && opt->is(Opt::Opt_Cpp))
+			i.remove(opt->words(*i)); // leaves i on the word after
+		else
+			++i;
 	}
     
 	args.trace("result");
@@ -459,13 +461,14 @@ void GccCompiler::strip_local_args(Arguments &args, bool on_server)
 
 void GccCompiler::strip_dasho(Arguments &args)
 {
-	for (Arguments::Iterator i = args; !!i; ++i)
+	for (Arguments::Iterator i = args; !!i; )
 	{
-		text a = *i;
-		if (a == "-o")
-			i.remove(2); // skip "-o  FILE"
-        else if (a.startswith("-o"))
-			i.remove(); // skip "-oFILE"
+		// skip "-o  FILE" or "-oFILE"
+		const CompilerOption *opt = gcc_option_table.find(*i);
+		if (opt && opt->is(Opt::Opt_Output))
+			i.remove(opt->words(*i));
+		else
+			++i;
 	}
 }
 
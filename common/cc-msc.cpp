@@ -21,6 +21,7 @@
 #include "exitcode.h"
 
 #include "compiler.h"
+#include "cc-options.h"
 
 namespace distcc
 {
@@ -76,6 +77,59 @@ bool MscCompiler::is_object(const string &filename) const
 // MSC (CL) stuff
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
+typedef CompilerOption Opt;
+
+// NOTE: a categorical listing of all of cl's options are listed at:
+// http://msdn2.microsoft.com/en-us/library/19z1t1wy(VS.80).aspx
+// All preprocessor options done.
+
+static const CompilerOption msc_options[] =
+{
+	{ "-E",    Opt::Arg_None,   Opt::Opt_Local | Opt::Opt_Cpp, "/E call for cpp must be local" },
+	{ "-E",    Opt::Arg_Joined, Opt::Opt_Cpp },
+
+	{ "-c",    Opt::Arg_None,   Opt::Opt_Compile },
+	{ "-FA",   Opt::Arg_Joined, Opt::Opt_Cpp | Opt::Opt_Assemble },
+	{ "-Fa",   Opt::Arg_Joined, Opt::Opt_Cpp | Opt::Opt_Listing },
+	{ "-Fo",   Opt::Arg_Joined, Opt::Opt_Output },
+	{ "-Fd",   Opt::Arg_Joined, Opt::Opt_Pdb },
+	{ "-Fe",   Opt::Arg_Joined, Opt::Opt_Cpp },
+
+	// Something like "-DNDEBUG", or "-D NDEBUG"
+	{ "-D",    Opt::Arg_Either, Opt::Opt_Cpp },
+	{ "-U",    Opt::Arg_Either, Opt::Opt_Cpp },
+	{ "-I",    Opt::Arg_Either, Opt::Opt_Cpp | Opt::Opt_Path },
+	{ "-FI",   Opt::Arg_Either, Opt::Opt_Cpp },
+	{ "-F",    Opt::Arg_Next,   Opt::Opt_Cpp },
+	{ "-Fx",   Opt::Arg_None,   Opt::Opt_Cpp },
+	{ "-AI",   Opt::Arg_Joined, Opt::Opt_Cpp },
+	{ "-C",    Opt::Arg_Joined, Opt::Opt_Cpp },
+	{ "-FU",   Opt::Arg_Joined, Opt::Opt_Cpp },
+	{ "-Fm",   Opt::Arg_Joined, Opt::Opt_Cpp },
+	{ "-FR",   Opt::Arg_Joined, Opt::Opt_Cpp },
+	{ "-Fr",   Opt::Arg_Joined, Opt::Opt_Cpp },
+	{ "-Y",    Opt::Arg_Joined, Opt::Opt_Cpp },
+	{ "-link", Opt::Arg_Joined, Opt::Opt_Cpp },
+	{ "@",     Opt::Arg_Joined, Opt::Opt_Cpp },
+	// Options that only affect cpp
+	{ "-u",    Opt::Arg_None,   Opt::Opt_Cpp },
+	{ "-X",    Opt::Arg_None,   Opt::Opt_Cpp },
+	{ "-LN",   Opt::Arg_None,   Opt::Opt_Cpp },
+	{ "-doc",  Opt::Arg_None,   Opt::Opt_Cpp },
+	{ "-Zs",   Opt::Arg_None,   Opt::Opt_Cpp },
+
+	{ 0 }
+};
+
+static const OptionTable msc_option_table(msc_options);
+
+const OptionTable &MscCompiler::options() const
+{
+	return msc_option_table;
+}
+
+//---------------------------------------------------------------------------------------------
+
 // input_file : the source file
 // output_file : the name of the file the source is compiled into (eg. .obj)
 // ret_newargs : A copy of the arguments with added /Fo option
@@ -106,49 +160,35 @@ void MscCompiler::scan_args(Arguments &args, bool on_server)
 
 		if (a[0] == '-')
 		{
-			if (a == "-E") 
+			const CompilerOption *opt = msc_option_table.find(a);
+			if (!opt)
+				continue;
+
+			if (opt->is(Opt::Opt_Local))
 			{
-				rs_trace("/E call for cpp must be local");
+				rs_trace("%s", opt->why);
 				throw "MscCompiler::scan_args: error";
 			}
-			else if (a.startswith("-Fa")) 
-			{
+
+			if (opt->is(Opt::Opt_Compile))
+				seen_opt_c = true;
+			if (opt->is(Opt::Opt_Listing))
 				seen_opt_asm = true;
-				if (a[3] != '\0') 
-				{
-					args.found_output_file(Arguments::convert_win_path(a.substr(3)));
-					*i = a.substr(0, 3) + args.output_file;
-				}
-			}
-			else if (a.startswith("-Fo")) 
-			{
+			if (opt->is(Opt::Opt_Output))
 				seen_opt_object = true;
-				if (a[3] != '\0') 
-				{
-					args.found_output_file(Arguments::convert_win_path(a.substr(3)));
-					*i = a.substr(0, 3) + args.output_file;
-				}
-			}
-			else if (a.startswith("-I"))
-			{
-				*i = a.substr(0, 2) + Arguments::convert_win_path(a.substr(2));
-			}
-			else if (a.startswith("-Fd")) 
-			{
-				if (a[3] != '\0')
-				{
-					args.pdb_file = Arguments::convert_win_path(a.substr(3));
-					*i = a.substr(0, 3) + args.pdb_file;
-				}
-			}
-			else if (a == "-c") 
-			{
-				seen_opt_c = true;
-			} 
-			else if (!a.find("-Fe")) 
-			{
-				// Ignore this
-			}
+
+			// file names are given the Windows way, in the word they're in
+			bool separate = opt->separate(a);
+			string value = opt->argument(i);
+			if (value.empty() || !opt->is(Opt::Opt_Listing | Opt::Opt_Output | Opt::Opt_Pdb | Opt::Opt_Path))
+				continue;
+
+			string fname = Arguments::convert_win_path(value);
+			if (opt->is(Opt::Opt_Listing | Opt::Opt_Output))
+				args.found_output_file(fname);
+			else if (opt->is(Opt::Opt_Pdb))
+				args.pdb_file = fname;
+			*i = separate ? fname : opt->name + fname;
 		}
         else 
 		{
@@ -247,9 +287,8 @@ int MscCompiler::set_action_opt(Arguments &args, const string &new_c)
     
 	for (Arguments::Iterator i = args; !!i; ++i)
 	{
-		text a = *i;
-
-		if (a == "-c" || a.startswith("-FA"))
+		const CompilerOption *opt = msc_option_table.find(*i);
+		if (opt && opt->is(Opt::Opt_Action))
 		{
             *i = new_c;
             gotone = true;
@@ -303,9 +342,7 @@ int MscCompiler::set_output(Arguments &args, const Path &o_fname, const Path &do
 // Giving -L on a compile-only command line is a bit wierd, but it is observed to happen in 
 // Makefiles that are not strict about CFLAGS vs LDFLAGS, etc.
 //
-// NOTE: a categorical listing of all of cl's options are listed at:
-// http://msdn2.microsoft.com/en-us/library/19z1t1wy(VS.80).aspx
-// All preprocessor options done.
+// The options that go are the ones marked Opt_Cpp in msc_options.
 
 void MscCompiler::strip_local_args(Arguments &args, bool on_server)
 {
@@ -313,27 +350,14 @@ void MscCompiler::strip_local_args(Arguments &args, bool on_server)
 		return;
 
     // skip through argv, copying all arguments but skipping ones that ought to be omitted
-	for (Arguments::Iterator i = args; !!i; ++i)
+	for (Arguments::Iterator i = args; !!i; )
 	{
-		text a = *i;
-
-		if (a.equalsto_one_of("-I", "-U", "-FI", "-U", "-Fx", "-F", 0) || a.startswith("-Fa"))
-		{
-			i.remove(2);
-		}
-		else if (a.startswith_one_of(
-				"-D", "-U", "-I", "-AI", "-C", "-D", "-E", "-FI", "-FU", "-U", "-Fe", 
-				"-link", "@", "-FA", "-Fm", "-FR", "-Fr", "-Y", 0))
-		{
-			// Something like "-DNDEBUG" or "-Wp,-MD,.deps/nsinstall.pp".  Just skip this word.
-			i.remove();
-		}
-		else if (a.equalsto_one_of("-E", "-u", "-X", "-LN", "-doc", "-Zs", 0)) 
-		{
-			// Options that only affect cpp; skip
-			i.remove();
-		}
-    }
+		const CompilerOption *opt = msc_option_table.find(*i);
+		if (opt && opt->is(Opt::Opt_Cpp))
+			i.remove(opt->words(*i)); // leaves i on the word after
+		else
+			++i;
+	}
     
     args.trace("result");
 }
@@ -351,9 +375,15 @@ void MscCompiler::strip_dasho(Arguments &args)
 {
     // skip through argv, copying all arguments but skipping ones that ought to be omitted
 
-	for (Arguments::Iterator i = args; !!i; ++i)
-        if (i->startswith("-Fo")) // skip "-Foc:\path\to\FILE.obj"
-			i.remove();
+	for (Arguments::Iterator i = args; !!i; )
+	{
+		// skip "-Foc:\path\to\FILE.obj"
+		const CompilerOption *opt = msc_option_table.find(*i);
+		if (opt && opt->is(Opt::Opt_Output))
+			i.remove(opt->words(*i));
+		else
+			++i;
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,94 @@
+/**
+ * @file
+ *
+ * Option tables of the compilers: what each option distcc cares about means to it.
+ **/
+
+#include "config.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "trace.h"
+#include "cc-options.h"
+
+namespace distcc
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+bool CompilerOption::separate(const string &a) const
+{
+	return arg == Arg_Next || (arg == Arg_Either && a.length() == length());
+}
+
+//---------------------------------------------------------------------------------------------
+
+string CompilerOption::argument(Arguments::Iterator &i) const
+{
+	if (!separate(*i))
+		return value(*i);
+
+	string a = *i;
+	if (!++i)
+	{
+		rs_log_info("%s wants an argument", +a);
+		throw "CompilerOption::argument: missing argument";
+	}
+	return *i;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+int OptionTable::_bucket(const char *a)
+{
+	return a[0] == '-' && a[1] ? (unsigned char) a[1] : Buckets - 1;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static bool dcc_more_specific(const CompilerOption *x, const CompilerOption *y)
+{
+	size_t xn = x->length(), yn = y->length();
+	if (xn != yn)
+		return xn > yn;
+	bool x_exact = x->arg == CompilerOption::Arg_None || x->arg == CompilerOption::Arg_Next;
+	bool y_exact = y->arg == CompilerOption::Arg_None || y->arg == CompilerOption::Arg_Next;
+	return x_exact && !y_exact;
+}
+
+//---------------------------------------------------------------------------------------------
+
+OptionTable::OptionTable(const CompilerOption *options)
+{
+	for (const CompilerOption *opt = options; opt->name; ++opt)
+		_buckets[_bucket(opt->name)].push_back(opt);
+
+	for (int i = 0; i < Buckets; ++i)
+		std::stable_sort(_buckets[i].begin(), _buckets[i].end(), dcc_more_specific);
+}
+
+//---------------------------------------------------------------------------------------------
+
+const CompilerOption *OptionTable::find(const string &a) const
+{
+	const char *s = a.c_str();
+	const vector<const CompilerOption *> &bucket = _buckets[_bucket(s)];
+
+	for (size_t i = 0; i < bucket.size(); ++i)
+	{
+		const CompilerOption *opt = bucket[i];
+		size_t n = opt->length();
+		if (a.length() < n || strncmp(s, opt->name, n))
+			continue;
+
+		if (a.length() == n || opt->arg == CompilerOption::Arg_Joined || opt->arg == CompilerOption::Arg_Either)
+			return opt;
+	}
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
@@ -0,0 +1,104 @@
+
+#ifndef _distcc_common_cc_options_h_
+#define _distcc_common_cc_options_h_
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "arg.h"
+
+namespace distcc
+{
+
+using std::string;
+using std::vector;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+// A compiler option distcc cares about, as it's listed in the option table of a compiler.
+// Everything a compiler does with an argument (scan_args, strip_local_args, strip_dasho and
+// set_action_opt) goes by the flags of the entry the argument matches, so that each option
+// is described in just one place.
+
+struct CompilerOption
+{
+	// How the option is written
+	enum Arg
+	{
+		Arg_None,   // "-c": just the option
+		Arg_Next,   // "-MF FILE": the option, and its argument in the next word
+		Arg_Joined, // "-Wp,...": anything starting with the option, its argument in the same word
+		Arg_Either  // "-DX" or "-D X"
+	};
+
+	// What it means
+	enum
+	{
+		Opt_Local     = 0x001, // can't be distributed (see why)
+		Opt_Cpp       = 0x002, // for the preprocessor or the linker: left out on the server
+		Opt_Compile   = 0x004, // -c
+		Opt_Assemble  = 0x008, // -S, stops before assembling
+		Opt_Output    = 0x010, // names the output file
+		Opt_DotD      = 0x020, // names the dependency file
+		Opt_Path      = 0x040, // names a header or a directory of them (MSC: converted to a Windows path)
+		Opt_Pdb       = 0x080, // MSC: names the program database
+		Opt_Listing   = 0x100, // MSC: names the assembler listing
+		Opt_Assembler = 0x200, // options for the assembler
+
+		Opt_Action = Opt_Compile | Opt_Assemble // replaced by set_action_opt
+	};
+
+	const char *name;
+	Arg arg;
+	unsigned flags;
+	const char *why;
+
+	bool is(unsigned f) const { return !!(flags & f); }
+
+	// Whether the argument of @p a, as matched by this option, is in the next word
+	bool separate(const string &a) const;
+
+	// The argument in @p a itself (Arg_Joined, Arg_Either)
+	string value(const string &a) const { return a.substr(length()); }
+
+	// Words taken by @p a: the option and its separate argument, if any
+	int words(const string &a) const { return separate(a) ? 2 : 1; }
+
+	// The argument of the option at @p i, moving @p i onto it if it's in the next word
+	string argument(Arguments::Iterator &i) const;
+
+	size_t length() const { return strlen(name); }
+};
+
+//---------------------------------------------------------------------------------------------
+
+// The options of a compiler, indexed by the character that follows the dash, so that
+// classifying an argument compares it with at most a few entries, rather than with every
+// option the compiler has.  Within each bucket the longest names come first, and an exact
+// option before a joined one of the same name, so the first entry that matches is the most
+// specific one ("-MF" rather than "-M", "-Xmake-dependency-savefile=" rather than
+// "-Xmake-dependency").
+
+class OptionTable
+{
+	enum { Buckets = 257 }; // one for each character after the dash, and one for the rest
+
+	vector<const CompilerOption *> _buckets[Buckets];
+
+	static int _bucket(const char *a);
+
+public:
+	// @p options ends with an entry without a name
+	OptionTable(const CompilerOption *options);
+
+	// The entry that @p a matches, or 0 if it isn't an option distcc cares about
+	const CompilerOption *find(const string &a) const;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
+
+#endif // _distcc_common_cc_options_h_
@@ -33,6 +33,8 @@ namespace distcc
 
 using rvfc::File;
 
+class OptionTable;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
 class Compiler
@@ -62,6 +64,16 @@ public:
 	virtual int set_output(Arguments &args, const Path &o_fname, const Path &dotd_fname, const Path &pdb_fname) = 0;
 
 	void set_input(Arguments &args, const string &i_fname) { args.set_input(*this, i_fname); }
+
+	// Whether the compiler reads its input sequentially, just once, so that it can be fed from a fifo
+	virtual bool reads_fifo() const { return false; }
+
+	// The options distcc cares about (see CompilerOption)
+	virtual const OptionTable &options() const = 0;
+
+	// Whether the headers a source includes can be found by reading it, so that it can be
+	// preprocessed on the server (host option "pump")
+	virtual bool scans_includes() const { return false; }
 };
 
 //---------------------------------------------------------------------------------------------
@@ -81,6 +93,8 @@ public:
 	void strip_local_args(Arguments &args, bool on_server);
 	int set_action_opt(Arguments &args, const string &new_c);
 	int set_output(Arguments &args, const Path &o_fname, const Path &dotd_fname, const Path &pdb_fname);
+
+	const OptionTable &options() const;
 };
 
 //---------------------------------------------------------------------------------------------
@@ -100,6 +114,11 @@ public:
 	void strip_local_args(Arguments &args, bool on_server);
 	int set_action_opt(Arguments &args, const string &new_c);
 	int set_output(Arguments &args, const Path &o_fname, const Path &dotd_fname, const Path &pdb_fname);
+
+	bool reads_fifo() const { return true; }
+
+	const OptionTable &options() const;
+	bool scans_includes() const { return true; }
 };
 
 //---------------------------------------------------------------------------------------------
@@ -119,6 +138,8 @@ public:
 	void strip_local_args(Arguments &args, bool on_server);
 	int set_action_opt(Arguments &args, const string &new_c);
 	int set_output(Arguments &args, const Path &o_fname, const Path &dotd_fname, const Path &pdb_fname);
+
+	const OptionTable &options() const;
 };
 
 //---------------------------------------------------------------------------------------------
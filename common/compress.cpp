@@ -86,8 +86,6 @@ namespace distcc
 
 char compress_work_mem[LZO1X_1_MEM_COMPRESS];
 
-static int dcc_compress_lzo1x_alloc(const char *in_buf, size_t in_len, char **out_buf_ret, size_t *out_len_ret);
-
 //---------------------------------------------------------------------------------------------
 // Compress from a file to a newly malloc'd block
 
@@ -123,7 +121,7 @@ out:
 // So we just read the whole input into a buffer, build the output in a buffer, 
 // and send it once its complete.
 
-static int dcc_compress_lzo1x_alloc(const char *in_buf, size_t in_len, char **out_buf_ret, size_t *out_len_ret)
+int dcc_compress_lzo1x_alloc(const char *in_buf, size_t in_len, char **out_buf_ret, size_t *out_len_ret)
 {
 	char *work_mem = compress_work_mem;
     int ret = 0, lzo_ret;
@@ -224,6 +224,7 @@ int dcc_recursion_safeguard();
 
 int dcc_r_bulk_lzo1x(fd_t outf_fd, fd_t in_fd, unsigned in_len);
 int dcc_compress_file_lzo1x(fd_t in_fd, size_t in_len, char **out_buf, size_t *out_len);
+int dcc_compress_lzo1x_alloc(const char *in_buf, size_t in_len, char **out_buf_ret, size_t *out_len_ret);
 
 // bulk.h
 void dcc_calc_rate(off_t size_out, struct timeval &before, struct timeval &after, double &secs, double &rate);
@@ -235,6 +236,7 @@ void dcc_note_compiled(const Path &input_file, const Path &output_file);
 // int dcc_get_tempdir(const char **);
 File dcc_make_tmpnam(const char *, const char *suffix);
 string dcc_get_tmp_top();
+void dcc_set_workspace(const string &dir);
 
 void dcc_mkdir(const string &path);
 
@@ -292,7 +294,7 @@ int dcc_map_input_file(int in_fd, off_t in_size, char **buf_ret);
 #define WCOREDUMP(status) 0
 #endif
 
-int dcc_socket_listen(int port, int *fd_out, const char *listen_addr);
+int dcc_socket_listen(int port, int *fd_out, const char *listen_addr, bool reuse_port = false);
 
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
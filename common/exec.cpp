@@ -46,6 +46,8 @@
 
 #ifdef __linux__
 #include <unistd.h>
+#include <sched.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -90,6 +92,20 @@ static void dcc_inside_child(Arguments &args, const File *stdin_file,
 
 static void dcc_execvp(char **argv) NORETURN;
 
+#ifdef __linux__
+static bool dcc_child_own_pgrp = false;
+
+// the last child started and not yet collected
+static volatile pid_t dcc_running_child = -1;
+
+static string dcc_child_cgroup;
+
+static std::vector<int> dcc_child_cpus;
+
+static std::vector<string> dcc_child_env;
+static int dcc_child_mem_node = -1;
+#endif
+
 //---------------------------------------------------------------------------------------------
 
 void dcc_hostdef::note_execution(const Arguments &args)
@@ -213,6 +229,45 @@ dcc_inside_child(Arguments &args, const File *stdin_file, const File *stdout_fil
 	// Ignore failure
 	dcc_increment_safeguard();
 
+	// The parent does this too; whichever comes first wins the race against a kill
+	if (dcc_child_own_pgrp)
+		setpgid(0, 0);
+
+	if (!dcc_child_cgroup.empty())
+	{
+		// Not being confined is no reason to fail the job
+		string pid = stringf("%d", (int) getpid());
+		int fd = open((dcc_child_cgroup + "/cgroup.procs").c_str(), O_WRONLY);
+		if (fd == -1 || write(fd, pid.data(), pid.size()) == -1)
+			rs_log_warning("failed to enter cgroup %s: %s", dcc_child_cgroup.c_str(), strerror(errno));
+		if (fd != -1)
+			close(fd);
+	}
+
+	if (!dcc_child_cpus.empty())
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		for (size_t i = 0; i < dcc_child_cpus.size(); ++i)
+			CPU_SET(dcc_child_cpus[i], &cpus);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1)
+			rs_log_warning("failed to bind to CPUs: %s", strerror(errno));
+	}
+
+	if (dcc_child_mem_node >= 0)
+	{
+		// set_mempolicy(MPOL_BIND), without depending on libnuma
+		enum { mpol_bind = 2, max_nodes = 1024 };
+		unsigned long nodes[max_nodes / (8 * sizeof(unsigned long))];
+		memset(nodes, 0, sizeof(nodes));
+		nodes[dcc_child_mem_node / (8 * sizeof(unsigned long))] |= 1UL << (dcc_child_mem_node % (8 * sizeof(unsigned long)));
+		if (syscall(SYS_set_mempolicy, mpol_bind, nodes, max_nodes) == -1)
+			rs_log_warning("failed to bind to the memory of node %d: %s", dcc_child_mem_node, strerror(errno));
+	}
+
+	for (size_t i = 0; i < dcc_child_env.size(); ++i)
+		putenv(strdup(dcc_child_env[i].c_str()));
+
 	// do this last, so that any errors from previous operations are visible
 	ret = dcc_redirect_fds(stdin_file, stdout_file, stderr_file);
 	if (ret)
@@ -262,6 +317,79 @@ dcc_new_pgrp()
 
 //---------------------------------------------------------------------------------------------
 
+void
+dcc_set_child_pgrp(bool own)
+{
+#ifdef __linux__
+	dcc_child_own_pgrp = own;
+#endif
+}
+
+//---------------------------------------------------------------------------------------------
+
+void
+dcc_set_child_cgroup(const string &dir)
+{
+#ifdef __linux__
+	dcc_child_cgroup = dir;
+#endif
+}
+
+//---------------------------------------------------------------------------------------------
+
+void
+dcc_set_child_env(const std::vector<string> &vars)
+{
+#ifdef __linux__
+	dcc_child_env = vars;
+#endif
+}
+
+//---------------------------------------------------------------------------------------------
+
+void
+dcc_set_child_cpus(const std::vector<int> &cpus, int mem_node)
+{
+#ifdef __linux__
+	dcc_child_cpus = cpus;
+	dcc_child_mem_node = mem_node < 1024 ? mem_node : -1;
+#endif
+}
+
+//---------------------------------------------------------------------------------------------
+
+void
+dcc_kill_child(const proc_t &pid, int sig)
+{
+	if (!pid)
+		return;
+
+#ifdef _WIN32
+	TerminateProcess(pid.handle, W_EXITCODE(0, sig));
+#else
+	rs_trace("killing child %d with signal %d", (int) pid.pid, sig);
+	if (!dcc_child_own_pgrp || killpg(pid.pid, sig) == -1)
+		kill(pid.pid, sig);
+#endif
+}
+
+//---------------------------------------------------------------------------------------------
+
+void
+dcc_kill_running_child(int sig)
+{
+#ifdef __linux__
+	pid_t pid = dcc_running_child;
+	if (pid == -1)
+		return;
+
+	if (!dcc_child_own_pgrp || killpg(pid, sig) == -1)
+		kill(pid, sig);
+#endif
+}
+
+//---------------------------------------------------------------------------------------------
+
 #ifdef _WIN32
 
 TemporaryFile::TemporaryFile(const File &file, bool create)
@@ -403,6 +531,9 @@ dcc_spawn_child(const Arguments &args, proc_t &pid, const Directory *cwd,
     }
 	else
 	{
+		if (dcc_child_own_pgrp)
+			setpgid(pid, pid);
+		dcc_running_child = pid;
         procid = pid;
         rs_trace("child started as pid%d", (int) pid);
         return 0;
@@ -456,7 +587,7 @@ sys_wait4(pid_t pid, int &status, int options, struct rusage *rusage)
 // the child waits all the time.
 
 int 
-dcc_collect_child(const string &what, const proc_t &pid, int &wait_status)
+dcc_collect_child(const string &what, const proc_t &pid, int &wait_status, JobUsage *usage)
 {
 #ifdef _WIN32
 
@@ -492,6 +623,14 @@ dcc_collect_child(const string &what, const proc_t &pid, int &wait_status)
 
 			wait_status = (int) exit_code;
 
+			FILETIME creation_time, exit_time, kernel_time, user_time;
+			if (usage && GetProcessTimes(proc->handle, &creation_time, &exit_time, &kernel_time, &user_time))
+			{
+				// in units of 100ns
+				usage->user_msecs = (unsigned long) ((((ULONGLONG) user_time.dwHighDateTime << 32) | user_time.dwLowDateTime) / 10000);
+				usage->sys_msecs = (unsigned long) ((((ULONGLONG) kernel_time.dwHighDateTime << 32) | kernel_time.dwLowDateTime) / 10000);
+			}
+
 			rs_trace("%s child %ld terminated", +what, proc->pid);
 			process_cleanup(proc);
 
@@ -518,6 +657,9 @@ fail:
 		ret_pid = sys_wait4(pid.pid, wait_status, 0, &ru);
         if (ret_pid != -1) 
 		{
+			if (ret_pid == dcc_running_child)
+				dcc_running_child = -1;
+
             // This is not the main user-visible message, that comes from critique_status()
 			rs_trace("%s child %ld terminated with status %#x", what, (long) ret_pid, wait_status);
 
@@ -528,6 +670,13 @@ fail:
 				ru.ru_stime.tv_sec, ru.ru_stime.tv_usec,
 				ru.ru_minflt, ru.ru_majflt);
 
+			if (usage)
+			{
+				usage->user_msecs = ru.ru_utime.tv_sec * 1000 + ru.ru_utime.tv_usec / 1000;
+				usage->sys_msecs = ru.ru_stime.tv_sec * 1000 + ru.ru_stime.tv_usec / 1000;
+				usage->max_rss_kb = ru.ru_maxrss; // already in kB on Linux
+			}
+
             return 0;
         }
 
@@ -545,6 +694,38 @@ fail:
 
 //---------------------------------------------------------------------------------------------
 
+string JobUsage::to_string() const
+{
+	return stringf("user=%lu sys=%lu wall=%lu rss=%lu", user_msecs, sys_msecs, wall_msecs, max_rss_kb);
+}
+
+//---------------------------------------------------------------------------------------------
+
+void JobUsage::parse(const string &s)
+{
+	const char *p = s.c_str();
+	while (*p)
+	{
+		char name[16];
+		unsigned long val;
+		int n;
+		if (sscanf(p, " %15[a-z]=%lu%n", name, &val, &n) != 2)
+			break;
+		p += n;
+
+		if (!strcmp(name, "user"))
+			user_msecs = val;
+		else if (!strcmp(name, "sys"))
+			sys_msecs = val;
+		else if (!strcmp(name, "wall"))
+			wall_msecs = val;
+		else if (!strcmp(name, "rss"))
+			max_rss_kb = val;
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
 /**
  * Analyze and report to the user on a command's exit code.  
  *
@@ -22,6 +22,9 @@
 
 // exec.c
 
+#ifndef _distcc_common_exec_h_
+#define _distcc_common_exec_h_
+
 #include "common/arg.h"
 #include "rvfc/filesys/defs.h"
 
@@ -33,13 +36,47 @@ using rvfc::Directory;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
+// What running a child cost.  Sent from the server to the client as the RUSG token.
+
+struct JobUsage
+{
+	unsigned long user_msecs, sys_msecs, wall_msecs;
+	unsigned long max_rss_kb;
+
+	JobUsage() : user_msecs(0), sys_msecs(0), wall_msecs(0), max_rss_kb(0) {}
+
+	// "user=MS sys=MS wall=MS rss=KB"; unknown fields are ignored when parsing
+	string to_string() const;
+	void parse(const string &s);
+};
+
+//---------------------------------------------------------------------------------------------
+
 int dcc_spawn_child(const Arguments &argv, proc_t &pid, const Directory *cwd,
 	const File *in_file, const File *out_fname, const File *err_fname);
 
-int dcc_collect_child(const string &what, const proc_t &pid, int &wait_status);
+// Fills in the CPU times and peak memory of @p usage, if given (but not its wall time)
+int dcc_collect_child(const string &what, const proc_t &pid, int &wait_status, JobUsage *usage = 0);
 int dcc_critique_status(int status, const string &command, const Path &input_fname, const string &hostname, bool verbose);
 
 int dcc_new_pgrp();
+
+// Run children in a process group of their own, so everything they start can be killed with them
+void dcc_set_child_pgrp(bool own);
+void dcc_kill_child(const proc_t &pid, int sig);
+
+// Move children into this cgroup (v2) directory before they exec
+void dcc_set_child_cgroup(const string &dir);
+
+// Set these "NAME=VALUE" in the environment of children before they exec (none, if empty)
+void dcc_set_child_env(const std::vector<string> &vars);
+
+// Bind children to these CPUs (all, if empty), and to the memory of NUMA node @p mem_node 
+// (unless it's -1), before they exec
+void dcc_set_child_cpus(const std::vector<int> &cpus, int mem_node);
+
+// Kill the child that's currently running, if any (safe to call from a signal handler)
+void dcc_kill_running_child(int sig);
 void dcc_reset_signal(int whichsig);
 
 #ifndef W_EXITCODE
@@ -49,3 +86,5 @@ void dcc_reset_signal(int whichsig);
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
 } // namespace distcc
+
+#endif // _distcc_common_exec_h_
@@ -54,7 +54,8 @@ enum dcc_exitcode
     EXIT_GONE                     = 117, // No longer relevant
     EXIT_TIMEOUT                  = 118,
     EXIT_NO_COMPILER_SETTING      = 119, // distcc was not able to set a compiler
-    EXIT_BAD_FUNCTION_CALL        = 120
+    EXIT_BAD_FUNCTION_CALL        = 120,
+    EXIT_WRONG_TOOLCHAIN          = 121  // Server's compiler differs from the client's
 };
 
 } // namespace distcc
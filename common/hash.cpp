@@ -0,0 +1,188 @@
+
+/**
+ * @file
+ *
+ * SHA-256 (FIPS 180-2), for content addressing.
+ **/
+
+#include "common/config.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+#ifdef _WIN32
+#include <io.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "common/distcc.h"
+#include "common/trace.h"
+#include "common/hash.h"
+
+namespace distcc
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+static const unsigned int sha256_k[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+//---------------------------------------------------------------------------------------------
+
+Digest::Digest() : _length(0), _used(0)
+{
+	static const unsigned int init[8] =
+	{
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	memcpy(_state, init, sizeof(_state));
+}
+
+//---------------------------------------------------------------------------------------------
+
+void Digest::transform(const unsigned char *p)
+{
+	unsigned int w[64];
+	for (int i = 0; i < 16; ++i, p += 4)
+		w[i] = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	for (int i = 16; i < 64; ++i)
+	{
+		unsigned int s0 = ROTR(w[i-15], 7) ^ ROTR(w[i-15], 18) ^ (w[i-15] >> 3);
+		unsigned int s1 = ROTR(w[i-2], 17) ^ ROTR(w[i-2], 19) ^ (w[i-2] >> 10);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+
+	unsigned int a = _state[0], b = _state[1], c = _state[2], d = _state[3],
+		e = _state[4], f = _state[5], g = _state[6], h = _state[7];
+
+	for (int i = 0; i < 64; ++i)
+	{
+		unsigned int t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+		unsigned int t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	_state[0] += a; _state[1] += b; _state[2] += c; _state[3] += d;
+	_state[4] += e; _state[5] += f; _state[6] += g; _state[7] += h;
+}
+
+//---------------------------------------------------------------------------------------------
+
+Digest &Digest::update(const void *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *) data;
+	_length += len;
+
+	if (_used)
+	{
+		size_t n = len < 64 - _used ? len : 64 - _used;
+		memcpy(_block + _used, p, n);
+		_used += n;
+		p += n;
+		len -= n;
+		if (_used < 64)
+			return *this;
+		transform(_block);
+		_used = 0;
+	}
+
+	for (; len >= 64; p += 64, len -= 64)
+		transform(p);
+
+	memcpy(_block, p, len);
+	_used = len;
+	return *this;
+}
+
+//---------------------------------------------------------------------------------------------
+
+Digest &Digest::update(const string &s)
+{
+	return update(s.data(), s.length());
+}
+
+//---------------------------------------------------------------------------------------------
+
+Digest &Digest::update_field(const string &s)
+{
+	unsigned int len = s.length();
+	unsigned char n[4] = { (unsigned char) (len >> 24), (unsigned char) (len >> 16), (unsigned char) (len >> 8), (unsigned char) len };
+	update(n, sizeof(n));
+	return update(s);
+}
+
+//---------------------------------------------------------------------------------------------
+
+bool Digest::update_file(const File &file)
+{
+	int fd = open(+file.path(), O_RDONLY | O_BINARY);
+	if (fd == -1)
+	{
+		rs_trace("failed to open %s for hashing: %s", +file.path(), strerror(errno));
+		return false;
+	}
+
+	char buf[65536];
+	ssize_t n;
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		update(buf, n);
+	close(fd);
+
+	if (n == -1)
+	{
+		rs_log_error("failed to read %s: %s", +file.path(), strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+
+string Digest::hex()
+{
+	unsigned long long bits = _length * 8;
+	static const unsigned char pad[64] = { 0x80 };
+	update(pad, _used < 56 ? 56 - _used : 120 - _used);
+
+	unsigned char n[8];
+	for (int i = 0; i < 8; ++i)
+		n[i] = (unsigned char) (bits >> (56 - 8 * i));
+	update(n, 8);
+
+	static const char *hexdigits = "0123456789abcdef";
+	string s;
+	for (int i = 0; i < 8; ++i)
+		for (int shift = 28; shift >= 0; shift -= 4)
+			s += hexdigits[(_state[i] >> shift) & 0xf];
+	return s;
+}
+
+//---------------------------------------------------------------------------------------------
+
+string dcc_hash_file(const File &file)
+{
+	Digest digest;
+	if (!digest.update_file(file))
+		return "";
+	return digest.hex();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
@@ -0,0 +1,53 @@
+
+#ifndef _distcc_common_hash_h_
+#define _distcc_common_hash_h_
+
+#include <string>
+
+#include "rvfc/filesys/defs.h"
+
+namespace distcc
+{
+
+using std::string;
+using rvfc::File;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+// SHA-256 message digest, used to identify content (cache keys, upload dedup, toolchains).
+
+class Digest
+{
+	unsigned int _state[8];
+	unsigned char _block[64];
+	unsigned long long _length;
+	size_t _used;
+
+	void transform(const unsigned char *block);
+
+public:
+	enum { size = 32 };
+
+	Digest();
+
+	Digest &update(const void *data, size_t len);
+	Digest &update(const string &s);
+
+	// Strings are length-prefixed, so that ("ab","c") and ("a","bc") differ
+	Digest &update_field(const string &s);
+
+	// Returns false if the file could not be read
+	bool update_file(const File &file);
+
+	// Finish and return the digest as 64 hex characters.  The object is spent afterwards.
+	string hex();
+};
+
+// Digest of a whole file as hex, or an empty string if it could not be read
+string dcc_hash_file(const File &file);
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
+
+#endif // _distcc_common_hash_h_
@@ -80,6 +80,13 @@ class dcc_hostdef
 			compr = DCC_COMPRESS_LZO1X;
 			protover = DCC_VER_2;
 		}
+		accept_busy = options && !!(*options)["busy"];
+		send_digest = options && !!(*options)["dedup"];
+		want_usage = options && !!(*options)["usage"];
+		send_job_id = options && !!(*options)["timeline"];
+		ship_toolchain = options && !!(*options)["ship"];
+		send_toolchain = ship_toolchain || (options && !!(*options)["toolchain"]);
+		pump = options && !!(*options)["pump"];
 	}
 
 public:
@@ -126,11 +133,38 @@ public:
     // The kind of compression to use for this host
     enum dcc_compress compr;
 
+    // Server runs admission control and may turn us away (--max-queue)
+    bool accept_busy;
+
+    // Offer the digest of the preprocessed source first, and send it only if the server lacks it
+    bool send_digest;
+
+	// Ask the server what the compilation cost it (RUSG)
+	bool want_usage;
+
+	// Tell the server the job's id for its timeline (JOBI), when we keep one ($DISTCC_TIMELINE)
+	bool send_job_id;
+
+	// Send our compiler's fingerprint, and compile there only if the server's is the same (TOOL)
+	bool send_toolchain;
+
+	// ... and if it isn't, send the server our compiler (implies send_toolchain)
+	bool ship_toolchain;
+
+	// Send the source and the headers it includes, and let the server preprocess (CMD_FLAGS_PUMP)
+	bool pump;
+
 	void enjoyed_host();
 	void disliked_host();
 
 	int check_backoff() const;
 
+	void note_busy(unsigned wait_secs);
+	int check_busy() const;
+
+	void note_wrong_toolchain(const string &toolchain);
+	int check_toolchain(const string &toolchain) const;
+
 	int mark_timefile(const string &lockname);
 	void remove_timefile(const string &lockname);
 	int check_timefile(const string &lockname, time_t &mtime) const;
@@ -166,7 +200,10 @@ public:
 
 	bool operator!() const { return _hosts.empty(); }
 
-	dcc_hostdef lock_one(int &cpu_lock_fd);
+	dcc_hostdef lock_one(int &cpu_lock_fd, const string &toolchain = "");
+
+	// Some host has the toolchain option
+	bool want_toolchain() const;
 };
 
 //---------------------------------------------------------------------------------------------
@@ -0,0 +1,498 @@
+
+/**
+ * @file
+ *
+ * Content-addressed cache of compilation results, shared by the client and the server.
+ **/
+
+#include "common/config.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <map>
+#include <vector>
+#include <algorithm>
+
+#include "common/distcc.h"
+#include "common/trace.h"
+#include "common/objcache.h"
+
+#include "rvfc/text/defs.h"
+
+namespace distcc
+{
+
+using namespace rvfc::Text;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _WIN32
+
+// Names of the files making up an entry
+static const char *entry_status = "status", *entry_obj = "obj", *entry_dotd = "dotd",
+	*entry_err = "stderr", *entry_out = "stdout";
+
+// Leftovers of processes that died while storing an entry are removed after this many seconds
+static const int stale_tmp_secs = 3600;
+
+//---------------------------------------------------------------------------------------------
+
+static bool dcc_copy_to_fd(const string &from, int out_fd)
+{
+	int in_fd = open(+from, O_RDONLY | O_BINARY);
+	if (in_fd == -1)
+		return false;
+
+	char buf[65536];
+	ssize_t n;
+	bool ok = true;
+	while (ok && (n = read(in_fd, buf, sizeof(buf))) != 0)
+	{
+		if (n == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			ok = false;
+			break;
+		}
+		for (char *p = buf; n > 0; )
+		{
+			ssize_t w = write(out_fd, p, n);
+			if (w == -1)
+			{
+				if (errno == EINTR)
+					continue;
+				ok = false;
+				break;
+			}
+			p += w;
+			n -= w;
+		}
+	}
+
+	close(in_fd);
+	return ok;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static bool dcc_copy_file(const string &from, const string &to)
+{
+	int out_fd = open(+to, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+	if (out_fd == -1)
+	{
+		rs_log_error("failed to create %s: %s", +to, strerror(errno));
+		return false;
+	}
+
+	bool ok = dcc_copy_to_fd(from, out_fd);
+	if (close(out_fd) == -1)
+		ok = false;
+	if (!ok)
+		unlink(+to);
+	return ok;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static off_t dcc_file_size(const string &path)
+{
+	struct stat st;
+	return stat(+path, &st) == -1 ? 0 : st.st_size;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void dcc_remove_entry_dir(const string &path)
+{
+	DIR *d = opendir(+path);
+	if (d)
+	{
+		struct dirent *de;
+		while ((de = readdir(d)) != 0)
+			if (strcmp(de->d_name, ".") && strcmp(de->d_name, ".."))
+				unlink(+(path + "/" + de->d_name));
+		closedir(d);
+	}
+	rmdir(+path);
+}
+
+//---------------------------------------------------------------------------------------------
+
+ObjectCache::ObjectCache(const Directory &dir, unsigned long long max_size) :
+	_dir(dir), _max_size(max_size), _stats(0)
+{
+	if (!_max_size)
+		return;
+
+	if (mkdir(+_dir.path(), 0777) == -1 && errno != EEXIST)
+	{
+		rs_log_error("failed to create cache directory %s: %s; cache disabled", +_dir.path(), strerror(errno));
+		_max_size = 0;
+		return;
+	}
+
+	string stats_fname = _dir.path() + "/stats";
+	int fd = open(+stats_fname, O_RDWR | O_CREAT, 0666);
+	if (fd != -1)
+	{
+		struct stat st;
+		if (fstat(fd, &st) == 0 && (st.st_size >= (off_t) sizeof(Stats) || ftruncate(fd, sizeof(Stats)) == 0))
+		{
+			void *p = mmap(0, sizeof(Stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (p != MAP_FAILED)
+				_stats = (Stats *) p;
+		}
+		close(fd);
+	}
+
+	if (!_stats)
+	{
+		// counting just for ourselves is better than not counting at all
+		rs_log_warning("failed to map %s: %s", +stats_fname, strerror(errno));
+		_stats = new Stats();
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
+ObjectCache::~ObjectCache()
+{
+	// the mapping (or the private fallback) lives as long as the process
+}
+
+//---------------------------------------------------------------------------------------------
+
+string ObjectCache::entry_path(const string &key) const
+{
+	return stringf("%s/%.2s/%s", +_dir.path(), +key, +key);
+}
+
+//---------------------------------------------------------------------------------------------
+
+bool ObjectCache::fetch(const string &key, int &status, const File &obj, const File &dotd, fd_t err_fd, fd_t out_fd)
+{
+	if (!_max_size)
+		return false;
+
+	string path = entry_path(key);
+
+	FILE *f = fopen(+(path + "/" + entry_status), "r");
+	int st;
+	bool found = f && fscanf(f, "%d", &st) == 1;
+	if (f)
+		fclose(f);
+
+	// The entry may be evicted while we copy it out; that is just a late miss
+	if (!found
+		|| (!!obj && !dcc_copy_file(path + "/" + entry_obj, obj.path()))
+		|| (!!dotd && access(+(path + "/" + entry_dotd), F_OK) == 0
+			&& !dcc_copy_file(path + "/" + entry_dotd, dotd.path()))
+		|| (err_fd.fd != -1 && !dcc_copy_to_fd(path + "/" + entry_err, err_fd.fd))
+		|| (out_fd.fd != -1 && !dcc_copy_to_fd(path + "/" + entry_out, out_fd.fd)))
+	{
+		__sync_fetch_and_add(&_stats->misses, 1);
+		rs_trace("cache miss %s", +key);
+		return false;
+	}
+
+	// keep recently used entries at the young end of the eviction order
+	utime(+path, 0);
+
+	__sync_fetch_and_add(&_stats->hits, 1);
+	rs_trace("cache hit %s", +key);
+	status = st;
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+
+void ObjectCache::store(const string &key, int status, const File &obj, const File &dotd, const File &err, const File &out)
+{
+	if (!_max_size || status)
+		return;
+
+	string tmp = _dir.path() + "/tmp.XXXXXX";
+	if (!mkdtemp(&tmp[0]))
+	{
+		rs_log_warning("failed to create cache entry in %s: %s", +_dir.path(), strerror(errno));
+		return;
+	}
+
+	// An entry must always have the (possibly empty) message files and the object
+	bool ok = true;
+	const struct { const File *file; const char *name; } files[] =
+	{
+		{ &obj, entry_obj }, { &dotd, entry_dotd }, { &err, entry_err }, { &out, entry_out }
+	};
+	unsigned long long size = 0;
+	for (size_t i = 0; ok && i < sizeof(files) / sizeof(*files); ++i)
+	{
+		string to = tmp + "/" + files[i].name;
+		if (!!*files[i].file && files[i].file->exist())
+		{
+			ok = dcc_copy_file(files[i].file->path(), to);
+			size += dcc_file_size(to);
+		}
+		else if (files[i].file != &dotd)
+		{
+			int fd = open(+to, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+			ok = fd != -1 && files[i].file != &obj;
+			if (fd != -1)
+				close(fd);
+		}
+	}
+
+	if (ok)
+	{
+		// written last: an entry without a status is never used
+		FILE *f = fopen(+(tmp + "/" + entry_status), "w");
+		ok = f && fprintf(f, "%d\n", status) > 0;
+		if (f && fclose(f) != 0)
+			ok = false;
+	}
+
+	string path = entry_path(key);
+	mkdir(+path.substr(0, path.rfind('/')), 0777);
+	if (!ok || rename(+tmp, +path) == -1)
+	{
+		// most likely somebody else stored the same result first
+		if (ok)
+			rs_trace("not storing %s: %s", +key, strerror(errno));
+		dcc_remove_entry_dir(tmp);
+		return;
+	}
+
+	__sync_fetch_and_add(&_stats->stores, 1);
+	if (__sync_add_and_fetch(&_stats->bytes, size) > _max_size)
+		evict();
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Remove the least recently used entries until the cache is back at 90% of its limit.
+// Only one process evicts at a time; the others carry on.
+
+void ObjectCache::evict()
+{
+	string lock_fname = _dir.path() + "/lock";
+	int lock_fd = open(+lock_fname, O_WRONLY | O_CREAT, 0666);
+	if (lock_fd == -1)
+		return;
+	if (flock(lock_fd, LOCK_EX | LOCK_NB) == -1)
+	{
+		close(lock_fd);
+		return;
+	}
+
+	struct Entry
+	{
+		time_t mtime;
+		unsigned long long size;
+		string path;
+
+		bool operator<(const Entry &e) const { return mtime < e.mtime; }
+	};
+	std::vector<Entry> entries;
+	unsigned long long total = 0;
+	time_t now = time(0);
+
+	DIR *top = opendir(+_dir.path());
+	struct dirent *de;
+	while (top && (de = readdir(top)) != 0)
+	{
+		string bucket = _dir.path() + "/" + de->d_name;
+		struct stat st;
+
+		if (!strncmp(de->d_name, "tmp.", 4))
+		{
+			if (stat(+bucket, &st) == 0 && now - st.st_mtime > stale_tmp_secs)
+				dcc_remove_entry_dir(bucket);
+			continue;
+		}
+		if (strlen(de->d_name) != 2)
+			continue;
+
+		DIR *d = opendir(+bucket);
+		struct dirent *ee;
+		while (d && (ee = readdir(d)) != 0)
+		{
+			if (ee->d_name[0] == '.')
+				continue;
+			Entry e;
+			e.path = bucket + "/" + ee->d_name;
+			if (stat(+e.path, &st) == -1)
+				continue;
+			e.mtime = st.st_mtime;
+			e.size = 0;
+			const char *names[] = { entry_obj, entry_dotd, entry_err, entry_out };
+			for (size_t i = 0; i < sizeof(names) / sizeof(*names); ++i)
+				e.size += dcc_file_size(e.path + "/" + names[i]);
+			total += e.size;
+			entries.push_back(e);
+		}
+		if (d)
+			closedir(d);
+	}
+	if (top)
+		closedir(top);
+
+	std::sort(entries.begin(), entries.end());
+
+	unsigned long long target = _max_size / 10 * 9;
+	unsigned long long evicted = 0;
+	for (size_t i = 0; i < entries.size() && total > target; ++i)
+	{
+		dcc_remove_entry_dir(entries[i].path);
+		total -= entries[i].size;
+		++evicted;
+	}
+
+	// Replace the running estimate with what we just counted
+	_stats->bytes = total;
+	__sync_fetch_and_add(&_stats->evictions, evicted);
+	rs_log_info("cache: evicted %llu entries, %llu bytes left", evicted, total);
+
+	flock(lock_fd, LOCK_UN);
+	close(lock_fd);
+}
+
+//---------------------------------------------------------------------------------------------
+
+const ObjectCache::Stats &ObjectCache::stats() const
+{
+	static Stats none;
+	return _stats ? *_stats : none;
+}
+
+//---------------------------------------------------------------------------------------------
+
+void ObjectCache::log_stats() const
+{
+	const Stats &s = stats();
+	unsigned long long lookups = s.hits + s.misses;
+	rs_log_info("cache: %llu hits, %llu misses (%.1f%%), %llu stores, %llu evictions, %llu MB",
+		s.hits, s.misses, lookups ? 100.0 * s.hits / lookups : 0.0, s.stores, s.evictions, s.bytes >> 20);
+}
+
+//---------------------------------------------------------------------------------------------
+
+string dcc_compiler_stamp(const string &compiler_name, string &path)
+{
+	struct stat st;
+
+	path = "";
+
+	if (compiler_name.find('/') != string::npos)
+	{
+		if (stat(+compiler_name, &st) == 0)
+			path = compiler_name;
+	}
+	else
+	{
+		const char *envpath = getenv("PATH");
+		for (const char *p = envpath ? envpath : ""; *p; )
+		{
+			const char *n = strchr(p, ':');
+			size_t len = n ? n - p : strlen(p);
+			string candidate = (len ? string(p, len) : string(".")) + "/" + compiler_name;
+			if (stat(+candidate, &st) == 0 && S_ISREG(st.st_mode) && access(+candidate, X_OK) == 0)
+			{
+				path = candidate;
+				break;
+			}
+			p += n ? len + 1 : len;
+		}
+	}
+
+	if (path.empty())
+	{
+		rs_trace("can't find %s to fingerprint it", +compiler_name);
+		return "";
+	}
+
+	return stringf("%s:%lld:%ld", +path, (long long) st.st_size, (long) st.st_mtime);
+}
+
+//---------------------------------------------------------------------------------------------
+
+string dcc_compiler_fingerprint(const string &compiler_name)
+{
+	string path;
+	string stamp = dcc_compiler_stamp(compiler_name, path);
+	if (stamp.empty())
+		return "";
+
+	// Hashing the driver costs a few ms: do it once per compiler for the life of the process
+	static std::map<string, std::pair<string, string> > known;
+	std::pair<string, string> &fp = known[compiler_name];
+	if (fp.first != stamp)
+	{
+		string digest = dcc_hash_file(File(path));
+		if (digest.empty())
+			return "";
+		fp = std::make_pair(stamp, digest);
+	}
+	return fp.first + ":" + fp.second;
+}
+
+//---------------------------------------------------------------------------------------------
+
+#else // _WIN32
+
+ObjectCache::ObjectCache(const Directory &dir, unsigned long long max_size) :
+	_dir(dir), _max_size(0), _stats(0)
+{
+	if (max_size)
+		rs_log_warning("the compilation cache is not supported on this platform");
+}
+
+ObjectCache::~ObjectCache() {}
+
+bool ObjectCache::fetch(const string &key, int &status, const File &obj, const File &dotd, fd_t err_fd, fd_t out_fd)
+{
+	return false;
+}
+
+void ObjectCache::store(const string &key, int status, const File &obj, const File &dotd, const File &err, const File &out) {}
+
+const ObjectCache::Stats &ObjectCache::stats() const
+{
+	static Stats none;
+	return none;
+}
+
+void ObjectCache::log_stats() const {}
+
+string dcc_compiler_stamp(const string &compiler_name, string &path)
+{
+	path = "";
+	return "";
+}
+
+string dcc_compiler_fingerprint(const string &compiler_name)
+{
+	return "";
+}
+
+#endif // _WIN32
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
@@ -0,0 +1,81 @@
+
+#ifndef _distcc_common_objcache_h_
+#define _distcc_common_objcache_h_
+
+#include <string>
+
+#include "common/distcc.h"
+#include "common/hash.h"
+
+#include "rvfc/filesys/defs.h"
+
+namespace distcc
+{
+
+using std::string;
+using rvfc::File;
+using rvfc::Directory;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+// On-disk cache of compilation results, keyed by a digest of everything that determines them.
+//
+// Each entry is a directory DIR/xx/KEY holding the wait status, the compiler's stderr and
+// stdout, the object file and the dependency file.  Entries are assembled in a private
+// temporary directory and renamed into place, so several processes can share a cache without
+// ever seeing a partial entry.  Reading an entry touches it; when the cache grows beyond its
+// size limit the least recently used entries are removed.
+//
+// Counters are kept in DIR/stats, which is mapped shared by all processes using the cache.
+
+class ObjectCache
+{
+public:
+	struct Stats
+	{
+		unsigned long long hits, misses, stores, evictions;
+		unsigned long long bytes; // approximate size of all entries
+	};
+
+private:
+	Directory _dir;
+	unsigned long long _max_size;
+	Stats *_stats;
+
+	string entry_path(const string &key) const;
+	void evict();
+
+public:
+	// A max_size of zero disables the cache
+	ObjectCache(const Directory &dir, unsigned long long max_size);
+	~ObjectCache();
+
+	bool operator!() const { return !_max_size; }
+
+	// On a hit, writes the object and dependency files (if the entry has them),
+	// appends the compiler's messages to err_fd and out_fd, and sets status.
+	bool fetch(const string &key, int &status, const File &obj, const File &dotd, fd_t err_fd, fd_t out_fd);
+
+	// Only successful compilations are worth keeping; obj, dotd, err and out may be empty
+	void store(const string &key, int status, const File &obj, const File &dotd, const File &err, const File &out);
+
+	const Stats &stats() const;
+	void log_stats() const;
+};
+
+//---------------------------------------------------------------------------------------------
+
+// Find a compiler in $PATH (unless it names a path) and return "path:size:mtime", or an empty
+// string if it can't be found.
+string dcc_compiler_stamp(const string &compiler_name, string &path);
+
+// Identify a compiler installation by its resolved path, size, mtime, and content digest.
+// The digest is computed once per process for each path and modification time.
+// Returns an empty string if the compiler can't be found.
+string dcc_compiler_fingerprint(const string &compiler_name);
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
+
+#endif // _distcc_common_objcache_h_
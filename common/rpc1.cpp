@@ -96,7 +96,7 @@ dcc_exitcode dcc_x_token_int(fd_t ofd, const char *token, unsigned param)
     }
     buf[12] = '\0';
 
-	if (strncmp("ARGV", buf, 4))
+	if (rs_trace_enabled() && strncmp("ARGV", buf, 4))
 		rs_trace("send %s", buf);
     return dcc_writex(ofd, buf, 12);
 }
@@ -251,6 +251,37 @@ unsigned int dcc_r_token_int(fd_t ifd, const char *expected)
     return val;
 }
 
+//---------------------------------------------------------------------------------------------
+
+// Read a token and value, where the token is one of several possible ones.
+// @p token must have room for 5 characters.
+
+dcc_exitcode dcc_r_sometoken_int(fd_t ifd, char *token, unsigned &val)
+{
+    char buf[13], *bum;
+    dcc_exitcode ret;
+
+    if ((ret = dcc_readx(ifd, buf, 12))) 
+	{
+        rs_log_error("read failed while waiting for some token");
+        return ret;
+    }
+
+    memcpy(token, buf, 4);
+    token[4] = '\0';
+    buf[12] = '\0';
+
+    val = strtoul(&buf[4], &bum, 16);
+    if (bum != &buf[12]) 
+	{
+        rs_log_error("failed to parse parameter of token \"%s\"", token);
+        dcc_explain_mismatch(buf, 12, ifd);
+        return EXIT_PROTOCOL_ERROR;
+    }
+
+    return EXIT_OK;
+}
+
 //---------------------------------------------------------------------------------------------
 // Read a byte string of length @p l into a newly allocated buffer, returned in @p buf.
 
@@ -36,6 +36,8 @@ namespace distcc
 
 using rvfc::Directory;
 
+struct JobUsage;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
 dcc_exitcode dcc_x_result_header(fd_t ofd, enum dcc_protover);
@@ -47,6 +49,7 @@ dcc_exitcode dcc_r_cc_status(fd_t, int &);
 dcc_exitcode dcc_x_token_int(fd_t ofd, const char *token, unsigned param);
 dcc_exitcode dcc_r_token_int(fd_t ifd, const char *expected, unsigned int &val);
 unsigned int dcc_r_token_int(fd_t ifd, const char *expected);
+dcc_exitcode dcc_r_sometoken_int(fd_t ifd, char *token, unsigned &val);
 
 dcc_exitcode dcc_x_token_string(fd_t fd, const char *token, const string &buf);
 dcc_exitcode dcc_r_token_string(fd_t ifd, const char *expect_token, string &str);
@@ -63,6 +66,9 @@ dcc_exitcode dcc_x_session_name(fd_t fd, const string &session);
 dcc_exitcode dcc_r_flags(fd_t ifd, unsigned &flag);
 dcc_exitcode dcc_x_flags(fd_t ifd, unsigned flag);
 
+dcc_exitcode dcc_r_job_id(fd_t ifd, string &job_id);
+dcc_exitcode dcc_x_job_id(fd_t fd, const string &job_id);
+
 dcc_exitcode dcc_r_compile_dir(fd_t ifd, Directory &cdir);
 dcc_exitcode dcc_x_compile_dir(fd_t fd, const Directory &cdir);
 
@@ -73,11 +79,27 @@ dcc_exitcode dcc_r_argv(fd_t ifd, Arguments &args);
 Arguments dcc_r_argv(fd_t ifd);
 dcc_exitcode dcc_x_argv(fd_t fd, const Arguments &args);
 
+dcc_exitcode dcc_x_admission(fd_t fd, bool admitted, unsigned wait_secs);
+dcc_exitcode dcc_r_admission(fd_t ifd, unsigned &wait_secs);
+
+dcc_exitcode dcc_x_have_input(fd_t fd, bool have);
+dcc_exitcode dcc_r_have_input(fd_t ifd, bool &have);
+
+dcc_exitcode dcc_x_usage(fd_t fd, const JobUsage &usage);
+dcc_exitcode dcc_r_usage(fd_t ifd, JobUsage &usage);
+
 enum dcc_command_flags
 {
 	CMD_FLAGS_ON_SERVER = 0x1,
 	CMD_FLAGS_NEED_PDB = 0x2,
-	CMD_FLAGS_NEED_DOTI = 0x4
+	CMD_FLAGS_NEED_DOTI = 0x4,
+	CMD_FLAGS_ACCEPT_BUSY = 0x8, // client reads an ADMT/BUSY reply right after FLGS
+	CMD_FLAGS_DOTI_DIGEST = 0x10, // client sends DIGI, and DOTI only if the server answers NEED
+	CMD_FLAGS_RUSAGE = 0x20, // server ends its reply with RUSG
+	CMD_FLAGS_JOB_ID = 0x40, // client sends JOBI right after FLGS
+	CMD_FLAGS_TOOLCHAIN = 0x80, // client sends TOOL after FLGS (and JOBI), server answers TOOL after ARGV
+	CMD_FLAGS_SHIP_TOOLCHAIN = 0x100, // if the TOOLs differ, server sends SHIP, client may send ENVD and ENVA
+	CMD_FLAGS_PUMP = 0x200 // client sends CDIR and its files (NFIL) instead of DOTI (see server/mirror.h)
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////
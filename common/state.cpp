@@ -26,39 +26,36 @@
  * This file provides a way for distcc processes to make little notes
  * about what they're up to that can be read by a monitor process.
  *
- * State is stored as follows.
+ * State is kept in a table of fixed size, in the file "tasks" in the
+ * state directory, which every distcc process maps into memory.  A
+ * process claims a record the first time it notes its state, and gives
+ * it up when it exits.  Updating the state is then a few plain stores,
+ * without touching the filesystem.
  *
- * Within our temporary directory, we create a subdirectory called "state".
+ * Each record has a sequence number, which is odd while the record is
+ * being written.  Readers copy the record, and try again if the number
+ * was odd or changed meanwhile.
  *
- * Each process creates a file named "binstate%d", for its pid.  We
- * always rewrite this file from the beginning.
+ * The table also keeps running totals of jobs and bytes transferred, for
+ * monitors to work out rates from.
  *
- * Inside each of these, we store a binary struct in the native host
- * encoding.  Ugly, but quick and easy both in code and CPU time.
+ * If a process dies without giving up its record, the record is taken
+ * over by the next process that finds its owner gone, and ignored by
+ * readers until then.
  *
- * Any process reading these files needs to handle the fact that they may be
- * truncated or otherwise incorrect.
- *
- * When the process exits, it removes its state file.  If you didn't
- * notice it already, it's too late now.
- *
- * In addition, if the process identified by the file no longer
- * exists, then the file must be orphaned by a process that suddenly
- * terminated.  The file is ignored and can be deleted by the first
- * process that notices it.
- *
- * The reader interface for these files is in mon.c
- *
- * These files are considered a private format, and they may change
- * between distcc releases.  The only supported way to read them is
- * through mon.c.
+ * The table is a private format, and it may change between distcc
+ * releases.  The only supported way to read it is
+ * dcc_read_task_states().
  **/
 
 #include "config.h"
 
 #ifdef __linux__
 #include <unistd.h>
+#include <signal.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #endif
 
 #include <stdio.h>
@@ -76,11 +73,11 @@
 #include "rpc1.h"
 #include "trace.h"
 #include "exitcode.h"
+#include "timeline.h"
+#include "stats.h"
 
 #include "util.h"
 
-#include <exception>
-
 #include "rvfc/filesys/defs.h"
 
 namespace distcc
@@ -90,7 +87,6 @@ using namespace rvfc;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
-const char *dcc_state_prefix = "binstate_";
 Directory dcc_state_dir;
 
 #ifdef _WIN32
@@ -98,15 +94,6 @@ __declspec (thread)
 #endif
 struct dcc_task_state my_state;
 
-//---------------------------------------------------------------------------------------------
-// Return newly allocated buffer holding the name of this process's state file.
-// (This can't reliably be static because we might fork...)
-
-static Path dcc_get_state_filename()
-{
-	return stringf("%s/%s%ld", +dcc_state_dir.path(), dcc_state_prefix, (long) getpid());
-}
-
 //---------------------------------------------------------------------------------------------
 
 const char *dcc_get_phase_name(enum dcc_phase phase)
@@ -135,79 +122,289 @@ const char *dcc_get_phase_name(enum dcc_phase phase)
 }
 
 //---------------------------------------------------------------------------------------------
-// Get a file descriptor for writing to this process's state file
 
-class StateFile
+// On the way out: the last phase ends, and the job goes into the statistics
+
+static void dcc_end_last_phase()
 {
-	fd_t _fd;
+	struct timeval tv;
+	// (not in a forked child that didn't get as far as exec)
+	if (!my_state.phase_start || my_state.cpid != (unsigned long) getpid() || gettimeofday(&tv, NULL) == -1)
+		return;
+
+	dcc_timeline_phase(0, tv, my_state.file, my_state.host);
+	dcc_stats_note_phase(my_state.curr_phase, (long long) tv.tv_sec * 1000000 + tv.tv_usec - my_state.phase_start);
+	dcc_stats_commit(my_state.host, my_state.bytes_sent, my_state.bytes_received);
+	my_state.phase_start = 0;
+}
 
-public:
-	StateFile(const string &fname)
+//---------------------------------------------------------------------------------------------
+
+#ifdef __linux__
+
+struct dcc_state_record
+{
+	volatile unsigned seq;      // odd while being written
+	volatile pid_t owner;       // 0 if free
+	struct dcc_task_state state;
+};
+
+struct dcc_state_table
+{
+	unsigned magic;
+	unsigned record_size;
+	unsigned n_records;
+	unsigned unused;
+	volatile unsigned long long jobs, bytes_sent, bytes_received;
+	struct dcc_state_record records[1];
+};
+
+enum { dcc_state_records = 1024 };
+
+static const size_t dcc_state_table_size =
+	sizeof(dcc_state_table) + (dcc_state_records - 1) * sizeof(dcc_state_record);
+
+static dcc_state_table *state_table = 0;
+static bool state_table_writable = false;
+static dcc_state_record *my_record = 0;
+
+//---------------------------------------------------------------------------------------------
+
+// Map the table, creating it if it's not there.  Null if it can't be had.
+
+static dcc_state_table *dcc_map_state_table(bool create)
+{
+	if (state_table && (state_table_writable || !create))
+		return state_table;
+	if (state_table)
 	{
-		_fd.socket = 0;
-		_fd.fd = open(+fname, O_CREAT|O_WRONLY|O_TRUNC|O_BINARY, 0666);
-		if (_fd.fd == -1)
-		{
-			rs_log_error("failed to open %s: %s", fname, strerror(errno));
-			throw "failed to open state file";
-		}
+		// mapped for reading only so far
+		munmap(state_table, dcc_state_table_size);
+		state_table = 0;
 	}
 
-	~StateFile()
+	string fname = stringf("%s/tasks", +dcc_state_dir.path());
+	int fd = open(+fname, create ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0666);
+	if (fd == -1)
 	{
-		dcc_close(_fd);
+		if (create)
+			rs_log_warning("failed to open %s: %s", +fname, strerror(errno));
+		return 0;
 	}
 
-	fd_t fd() const { return _fd; }
-};
+	// Any number of processes may be doing this at once; they all make it the same size
+	struct stat st;
+	if (fstat(fd, &st) == -1
+		|| ((size_t) st.st_size < dcc_state_table_size && (!create || ftruncate(fd, dcc_state_table_size) == -1)))
+	{
+		if (create)
+			rs_log_warning("failed to size %s: %s", +fname, strerror(errno));
+		close(fd);
+		return 0;
+	}
+
+	void *p = mmap(0, dcc_state_table_size, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+	{
+		rs_log_warning("failed to map %s: %s", +fname, strerror(errno));
+		return 0;
+	}
+
+	dcc_state_table *table = (dcc_state_table *) p;
+	if (create && table->magic != DCC_STATE_MAGIC)
+	{
+		table->record_size = sizeof(dcc_state_record);
+		table->n_records = dcc_state_records;
+		table->magic = DCC_STATE_MAGIC;
+	}
+	if (table->magic != DCC_STATE_MAGIC || table->record_size != sizeof(dcc_state_record)
+		|| table->n_records != dcc_state_records)
+	{
+		// belongs to a different version of distcc
+		if (create)
+			rs_log_warning("%s has an unknown format; not noting state", +fname);
+		munmap(p, dcc_state_table_size);
+		return 0;
+	}
+
+	state_table_writable = create;
+	return state_table = table;
+}
 
 //---------------------------------------------------------------------------------------------
 
-static int dcc_open_state(fd_t &fd, const char *fname)
+static bool dcc_pid_gone(pid_t pid)
+{
+	return kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// The record of this process, claimed on first use
+
+static dcc_state_record *dcc_my_record()
 {
-	fd.socket = 0;
-	fd.fd = open(fname, O_CREAT|O_WRONLY|O_TRUNC|O_BINARY, 0666);
-	if (fd.fd == -1)
+	pid_t pid = getpid();
+	if (my_record && my_record->owner == pid)
+		return my_record;
+	my_record = 0; // a forked child has to claim its own
+
+	dcc_state_table *table = dcc_map_state_table(true);
+	if (!table)
+		return 0;
+
+	// Start looking at different places, so that processes starting together don't collide
+	for (int n = 0; n < dcc_state_records; ++n)
 	{
-		rs_log_error("failed to open %s: %s", fname, strerror(errno));
-		return EXIT_IO_ERROR;
+		dcc_state_record *r = &table->records[(pid + n) % dcc_state_records];
+		pid_t owner = r->owner;
+		if ((owner == 0 || (owner != pid && dcc_pid_gone(owner)))
+			&& __sync_bool_compare_and_swap(&r->owner, owner, pid))
+		{
+			// An owner that died while publishing left the sequence number odd, which would
+			// hide the record from readers for good
+			unsigned seq = r->seq;
+			__atomic_store_n(&r->seq, (seq + 1) & ~1u, __ATOMIC_RELEASE);
+			return my_record = r;
+		}
 	}
 
+	rs_trace("task state table is full");
 	return 0;
 }
 
 //---------------------------------------------------------------------------------------------
 
-// Remove the state file for this process.
+static void dcc_publish_state(dcc_state_record *r, const dcc_task_state *state)
+{
+	__atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (state)
+		r->state = *state;
+	else
+		memset(&r->state, 0, sizeof(r->state));
+	__atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELEASE);
+}
+
+//---------------------------------------------------------------------------------------------
+
+static int dcc_write_state()
+{
+	dcc_state_record *r = dcc_my_record();
+	if (r)
+		dcc_publish_state(r, &my_state);
+	return 0;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Give up the record of this process.
 // This can be called from atexit().
 
-void dcc_remove_state_file()
+void dcc_remove_state()
+{
+	dcc_end_last_phase();
+
+	if (!my_record || my_record->owner != getpid())
+		return; // It's OK if we never claimed one
+
+	dcc_publish_state(my_record, NULL);
+	__sync_add_and_fetch(&state_table->jobs, 1);
+	__sync_bool_compare_and_swap(&my_record->owner, getpid(), 0);
+	my_record = 0;
+}
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_note_state_bytes(unsigned long long sent, unsigned long long received)
 {
-    string fname = dcc_get_state_filename();
-	if (unlink(+fname) == -1) 
+	my_state.bytes_sent += sent;
+	my_state.bytes_received += received;
+
+	dcc_state_record *r = dcc_my_record();
+	if (!r)
+		return;
+	__sync_add_and_fetch(&state_table->bytes_sent, sent);
+	__sync_add_and_fetch(&state_table->bytes_received, received);
+	dcc_publish_state(r, &my_state);
+}
+
+//---------------------------------------------------------------------------------------------
+
+int dcc_read_task_states(std::vector<dcc_task_state> &tasks, dcc_task_totals *totals)
+{
+	tasks.clear();
+	if (totals)
+		memset(totals, 0, sizeof(*totals));
+
+	dcc_state_table *table = dcc_map_state_table(false);
+	if (!table)
+		return 0; // nobody has noted anything yet
+
+	if (totals)
+	{
+		totals->jobs = table->jobs;
+		totals->bytes_sent = table->bytes_sent;
+		totals->bytes_received = table->bytes_received;
+	}
+
+	for (int i = 0; i < dcc_state_records; ++i)
 	{
-        // It's OK if we never created it
-        if (errno != ENOENT) 
+		const dcc_state_record *r = &table->records[i];
+		pid_t owner = r->owner;
+		if (owner == 0 || dcc_pid_gone(owner))
+			continue;
+
+		// If the owner keeps changing it, give up on this one for now
+		for (int attempt = 0; attempt < 100; ++attempt)
 		{
-            rs_log_warning("failed to unlink %s: %s", fname, strerror(errno));
-            // ret = EXIT_IO_ERROR;
-        }
-    }
+			unsigned seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+			if (seq & 1)
+				continue;
+			dcc_task_state state = r->state;
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&r->seq, __ATOMIC_RELAXED) != seq)
+				continue;
+
+			if (state.cpid == (unsigned long) owner)
+				tasks.push_back(state);
+			break;
+		}
+	}
+
+	return 0;
 }
 
 //---------------------------------------------------------------------------------------------
 
-static int dcc_write_state(fd_t fd)
+#else // ! __linux__
+
+// No shared table: the state is kept in memory only, for the timeline
+
+static int dcc_write_state() { return 0; }
+
+void dcc_remove_state()
 {
-    // Write out as one big blob.  fd is positioned at the start of the file.
+	dcc_end_last_phase();
+}
 
-    int ret = dcc_writex(fd, &my_state, sizeof my_state);
-    if (ret)
-        return ret;
+void dcc_note_state_bytes(unsigned long long sent, unsigned long long received)
+{
+	my_state.bytes_sent += sent;
+	my_state.bytes_received += received;
+}
 
-    return 0;
+int dcc_read_task_states(std::vector<dcc_task_state> &tasks, dcc_task_totals *totals)
+{
+	tasks.clear();
+	if (totals)
+		memset(totals, 0, sizeof(*totals));
+	return 0;
 }
 
+#endif // ! __linux__
+
 //---------------------------------------------------------------------------------------------
 
 // Record the state of this process.
@@ -216,14 +413,8 @@ static int dcc_write_state(fd_t fd)
 
 int dcc_note_state(enum dcc_phase state, const File &source_file, const string &host)
 {
-    int ret = 0;
-
-    my_state.struct_size = sizeof(my_state);
-    my_state.magic = DCC_STATE_MAGIC;
     my_state.cpid = (unsigned long) getpid();
 
-    Path fname = dcc_get_state_filename();
-
     Path source_base = source_file.path().basename();
     if (!!source_base)
         strlcpy(my_state.file, +source_base, sizeof(my_state.file));
@@ -238,35 +429,24 @@ int dcc_note_state(enum dcc_phase state, const File &source_file, const string &
 		// throw "dcc_note_state: gettimeofday failed";
 		return -1;
     }
+    long long now = (long long) tv.tv_sec * 1000000 + tv.tv_usec;
+    if (my_state.phase_start)
+        dcc_stats_note_phase(my_state.curr_phase, now - my_state.phase_start);
     my_state.curr_phase = state;
+    my_state.phase_start = now;
+    dcc_timeline_phase(state == DCC_PHASE_DONE ? 0 : dcc_get_phase_name(state), tv, my_state.file, my_state.host);
 
     rs_trace("note state %d, file \"%s\", host \"%s\"", state, +source_base, +host);
 
-	try
-	{
-		StateFile state_file(fname);
-		return dcc_write_state(state_file.fd());
-	}
-	catch (std::exception &x)
-	{
-		return -1;
-	}
-
-    return 0;
+	return dcc_write_state();
 }
 
 //---------------------------------------------------------------------------------------------
 
 int dcc_note_state(enum dcc_phase state)
 {
-    int ret = 0;
-
-    my_state.struct_size = sizeof(my_state);
-    my_state.magic = DCC_STATE_MAGIC;
     my_state.cpid = (unsigned long) getpid();
 
-    Path fname = dcc_get_state_filename();
-
     struct timeval tv;
     if (gettimeofday(&tv, NULL) == -1) 
 	{
@@ -274,21 +454,16 @@ int dcc_note_state(enum dcc_phase state)
 		// throw "dcc_note_state: gettimeofday failed";
 		return -1;
     }
+    long long now = (long long) tv.tv_sec * 1000000 + tv.tv_usec;
+    if (my_state.phase_start)
+        dcc_stats_note_phase(my_state.curr_phase, now - my_state.phase_start);
     my_state.curr_phase = state;
+    my_state.phase_start = now;
+    dcc_timeline_phase(state == DCC_PHASE_DONE ? 0 : dcc_get_phase_name(state), tv, my_state.file, my_state.host);
 
     rs_trace("note state %d", state);
 
-	try
-	{
-		StateFile state_file(fname);
-		return dcc_write_state(state_file.fd());
-	}
-	catch (std::exception &x)
-	{
-		return -1;
-	}
-
-    return 0;
+	return dcc_write_state();
 }
 
 //---------------------------------------------------------------------------------------------
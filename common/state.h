@@ -24,6 +24,7 @@
 #define _DISTCC_STATE_H
 
 #include <string>
+#include <vector>
 
 #include "rvfc/filesys/defs.h"
 #include "rvfc/text/defs.h"
@@ -39,7 +40,7 @@ using rvfc::Directory;
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
 // Note that these must be in the order in which they are encountered
-// for the state file to work properly.  It's OK if some are skipped though.
+// for monitors to show them properly.  It's OK if some are skipped though.
 
 enum dcc_phase 
 {
@@ -53,40 +54,46 @@ enum dcc_phase
     DCC_PHASE_DONE              /**< MUST be last */
 };
 
-#define DCC_STATE_MAGIC 0x44494800 /* DIH\0 */
+#define DCC_STATE_MAGIC 0x44494802 /* DIH\2 */
 
-// State and history of a distcc process.  
-// Used in memory and also in native format for binary state files.
-// This should be <4kB, so that it will normally be written out atomically.
+// State of a distcc process, as kept in the shared task table
+// (the table is in native format, like the binary state files it replaced).
 
 struct dcc_task_state 
 {
-    size_t struct_size;
-    unsigned long magic;
     unsigned long cpid;         /**< Client pid */
     char file[128];             /**< Input filename  */
     char host[128];             /**< Destination host description */
     int slot;                   /**< Which CPU slot for this host */
 
     enum dcc_phase curr_phase;
+    long long phase_start;      /**< When curr_phase was entered, usecs since the epoch */
 
-    // In memory, point to the next in a list of all tasks.  In the file, undefined.
-	struct dcc_task_state *next;
+    unsigned long long bytes_sent, bytes_received;
+};
+
+// Running totals of all processes that have used the table
+struct dcc_task_totals
+{
+    unsigned long long jobs, bytes_sent, bytes_received;
 };
 
-extern const char *dcc_state_prefix;
 extern Directory dcc_state_dir;
 
 Directory dcc_get_state_dir ();
-int dcc_open_state_file (int &p_fd);
 
 int dcc_note_state(enum dcc_phase state, const File &file, const string &host);
 int dcc_note_state(enum dcc_phase state);
-void dcc_remove_state_file();
+void dcc_remove_state();
 
 const char *dcc_get_phase_name(enum dcc_phase);
 
 void dcc_note_state_slot(int slot);
+void dcc_note_state_bytes(unsigned long long sent, unsigned long long received);
+
+// The states of the live distcc processes using the state directory.
+// Each is a consistent snapshot, though not all of them are taken at the same instant.
+int dcc_read_task_states(std::vector<dcc_task_state> &tasks, dcc_task_totals *totals = 0);
 
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -0,0 +1,408 @@
+/**
+ * @file
+ *
+ * Statistics of the client, shared by all distcc processes on the machine.
+ *
+ * Each process keeps the time it spent in each phase, and adds them to the shared file
+ * once, on the way out, under the host its job went to.  Hosts are given records on first
+ * use; when those run out, jobs are counted under the last record, "(other)".
+ **/
+
+#include "config.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "util.h"
+#include "stats.h"
+
+#include "rvfc/text/defs.h"
+
+namespace distcc
+{
+
+using namespace rvfc::Text;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+static long long my_phase_usecs[DCC_PHASE_DONE];
+static bool my_phase_seen[DCC_PHASE_DONE];
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_stats_note_phase(enum dcc_phase phase, long long usecs)
+{
+	if (phase < DCC_PHASE_STARTUP || phase >= DCC_PHASE_DONE || usecs < 0)
+		return;
+	my_phase_usecs[phase] += usecs;
+	my_phase_seen[phase] = true;
+}
+
+//---------------------------------------------------------------------------------------------
+
+#ifdef __linux__
+
+// Log-linear buckets: values below 8 exactly, then 8 buckets for each power of 2
+enum
+{
+	dcc_stats_sub_bits = 3,
+	dcc_stats_sub = 1 << dcc_stats_sub_bits,
+	dcc_stats_max_exp = 35, // 2^35us is 9.5 hours; anything longer goes in the last bucket
+	dcc_stats_buckets = (dcc_stats_max_exp - dcc_stats_sub_bits + 2) * dcc_stats_sub,
+	dcc_stats_hosts = 64
+};
+
+#define DCC_STATS_MAGIC 0x44495301 /* DIS\1 */
+
+struct dcc_stats_phase
+{
+	unsigned long long count, sum_usecs, max_usecs;
+	unsigned buckets[dcc_stats_buckets];
+};
+
+struct dcc_stats_host
+{
+	volatile unsigned state;    // 0 free, 1 being named, 2 in use
+	char name[60];
+	unsigned long long jobs, bytes_sent, bytes_received;
+	dcc_stats_phase phases[DCC_PHASE_DONE];
+};
+
+struct dcc_stats_file
+{
+	unsigned magic;
+	unsigned size;
+	volatile long long reset_usecs;
+	dcc_stats_host hosts[dcc_stats_hosts];
+};
+
+static dcc_stats_file *stats_file = 0;
+
+//---------------------------------------------------------------------------------------------
+
+static long long dcc_stats_now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (long long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static int dcc_stats_bucket(unsigned long long usecs)
+{
+	if (usecs < dcc_stats_sub)
+		return (int) usecs;
+	int exp = 63 - __builtin_clzll(usecs);
+	if (exp > dcc_stats_max_exp)
+		return dcc_stats_buckets - 1;
+	return (exp - dcc_stats_sub_bits + 1) * dcc_stats_sub + (int) ((usecs >> (exp - dcc_stats_sub_bits)) & (dcc_stats_sub - 1));
+}
+
+//---------------------------------------------------------------------------------------------
+
+// The middle of the values that fall in a bucket
+
+static double dcc_stats_bucket_value(int bucket)
+{
+	if (bucket < dcc_stats_sub)
+		return bucket;
+	int exp = bucket / dcc_stats_sub + dcc_stats_sub_bits - 1;
+	unsigned long long width = 1ULL << (exp - dcc_stats_sub_bits);
+	return (double) ((dcc_stats_sub + bucket % dcc_stats_sub) * width) + width / 2.0;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static dcc_stats_file *dcc_map_stats(bool create)
+{
+	if (stats_file)
+		return stats_file;
+
+	string fname = stringf("%s/stats", +dcc_state_dir.path());
+	int fd = open(+fname, O_RDWR | (create ? O_CREAT : 0) | O_CLOEXEC, 0666);
+	if (fd == -1)
+	{
+		if (create)
+			rs_log_warning("failed to open %s: %s", +fname, strerror(errno));
+		return 0;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || ((size_t) st.st_size < sizeof(dcc_stats_file) && ftruncate(fd, sizeof(dcc_stats_file)) == -1))
+	{
+		rs_log_warning("failed to size %s: %s", +fname, strerror(errno));
+		close(fd);
+		return 0;
+	}
+
+	void *p = mmap(0, sizeof(dcc_stats_file), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+	{
+		rs_log_warning("failed to map %s: %s", +fname, strerror(errno));
+		return 0;
+	}
+
+	dcc_stats_file *stats = (dcc_stats_file *) p;
+	if (__sync_bool_compare_and_swap(&stats->magic, 0, DCC_STATS_MAGIC))
+	{
+		stats->reset_usecs = dcc_stats_now();
+		__atomic_store_n(&stats->size, (unsigned) sizeof(dcc_stats_file), __ATOMIC_RELEASE);
+	}
+	// another process may be just setting it up
+	for (int i = 0; i < 1000 && stats->magic == DCC_STATS_MAGIC && !__atomic_load_n(&stats->size, __ATOMIC_ACQUIRE); ++i)
+		sched_yield();
+	if (stats->magic != DCC_STATS_MAGIC || stats->size != sizeof(dcc_stats_file))
+	{
+		rs_log_warning("%s has an unknown format; remove it to start afresh", +fname);
+		munmap(p, sizeof(dcc_stats_file));
+		return 0;
+	}
+
+	return stats_file = stats;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static dcc_stats_host *dcc_stats_host_record(dcc_stats_file *stats, const char *name)
+{
+	for (int i = 0; i < dcc_stats_hosts - 1; ++i)
+	{
+		dcc_stats_host *h = &stats->hosts[i];
+		if (h->state == 0 && __sync_bool_compare_and_swap(&h->state, 0, 1))
+		{
+			strlcpy(h->name, name, sizeof(h->name));
+			__atomic_store_n(&h->state, 2, __ATOMIC_RELEASE);
+			return h;
+		}
+
+		// somebody else is naming it, very briefly
+		while (__atomic_load_n(&h->state, __ATOMIC_ACQUIRE) == 1)
+			sched_yield();
+		if (!strncmp(h->name, name, sizeof(h->name) - 1))
+			return h;
+	}
+
+	dcc_stats_host *other = &stats->hosts[dcc_stats_hosts - 1];
+	if (__sync_bool_compare_and_swap(&other->state, 0, 2))
+		strlcpy(other->name, "(other)", sizeof(other->name));
+	return other;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void dcc_stats_max(unsigned long long *max, unsigned long long value)
+{
+	unsigned long long old;
+	while ((old = *max) < value && !__sync_bool_compare_and_swap(max, old, value))
+		;
+}
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_stats_commit(const char *host, unsigned long long bytes_sent, unsigned long long bytes_received)
+{
+	dcc_stats_file *stats = dcc_map_stats(true);
+	if (!stats)
+		return;
+
+	dcc_stats_host *h = dcc_stats_host_record(stats, host && *host ? host : "(none)");
+	__sync_add_and_fetch(&h->jobs, 1);
+	__sync_add_and_fetch(&h->bytes_sent, bytes_sent);
+	__sync_add_and_fetch(&h->bytes_received, bytes_received);
+
+	for (int phase = DCC_PHASE_STARTUP; phase < DCC_PHASE_DONE; ++phase)
+	{
+		if (!my_phase_seen[phase])
+			continue;
+		dcc_stats_phase &p = h->phases[phase];
+		unsigned long long usecs = my_phase_usecs[phase];
+		__sync_add_and_fetch(&p.count, 1);
+		__sync_add_and_fetch(&p.sum_usecs, usecs);
+		__sync_add_and_fetch(&p.buckets[dcc_stats_bucket(usecs)], 1);
+		dcc_stats_max(&p.max_usecs, usecs);
+	}
+
+	memset(my_phase_seen, 0, sizeof(my_phase_seen));
+	memset(my_phase_usecs, 0, sizeof(my_phase_usecs));
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void dcc_stats_add(dcc_stats_host &sum, const dcc_stats_host &h)
+{
+	sum.jobs += h.jobs;
+	sum.bytes_sent += h.bytes_sent;
+	sum.bytes_received += h.bytes_received;
+	for (int phase = 0; phase < DCC_PHASE_DONE; ++phase)
+	{
+		dcc_stats_phase &s = sum.phases[phase];
+		const dcc_stats_phase &p = h.phases[phase];
+		s.count += p.count;
+		s.sum_usecs += p.sum_usecs;
+		if (p.max_usecs > s.max_usecs)
+			s.max_usecs = p.max_usecs;
+		for (int b = 0; b < dcc_stats_buckets; ++b)
+			s.buckets[b] += p.buckets[b];
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
+static double dcc_stats_percentile(const dcc_stats_phase &p, double pct)
+{
+	unsigned long long total = 0;
+	for (int b = 0; b < dcc_stats_buckets; ++b)
+		total += p.buckets[b];
+	if (!total)
+		return 0;
+
+	unsigned long long rank = (unsigned long long) (pct / 100.0 * total + 0.5), seen = 0;
+	if (rank < 1)
+		rank = 1;
+	for (int b = 0; b < dcc_stats_buckets; ++b)
+	{
+		seen += p.buckets[b];
+		if (seen >= rank)
+		{
+			// no more than the largest, which the bucket may be wider than
+			double value = dcc_stats_bucket_value(b);
+			return (value < p.max_usecs ? value : p.max_usecs) / 1e6;
+		}
+	}
+	return p.max_usecs / 1e6;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void dcc_stats_print_host(FILE *out, const char *name, const dcc_stats_host &h, double secs)
+{
+	fprintf(out, "%s: %llu jobs, %.2f jobs/s, sent %.1f MB (%.3f MB/s), received %.1f MB (%.3f MB/s)\n",
+		name, h.jobs, h.jobs / secs, h.bytes_sent / 1e6, h.bytes_sent / 1e6 / secs,
+		h.bytes_received / 1e6, h.bytes_received / 1e6 / secs);
+
+	// Where the time goes: each phase's share of the time of all phases
+	unsigned long long all_usecs = 0;
+	for (int phase = 0; phase < DCC_PHASE_DONE; ++phase)
+		all_usecs += h.phases[phase].sum_usecs;
+
+	fprintf(out, "  %-12s %8s %6s %9s %9s %9s %9s %9s\n", "phase", "count", "share", "mean", "p50", "p90", "p99", "max");
+	for (int phase = 0; phase < DCC_PHASE_DONE; ++phase)
+	{
+		const dcc_stats_phase &p = h.phases[phase];
+		if (!p.count)
+			continue;
+		fprintf(out, "  %-12s %8llu %5.1f%% %8.3fs %8.3fs %8.3fs %8.3fs %8.3fs\n",
+			dcc_get_phase_name((enum dcc_phase) phase), p.count,
+			all_usecs ? 100.0 * p.sum_usecs / all_usecs : 0.0, p.sum_usecs / 1e6 / p.count,
+			dcc_stats_percentile(p, 50), dcc_stats_percentile(p, 90), dcc_stats_percentile(p, 99),
+			p.max_usecs / 1e6);
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
+int dcc_stats_report(FILE *out)
+{
+	dcc_stats_file *stats = dcc_map_stats(false);
+	if (!stats)
+	{
+		fprintf(out, "no statistics yet\n");
+		return 0;
+	}
+
+	long long reset = stats->reset_usecs;
+	double secs = (dcc_stats_now() - reset) / 1e6;
+	if (secs < 1e-3)
+		secs = 1e-3;
+
+	char since[64];
+	time_t t = (time_t) (reset / 1000000);
+	strftime(since, sizeof(since), "%Y-%m-%d %H:%M:%S", localtime(&t));
+	fprintf(out, "distcc statistics since %s (%.0fs)\n\n", since, secs);
+
+	dcc_stats_host *all = (dcc_stats_host *) calloc(1, sizeof(dcc_stats_host));
+	if (!all)
+		return EXIT_OUT_OF_MEMORY;
+
+	int n_hosts = 0;
+	for (int i = 0; i < dcc_stats_hosts; ++i)
+	{
+		const dcc_stats_host &h = stats->hosts[i];
+		if (h.state != 2 || !h.jobs)
+			continue;
+		dcc_stats_add(*all, h);
+		++n_hosts;
+	}
+	dcc_stats_print_host(out, "all hosts", *all, secs);
+	free(all);
+
+	for (int i = 0; i < dcc_stats_hosts && n_hosts > 1; ++i)
+	{
+		const dcc_stats_host &h = stats->hosts[i];
+		if (h.state != 2 || !h.jobs)
+			continue;
+		char name[sizeof(h.name)];
+		strlcpy(name, h.name, sizeof(name));
+		fprintf(out, "\n");
+		dcc_stats_print_host(out, name, h, secs);
+	}
+
+	return 0;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Jobs that finish while this runs may be partly counted; the hosts keep their records
+
+int dcc_stats_reset()
+{
+	dcc_stats_file *stats = dcc_map_stats(true);
+	if (!stats)
+		return EXIT_IO_ERROR;
+
+	for (int i = 0; i < dcc_stats_hosts; ++i)
+	{
+		dcc_stats_host &h = stats->hosts[i];
+		h.jobs = h.bytes_sent = h.bytes_received = 0;
+		memset(h.phases, 0, sizeof(h.phases));
+	}
+	stats->reset_usecs = dcc_stats_now();
+	return 0;
+}
+
+//---------------------------------------------------------------------------------------------
+
+#else // ! __linux__
+
+void dcc_stats_commit(const char *host, unsigned long long bytes_sent, unsigned long long bytes_received) {}
+
+int dcc_stats_report(FILE *out)
+{
+	fprintf(out, "statistics are not kept on this platform\n");
+	return 0;
+}
+
+int dcc_stats_reset() { return 0; }
+
+#endif // ! __linux__
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
@@ -0,0 +1,33 @@
+
+#ifndef _distcc_common_stats_h_
+#define _distcc_common_stats_h_
+
+#include <stdio.h>
+
+#include "common/state.h"
+
+namespace distcc
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+// Statistics of the client: for each host, the number of jobs, bytes sent and received, and
+// a histogram of the time spent in each phase.  Kept in the file "stats" in the state
+// directory, which all clients map shared and add to with atomic increments, so no lock
+// is taken.  The histograms have buckets of about 12% width from 1us up to hours.
+
+// The time this process has spent in a phase; kept until dcc_stats_commit()
+void dcc_stats_note_phase(enum dcc_phase phase, long long usecs);
+
+// Add the job of this process to the statistics of the host it went to
+void dcc_stats_commit(const char *host, unsigned long long bytes_sent, unsigned long long bytes_received);
+
+// Print percentiles and throughput since the last reset (distcc --stats)
+int dcc_stats_report(FILE *out);
+int dcc_stats_reset();
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
+
+#endif // _distcc_common_stats_h_
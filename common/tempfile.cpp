@@ -121,6 +121,16 @@ string dcc_get_tmp_top()
 #endif
 }
 
+//---------------------------------------------------------------------------------------------
+
+// Directory for dcc_make_tmpnam, if not the temporary directory (e.g. one in memory)
+static string dcc_workspace;
+
+void dcc_set_workspace(const string &dir)
+{
+	dcc_workspace = dir;
+}
+
 //---------------------------------------------------------------------------------------------
 // Create the directory @p path.  If it already exists as a directory we succeed.
 
@@ -148,7 +158,7 @@ void dcc_mkdir(const string &path)
 
 File dcc_make_tmpnam(const char *prefix, const char *suffix)
 {
-    string tempdir = dcc_get_tmp_top();
+    string tempdir = dcc_workspace.empty() ? dcc_get_tmp_top() : dcc_workspace;
 
 #ifdef __linux__
     if (access(+tempdir, W_OK|X_OK) == -1) 
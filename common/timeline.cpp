@@ -0,0 +1,160 @@
+/**
+ * @file
+ *
+ * Timeline of job phases in the Chrome trace-event format.
+ *
+ * Events are written as they happen with a single write() to a file opened with O_APPEND,
+ * so any number of processes may share the file, and a process that dies leaves behind
+ * whole lines only.  The file is not a complete JSON document; distcc-trace-merge makes one.
+ **/
+
+#include "config.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/time.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#endif
+
+#include "distcc.h"
+#include "trace.h"
+#include "util.h"
+#include "timeline.h"
+
+#include "rvfc/text/defs.h"
+
+namespace distcc
+{
+
+using namespace rvfc::Text;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+static int timeline_fd = -1;
+static pid_t timeline_pid = 0; // the process that opened timeline_fd
+
+// The phase the client is in
+static const char *curr_phase = 0;
+static struct timeval curr_phase_start;
+
+//---------------------------------------------------------------------------------------------
+
+bool dcc_timeline_enabled()
+{
+	static int enabled = -1;
+	if (enabled == -1)
+	{
+		const char *dir = getenv("DISTCC_TIMELINE");
+		enabled = dir && *dir;
+	}
+	return !!enabled;
+}
+
+//---------------------------------------------------------------------------------------------
+
+const string &dcc_timeline_job_id()
+{
+	static string job_id;
+	if (job_id.empty())
+	{
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		job_id = stringf("%s-%ld-%llu", dcc_gethostname(), (long) getpid(),
+			(unsigned long long) tv.tv_sec * 1000000 + tv.tv_usec);
+	}
+	return job_id;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// The file is opened once per process: a forked server worker gets a file descriptor of its own
+
+static int dcc_timeline_fd()
+{
+	if (timeline_fd != -1 && timeline_pid == getpid())
+		return timeline_fd;
+
+	if (timeline_fd != -1)
+		close(timeline_fd);
+
+	string fname = stringf("%s/%s-%s.trace", getenv("DISTCC_TIMELINE"), rs_program_name, dcc_gethostname());
+	timeline_fd = open(+fname, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+	timeline_pid = getpid();
+	if (timeline_fd == -1)
+		rs_log_warning("failed to open timeline %s: %s", +fname, strerror(errno));
+	return timeline_fd;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static string dcc_json_string(const char *s)
+{
+	string r;
+	for (; s && *s; ++s)
+	{
+		unsigned char c = *s;
+		if (c == '"' || c == '\\')
+		{
+			r += '\\';
+			r += c;
+		}
+		else if (c < 0x20)
+			r += stringf("\\u%04x", c);
+		else
+			r += c;
+	}
+	return r;
+}
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_timeline_span(const char *name, const struct timeval &start, const struct timeval &end,
+	const string &job_id, const char *file, const char *host)
+{
+	if (!dcc_timeline_enabled())
+		return;
+	int fd = dcc_timeline_fd();
+	if (fd == -1)
+		return;
+
+	long long ts = (long long) start.tv_sec * 1000000 + start.tv_usec;
+	long long dur = ((long long) end.tv_sec * 1000000 + end.tv_usec) - ts;
+	if (dur < 0)
+		dur = 0;
+
+	// The merge tool picks fields out of the line by name, so keep to this layout
+	string line = stringf("{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,"
+		"\"pid\":%ld,\"tid\":%ld,\"args\":{\"node\":\"%s\",\"job\":\"%s\",\"file\":\"%s\",\"host\":\"%s\"}}\n",
+		name, rs_program_name, ts, dur, (long) getpid(), (long) getpid(),
+		+dcc_json_string(dcc_gethostname()), +dcc_json_string(+job_id),
+		+dcc_json_string(file), +dcc_json_string(host));
+
+	if (write(fd, line.data(), line.size()) != (ssize_t) line.size())
+		rs_trace("failed to write timeline: %s", strerror(errno));
+}
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_timeline_phase(const char *name, const struct timeval &now, const char *file, const char *host)
+{
+	if (!dcc_timeline_enabled())
+		return;
+
+	if (curr_phase)
+		dcc_timeline_span(curr_phase, curr_phase_start, now, dcc_timeline_job_id(), file, host);
+
+	curr_phase = name;
+	curr_phase_start = now;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
@@ -0,0 +1,43 @@
+
+#ifndef _distcc_common_timeline_h_
+#define _distcc_common_timeline_h_
+
+#include <string>
+
+#ifdef __linux__
+#include <sys/time.h>
+#endif
+
+namespace distcc
+{
+
+using std::string;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+// Timeline of the phases of jobs, in the Chrome trace-event format (chrome://tracing, Perfetto).
+//
+// Enabled by setting $DISTCC_TIMELINE to a directory, for the clients and for distccd.
+// Each process appends complete ("X") events, one per line, to
+// <dir>/<program>-<hostname>.trace, so the directory may be shared over NFS by all machines
+// of a build.  The client makes up an ID for its job and sends it along with the request,
+// so the spans of the server are tagged with the same ID.  distcc-trace-merge puts the files
+// together into a single timeline of the build.
+
+bool dcc_timeline_enabled();
+
+// The ID of the job of this (client) process: hostname-pid-start time
+const string &dcc_timeline_job_id();
+
+// Record a span of a job
+void dcc_timeline_span(const char *name, const struct timeval &start, const struct timeval &end,
+	const string &job_id, const char *file, const char *host);
+
+// The client is now in the named phase (0 for none); the span of the previous one is recorded
+void dcc_timeline_phase(const char *name, const struct timeval &now, const char *file, const char *host);
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
+
+#endif // _distcc_common_timeline_h_
@@ -0,0 +1,242 @@
+/**
+ * @file
+ *
+ * Fingerprints of compiler toolchains, so that jobs go only to hosts that would compile them
+ * with the same compiler as the client.
+ **/
+
+#include "common/config.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <map>
+
+#include "common/distcc.h"
+#include "common/trace.h"
+#include "common/rpc1.h"
+#include "common/state.h"
+#include "common/objcache.h"
+#include "common/hash.h"
+#include "common/toolchain.h"
+
+#include "rvfc/text/defs.h"
+
+namespace distcc
+{
+
+using namespace rvfc::Text;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef __linux__
+
+// The first line of what the compiler prints for @p option, or an empty string
+// if it doesn't understand it
+
+static string dcc_compiler_says(const string &path, const char *option)
+{
+	string quoted = "'";
+	for (const char *p = +path; *p; ++p)
+		quoted += *p == '\'' ? string("'\\''") : string(1, *p);
+	quoted += "'";
+
+	FILE *f = popen(+stringf("%s %s 2>/dev/null </dev/null", +quoted, option), "r");
+	if (!f)
+	{
+		rs_log_warning("failed to run %s: %s", +path, strerror(errno));
+		return "";
+	}
+
+	char buf[256];
+	string line;
+	if (fgets(buf, sizeof(buf), f))
+		line = buf;
+	while (fgets(buf, sizeof(buf), f))
+		; // let it finish writing
+	if (pclose(f) != 0)
+		return "";
+
+	while (!line.empty() && (line[line.size() - 1] == '\n' || line[line.size() - 1] == '\r'))
+		line.erase(line.size() - 1);
+	return line;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static string dcc_toolchain_cache_file()
+{
+	return !dcc_state_dir ? string("") : stringf("%s/toolchains", +dcc_state_dir.path());
+}
+
+//---------------------------------------------------------------------------------------------
+
+// The file has a line "<stamp>\t<fingerprint>" for each compiler seen; it's only appended to,
+// and a stale line is just passed over when the driver changes
+
+static string dcc_lookup_toolchain(const string &stamp)
+{
+	string fname = dcc_toolchain_cache_file();
+	FILE *f = fname.empty() ? 0 : fopen(+fname, "r");
+	if (!f)
+		return "";
+
+	string key = stamp + "\t", fingerprint;
+	char buf[4096];
+	while (fgets(buf, sizeof(buf), f))
+	{
+		size_t len = strlen(buf);
+		if (len == 0 || buf[len - 1] != '\n' || strncmp(buf, +key, key.size()))
+			continue;
+		fingerprint = string(buf + key.size(), len - key.size() - 1);
+	}
+	fclose(f);
+	return fingerprint;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void dcc_remember_toolchain(const string &stamp, const string &fingerprint)
+{
+	string fname = dcc_toolchain_cache_file();
+	if (fname.empty())
+		return;
+
+	// one write to a file opened for appending, so concurrent clients don't mix their lines
+	int fd = open(+fname, O_WRONLY | O_APPEND | O_CREAT, 0666);
+	if (fd == -1)
+	{
+		rs_trace("failed to open %s: %s", +fname, strerror(errno));
+		return;
+	}
+	string line = stamp + "\t" + fingerprint + "\n";
+	if (write(fd, line.data(), line.size()) != (ssize_t) line.size())
+		rs_log_warning("failed to write %s: %s", +fname, strerror(errno));
+	close(fd);
+}
+
+//---------------------------------------------------------------------------------------------
+
+string dcc_toolchain_fingerprint(const string &compiler_name)
+{
+	static std::map<string, std::pair<string, string> > known;
+
+	string path;
+	string stamp = dcc_compiler_stamp(compiler_name, path);
+	if (stamp.empty())
+		return "";
+
+	std::pair<string, string> &tc = known[compiler_name];
+	if (tc.first == stamp)
+		return tc.second;
+
+	string fingerprint = dcc_lookup_toolchain(stamp);
+	if (fingerprint.empty())
+	{
+		// "path:size:mtime:digest"; a prefix of the digest tells builds apart well enough
+		string driver = dcc_compiler_fingerprint(compiler_name);
+		if (driver.empty())
+			return "";
+		string digest = driver.substr(driver.rfind(':') + 1, 16);
+
+		// gcc 7 and later give just the major version to -dumpversion
+		string version = dcc_compiler_says(path, "-dumpfullversion -dumpversion");
+		if (version.empty())
+			version = dcc_compiler_says(path, "-dumpversion");
+		string machine = dcc_compiler_says(path, "-dumpmachine");
+
+		fingerprint = stringf("%s %s %s", version.empty() ? "?" : +version,
+			machine.empty() ? "?" : +machine, +digest);
+		rs_trace("toolchain of %s: %s", +path, +fingerprint);
+		dcc_remember_toolchain(stamp, fingerprint);
+	}
+
+	tc = std::make_pair(stamp, fingerprint);
+	return fingerprint;
+}
+
+//---------------------------------------------------------------------------------------------
+
+#else // ! __linux__
+
+string dcc_toolchain_fingerprint(const string &compiler_name)
+{
+	return "";
+}
+
+#endif // ! __linux__
+
+//---------------------------------------------------------------------------------------------
+
+string dcc_toolchain_key(const string &fingerprint)
+{
+	return Digest().update(fingerprint).hex().substr(0, 32);
+}
+
+//---------------------------------------------------------------------------------------------
+
+dcc_exitcode dcc_x_toolchain(fd_t fd, const string &fingerprint)
+{
+	return dcc_x_token_string(fd, "TOOL", fingerprint);
+}
+
+//---------------------------------------------------------------------------------------------
+
+dcc_exitcode dcc_r_toolchain(fd_t ifd, string &fingerprint)
+{
+	return dcc_r_token_string(ifd, "TOOL", fingerprint);
+}
+
+//---------------------------------------------------------------------------------------------
+
+const char *ToolchainEnv::manifest_name = "toolchain-env";
+
+string ToolchainEnv::to_string() const
+{
+	string s = "fingerprint " + fingerprint + "\n" + "driver " + driver + "\n";
+	for (size_t i = 0; i < path.size(); ++i)
+		s += "path " + path[i] + "\n";
+	for (size_t i = 0; i < lib.size(); ++i)
+		s += "lib " + lib[i] + "\n";
+	return s;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Lines with unknown keys are passed over, so that more can be added
+
+bool ToolchainEnv::parse(const string &s)
+{
+	*this = ToolchainEnv();
+	for (size_t p = 0; p < s.size(); )
+	{
+		size_t n = s.find('\n', p);
+		string line = s.substr(p, n == string::npos ? string::npos : n - p);
+		p = n == string::npos ? s.size() : n + 1;
+
+		size_t sp = line.find(' ');
+		if (sp == string::npos)
+			continue;
+		string key = line.substr(0, sp), value = line.substr(sp + 1);
+		if (key == "fingerprint")
+			fingerprint = value;
+		else if (key == "driver")
+			driver = value;
+		else if (key == "path")
+			path.push_back(value);
+		else if (key == "lib")
+			lib.push_back(value);
+	}
+	return !fingerprint.empty() && !driver.empty() && driver[0] == '/';
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
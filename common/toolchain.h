@@ -0,0 +1,69 @@
+
+#ifndef _distcc_common_toolchain_h_
+#define _distcc_common_toolchain_h_
+
+#include <string>
+#include <vector>
+
+#include "common/distcc.h"
+
+namespace distcc
+{
+
+using std::string;
+using std::vector;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+// Fingerprint of the toolchain behind a compiler driver: what it says to -dumpversion and
+// -dumpmachine, and a digest of the driver binary, e.g. "12.2.0 x86_64-linux-gnu 3fa4c1d09b2e7a55".
+// Two hosts with the same fingerprint produce the same objects from the same input.
+//
+// Running the compiler costs some tens of milliseconds, so the fingerprints are kept in the
+// file "toolchains" in the state directory (if there is one) by the path, size and mtime of
+// the driver, as well as for the life of the process.
+// Returns an empty string if the compiler can't be found.
+
+string dcc_toolchain_fingerprint(const string &compiler_name);
+
+// A short name for a fingerprint, fit for a file name
+string dcc_toolchain_key(const string &fingerprint);
+
+// The client sends its fingerprint as TOOL right after FLGS (CMD_FLAGS_TOOLCHAIN), and the
+// server answers with its own for the compiler it would run, once it has read the arguments.
+// The server only compiles if they are the same.
+
+dcc_exitcode dcc_x_toolchain(fd_t fd, const string &fingerprint);
+dcc_exitcode dcc_r_toolchain(fd_t ifd, string &fingerprint);
+
+//---------------------------------------------------------------------------------------------
+
+// A compiler packed up to run on another host (CMD_FLAGS_SHIP_TOOLCHAIN): a .tar.gz of the
+// driver, the programs it runs (cc1, cc1plus, as) and the shared libraries they need other
+// than those of the C library, all at their own absolute paths, along with a manifest.
+// The host unpacks it under a directory of its own and runs the driver from there, with
+// the directories of the programs first on the PATH and those of the libraries on
+// LD_LIBRARY_PATH: gcc finds its own parts relative to where the driver is.
+//
+// The protocol, when the server's TOOL isn't the client's fingerprint:
+//   server: SHIP 1 if it takes compilers (distccd --toolchain-dir), SHIP 0 if not
+//   client: ENVD, the digest of the archive (empty if it couldn't make one), then ENVA
+//   server: TOOL again, the client's fingerprint if the compiler it got has it
+
+struct ToolchainEnv
+{
+	string fingerprint;
+	string driver;              // absolute path, inside the archive
+	vector<string> path, lib;   // directories, likewise
+
+	// The manifest, "toolchain-env" in the archive: a line "<key> <value>" for each entry
+	static const char *manifest_name;
+	string to_string() const;
+	bool parse(const string &s);
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
+
+#endif // _distcc_common_toolchain_h_
@@ -64,8 +64,18 @@
 #endif
 
 
-/* unconditionally on */
+/**
+ * Messages less important than this level are compiled out, whatever the level set at 
+ * runtime.  Everything is compiled in by default; build with e.g. -DRS_LOG_COMPILE_LEVEL=6 
+ * (RS_LOG_INFO) to drop all trace.
+ */
+#ifndef RS_LOG_COMPILE_LEVEL
+#define RS_LOG_COMPILE_LEVEL 7 // RS_LOG_DEBUG
+#endif
+
+#if RS_LOG_COMPILE_LEVEL >= 7
 #define DO_RS_TRACE
+#endif
 
 /**
  * Log severity levels.
@@ -127,6 +137,15 @@ void rs_remove_all_loggers(void);
 void rs_logger_file(int level, const char *file, int line, char const *fmt, va_list va, void *, int);
 void rs_logger_syslog(int level, const char *file, int line, char const *fmt, va_list va, void *, int);
 
+// Like rs_logger_file(), but the messages are written by a background thread from a buffer of
+// bounded size (see asynclog.cpp).  Writes synchronously until rs_async_log_start() has been
+// called in the process, which returns false if it's not available.
+// rs_async_log_flush() waits until everything logged so far is written (and synced to disk).
+void rs_logger_async(int level, const char *file, int line, char const *fmt, va_list va, void *, int);
+int rs_async_log_start(size_t buffer_size);
+void rs_async_log_flush(int do_fsync);
+unsigned long rs_async_log_dropped(void);
+
 // Check whether the library was compiled with debugging trace suport
 int rs_supports_trace(void);
 
@@ -137,48 +156,34 @@ void rs_log0(int level, char const *file, int line, char const *fmt, ...)
   ;
 
 
+// The least important severity that is logged; see rs_trace_set_level()
+extern int rs_trace_level;
+
+// Whether a message with these flags would be logged.  The macros below check this before 
+// evaluating any of their arguments, so a message that isn't logged costs a comparison, and 
+// one below RS_LOG_COMPILE_LEVEL costs nothing at all.
+#define rs_log_enabled(flags) \
+	(((flags) & RS_LOG_PRIMASK) <= RS_LOG_COMPILE_LEVEL && ((flags) & RS_LOG_PRIMASK) <= rs_trace_level)
+
 // TODO: Check for the __FUNCTION__ thing, rather than gnuc
 //#if defined(HAVE_VARARG_MACROS)  && defined(__GNUC__) 
 #if 1
 
-#if 1 || defined(DO_RS_TRACE)
-#define rs_trace(fmt, ...) \
-    do \
-		rs_log0(RS_LOG_DEBUG, __FILE__, __LINE__, fmt ,##__VA_ARGS__);  \
-	while (0)
-#else
-#define rs_trace(s, ...)
-#endif	// !DO_RS_TRACE
-
-#define rs_log(l, s, ...) \
-	do \
-		rs_log0((l), __FILE__, __LINE__, (s) ,##__VA_ARGS__);  \
-	while (0)
-
-#define rs_log_crit(s, ...) \
+#define rs_log_if_enabled(l, s, ...) \
 	do \
-		rs_log0(RS_LOG_CRIT, __FILE__, __LINE__, (s) ,##__VA_ARGS__); \
+	{ \
+		if (rs_log_enabled(l)) \
+			rs_log0((l), __FILE__, __LINE__, (s) ,##__VA_ARGS__); \
+	} \
 	while (0)
 
-#define rs_log_error(s, ...) \
-	do \
-		rs_log0(RS_LOG_ERR, __FILE__, __LINE__, (s) ,##__VA_ARGS__); \
-	while (0)
-
-#define rs_log_notice(s, ...) \
-	do \
-		rs_log0(RS_LOG_NOTICE, __FILE__, __LINE__, (s) ,##__VA_ARGS__); \
-	while (0)
-
-#define rs_log_warning(s, ...) \
-	do \
-		rs_log0(RS_LOG_WARNING, __FILE__, __LINE__, (s) ,##__VA_ARGS__); \
-	while (0)
-
-#define rs_log_info(s, ...) \
-	do \
-		rs_log0(RS_LOG_INFO, __FILE__, __LINE__, (s) ,##__VA_ARGS__); \
-	while (0)
+#define rs_trace(s, ...)        rs_log_if_enabled(RS_LOG_DEBUG, s ,##__VA_ARGS__)
+#define rs_log(l, s, ...)       rs_log_if_enabled(l, s ,##__VA_ARGS__)
+#define rs_log_crit(s, ...)     rs_log_if_enabled(RS_LOG_CRIT, s ,##__VA_ARGS__)
+#define rs_log_error(s, ...)    rs_log_if_enabled(RS_LOG_ERR, s ,##__VA_ARGS__)
+#define rs_log_notice(s, ...)   rs_log_if_enabled(RS_LOG_NOTICE, s ,##__VA_ARGS__)
+#define rs_log_warning(s, ...)  rs_log_if_enabled(RS_LOG_WARNING, s ,##__VA_ARGS__)
+#define rs_log_info(s, ...)     rs_log_if_enabled(RS_LOG_INFO, s ,##__VA_ARGS__)
 
 #else // not defined HAVE_VARARG_MACROS
 
@@ -207,15 +212,10 @@ void rs_log_critical_nofn(char const *, ...);
 void rs_log0_nofn(int level, char const *fmt, ...);
 
 // \macro rs_trace_enabled()
-// Call this before putting too much effort into generating trace messages.
+// Call this before putting too much effort into generating trace messages
+// other than as arguments of rs_trace(), which are only evaluated if it's true.
 
-extern int rs_trace_level;
-
-#ifdef DO_RS_TRACE
-#define rs_trace_enabled() ((rs_trace_level & RS_LOG_PRIMASK) >= RS_LOG_DEBUG)
-#else
-#define rs_trace_enabled() 0
-#endif
+#define rs_trace_enabled() rs_log_enabled(RS_LOG_DEBUG)
 
 /**
  * Name of the program, to be included in log messages.
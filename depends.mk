@@ -2,4 +2,6 @@
 define MODULE_DEPENDS.common
 	(distcc-client,$(VROOT)/distcc/client)
 	(distcc-server,$(VROOT)/distcc/server)
+	(distcc-top,$(VROOT)/distcc/tools/top)
+	(distcc-trace-merge,$(VROOT)/distcc/tools/trace-merge)
 endef
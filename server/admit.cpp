@@ -0,0 +1,463 @@
+
+/**
+ * @file
+ *
+ * Server-side admission control: bound the number of queued jobs and tell
+ * clients early when we're too busy to take another one.  Keep compilers from 
+ * starting while memory is short.
+ **/
+
+#include "common/config.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include <stdexcept>
+
+#include "common/distcc.h"
+#include "common/trace.h"
+#include "common/exec.h"
+
+#include "server/admit.h"
+
+#include "rvfc/text/defs.h"
+
+namespace distcc
+{
+
+using namespace rvfc::Text;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef __linux__
+
+enum
+{
+	max_slots = 256, // --jobs is at most 200
+	max_holders = 2 * max_slots, // workers, and the retiring ones finishing their last job
+	rss_table_size = 1024,
+
+	// A compiler takes a while to reach its peak memory use; the expected use of jobs started 
+	// this recently is counted as if already taken
+	ramp_secs = 5,
+
+	// While waiting for memory, check this often (ms), and log every so many checks
+	memory_poll_msecs = 100,
+	memory_log_polls = 50
+};
+
+struct dcc_admission_state
+{
+	int max_jobs, max_queue;
+
+	// Jobs past the request header: compiling, or queued for a compile slot
+	volatile int admitted;
+
+	// Moving average of compiler run time, used to estimate the wait of a refused client
+	volatile unsigned avg_msecs;
+
+	sem_t compile_slots;
+
+	// The worker holding each compile slot, or 0; the semaphore guarantees there's a free one 
+	// for each holder
+	volatile pid_t slot_taken[max_slots];
+
+	// The workers holding an admission, so that the parent can give back what a worker that
+	// died still held (dcc_admission_release)
+	volatile pid_t admitted_by[max_holders];
+
+	// Memory to keep available, and the highest acceptable memory pressure; zero if not limited
+	unsigned long reserve_kb;
+	unsigned pressure;
+
+	// Compilers that are running
+	volatile int compiling;
+
+	// Expected memory of the compilers started within ramp_secs of ramp_start
+	volatile unsigned long ramp_kb;
+	volatile time_t ramp_start;
+
+	// Moving average of compiler peak memory, and the last peak for each job name (by hash)
+	volatile unsigned long avg_rss_kb;
+	struct
+	{
+		volatile unsigned key;
+		volatile unsigned long rss_kb;
+	} rss_table[rss_table_size];
+};
+
+static dcc_admission_state *admission = 0;
+
+// of the job in this worker
+static unsigned job_key = 0;
+static unsigned long job_est_kb = 0;
+static int job_slot = -1;
+static int job_holder = -1;
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_admission_init(int max_jobs, int max_queue)
+{
+	void *p = mmap(0, sizeof(dcc_admission_state), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+	{
+		rs_log_error("failed to map admission state: %s", strerror(errno));
+		throw std::runtime_error("cannot set up admission control");
+	}
+
+	admission = (dcc_admission_state *) p;
+	admission->max_jobs = max_jobs;
+	admission->max_queue = max_queue;
+	admission->admitted = 0;
+	admission->avg_msecs = 0;
+	admission->reserve_kb = 0;
+	admission->pressure = 0;
+	admission->compiling = 0;
+	admission->ramp_kb = 0;
+	admission->ramp_start = 0;
+	admission->avg_rss_kb = 0;
+	memset((void *) admission->rss_table, 0, sizeof(admission->rss_table));
+	memset((void *) admission->slot_taken, 0, sizeof(admission->slot_taken));
+	memset((void *) admission->admitted_by, 0, sizeof(admission->admitted_by));
+
+	if (sem_init(&admission->compile_slots, 1, max_jobs) == -1)
+	{
+		rs_log_error("sem_init failed: %s", strerror(errno));
+		munmap(p, sizeof(dcc_admission_state));
+		admission = 0;
+		throw std::runtime_error("cannot set up admission control");
+	}
+
+	rs_log_info("admission control: %d compile slots, queue depth %d", max_jobs, max_queue);
+}
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_admission_limit_memory(unsigned reserve_mb, unsigned pressure)
+{
+	if (!admission)
+		return;
+
+	admission->reserve_kb = (unsigned long) reserve_mb * 1024;
+	admission->pressure = pressure;
+
+	rs_log_info("memory admission: keeping %uMB available, memory pressure below %u%%", reserve_mb, pressure);
+}
+
+//---------------------------------------------------------------------------------------------
+
+// MemAvailable from /proc/meminfo, or -1 if unknown
+
+static long dcc_mem_available_kb()
+{
+	FILE *f = fopen("/proc/meminfo", "r");
+	if (!f)
+		return -1;
+
+	char line[128];
+	long kb = -1;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "MemAvailable: %ld kB", &kb) == 1)
+			break;
+	fclose(f);
+	return kb;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// The share of time (percent) in which some tasks stalled on memory over the last 10 seconds, 
+// from /proc/pressure/memory, or -1 if the kernel doesn't tell
+
+static double dcc_mem_pressure()
+{
+	FILE *f = fopen("/proc/pressure/memory", "r");
+	if (!f)
+		return -1;
+
+	double avg10 = -1;
+	if (fscanf(f, "some avg10=%lf", &avg10) != 1)
+		avg10 = -1;
+	fclose(f);
+	return avg10;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static unsigned long dcc_ramp_kb()
+{
+	return time(0) - admission->ramp_start < ramp_secs ? admission->ramp_kb : 0;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Is there room for a compiler expected to take @p est_kb?  Fills in @p why if not.
+
+static bool dcc_memory_allows(unsigned long est_kb, string &why)
+{
+	if (admission->pressure)
+	{
+		double pressure = dcc_mem_pressure();
+		if (pressure >= admission->pressure)
+		{
+			why = stringf("memory pressure %.1f%%", pressure);
+			return false;
+		}
+	}
+
+	if (admission->reserve_kb)
+	{
+		long avail = dcc_mem_available_kb();
+		unsigned long ramp = dcc_ramp_kb();
+		if (avail != -1 && (unsigned long) avail < admission->reserve_kb + est_kb + ramp)
+		{
+			why = stringf("%ldMB available, %luMB expected for this job and %luMB for others starting", 
+				avail / 1024, est_kb / 1024, ramp / 1024);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static bool dcc_memory_limited()
+{
+	return admission && (admission->reserve_kb || admission->pressure);
+}
+
+//---------------------------------------------------------------------------------------------
+
+bool dcc_admission_enter(bool can_refuse, unsigned &wait_secs)
+{
+	wait_secs = 0;
+	if (!admission)
+		return true;
+
+	int n = __sync_add_and_fetch(&admission->admitted, 1);
+	string why;
+	if (can_refuse && n > 1 && dcc_memory_limited() && !dcc_memory_allows(admission->avg_rss_kb, why))
+	{
+		__sync_sub_and_fetch(&admission->admitted, 1);
+
+		// The compilers that are running have to finish first
+		wait_secs = admission->avg_msecs / 1000 + 1;
+		rs_log_info("too busy: memory is short (%s), estimated wait %us", +why, wait_secs);
+		return false;
+	}
+
+	if (!can_refuse || n <= admission->max_jobs + admission->max_queue)
+	{
+		for (int i = 0; i < max_holders; ++i)
+			if (__sync_bool_compare_and_swap(&admission->admitted_by[i], 0, getpid()))
+			{
+				job_holder = i;
+				break;
+			}
+
+		rs_trace("admitted job %d of %d", n, admission->max_jobs + admission->max_queue);
+		return true;
+	}
+
+	__sync_sub_and_fetch(&admission->admitted, 1);
+
+	// Everybody ahead of us must pass through one of max_jobs slots
+	unsigned queued = n - admission->max_jobs;
+	unsigned msecs = admission->avg_msecs * queued / admission->max_jobs;
+	wait_secs = msecs / 1000 + 1;
+
+	rs_log_info("too busy: %d jobs admitted, estimated wait %us", n - 1, wait_secs);
+	return false;
+}
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_admission_leave()
+{
+	if (!admission)
+		return;
+
+	// Whoever clears the record gives the admission back: us, or the parent if we died
+	bool ours = job_holder == -1
+		|| __sync_bool_compare_and_swap(&admission->admitted_by[job_holder], getpid(), 0);
+	job_holder = -1;
+	if (ours)
+		__sync_sub_and_fetch(&admission->admitted, 1);
+}
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_admission_begin_compile(const string &job_name)
+{
+	if (!admission)
+		return;
+
+	while (sem_wait(&admission->compile_slots) == -1)
+	{
+		if (errno != EINTR)
+		{
+			rs_log_error("sem_wait failed: %s", strerror(errno));
+			break;
+		}
+	}
+
+	job_key = 2166136261u;
+	for (string::const_iterator i = job_name.begin(); i != job_name.end(); ++i)
+		job_key = (job_key ^ (unsigned char) *i) * 16777619u;
+	job_key |= 1; // zero marks a free entry
+
+	if (dcc_memory_limited())
+	{
+		unsigned i = job_key % rss_table_size;
+		job_est_kb = admission->rss_table[i].key == job_key ? admission->rss_table[i].rss_kb : admission->avg_rss_kb;
+
+		// Nothing would free memory for us if no compiler is running, so one always may
+		string why;
+		for (int polls = 0; admission->compiling > 0 && !dcc_memory_allows(job_est_kb, why); ++polls)
+		{
+			if (polls % memory_log_polls == 0)
+				rs_log_info("waiting for memory to compile %s: %s", +job_name, +why);
+			usleep(memory_poll_msecs * 1000);
+		}
+
+		if (time(0) - admission->ramp_start >= ramp_secs)
+		{
+			admission->ramp_start = time(0);
+			admission->ramp_kb = 0;
+		}
+		__sync_add_and_fetch(&admission->ramp_kb, job_est_kb);
+	}
+
+	__sync_add_and_fetch(&admission->compiling, 1);
+
+	for (int i = 0; i < admission->max_jobs && i < max_slots; ++i)
+		if (__sync_bool_compare_and_swap(&admission->slot_taken[i], 0, getpid()))
+		{
+			job_slot = i;
+			break;
+		}
+}
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_admission_end_compile(unsigned msecs, unsigned long max_rss_kb)
+{
+	if (!admission)
+		return;
+
+	// Races between workers only perturb the estimates, so no lock is taken here
+	unsigned avg = admission->avg_msecs;
+	admission->avg_msecs = avg ? (7 * avg + msecs) / 8 : msecs;
+
+	if (max_rss_kb)
+	{
+		unsigned long avg_rss = admission->avg_rss_kb;
+		admission->avg_rss_kb = avg_rss ? (7 * avg_rss + max_rss_kb) / 8 : max_rss_kb;
+
+		unsigned i = job_key % rss_table_size;
+		admission->rss_table[i].key = job_key;
+		admission->rss_table[i].rss_kb = max_rss_kb;
+	}
+
+	bool ours = job_slot == -1
+		|| __sync_bool_compare_and_swap(&admission->slot_taken[job_slot], getpid(), 0);
+	job_slot = -1;
+	if (ours)
+	{
+		__sync_sub_and_fetch(&admission->compiling, 1);
+		sem_post(&admission->compile_slots);
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_admission_release(pid_t kid)
+{
+	if (!admission || kid <= 0)
+		return;
+
+	for (int i = 0; i < max_slots; ++i)
+		if (__sync_bool_compare_and_swap(&admission->slot_taken[i], kid, 0))
+		{
+			rs_log_warning("child %d died holding compile slot %d", (int) kid, i);
+			__sync_sub_and_fetch(&admission->compiling, 1);
+			sem_post(&admission->compile_slots);
+		}
+
+	for (int i = 0; i < max_holders; ++i)
+		if (__sync_bool_compare_and_swap(&admission->admitted_by[i], kid, 0))
+		{
+			rs_trace("child %d died holding an admission", (int) kid);
+			__sync_sub_and_fetch(&admission->admitted, 1);
+		}
+}
+
+//---------------------------------------------------------------------------------------------
+
+int dcc_admission_slot()
+{
+	return job_slot;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static bool dcc_write_cgroup_file(const string &path, const string &value)
+{
+	FILE *f = fopen(path.c_str(), "w");
+	bool ok = f && fputs(value.c_str(), f) != EOF;
+	if (f && fclose(f) == EOF)
+		ok = false;
+
+	if (!ok)
+		rs_log_error("failed to write %s to %s: %s", value.c_str(), path.c_str(), strerror(errno));
+	return ok;
+}
+
+//---------------------------------------------------------------------------------------------
+
+bool dcc_admission_cgroup(const char *dir, unsigned limit_mb)
+{
+	if (access(+stringf("%s/cgroup.procs", dir), W_OK) == -1)
+	{
+		rs_log_error("cannot use cgroup %s: %s", dir, strerror(errno));
+		return false;
+	}
+
+	if (limit_mb && !dcc_write_cgroup_file(stringf("%s/memory.max", dir), stringf("%lu", (unsigned long) limit_mb << 20)))
+		return false;
+
+	dcc_set_child_cgroup(dir);
+	rs_log_info("compilers run in cgroup %s, memory limit %uMB", dir, limit_mb);
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+
+#else // ! __linux__
+
+// Workers are not forked on Windows, so there is no shared state to keep; admit everything.
+
+void dcc_admission_init(int max_jobs, int max_queue) {}
+void dcc_admission_limit_memory(unsigned reserve_mb, unsigned pressure) {}
+bool dcc_admission_enter(bool can_refuse, unsigned &wait_secs) { wait_secs = 0; return true; }
+void dcc_admission_leave() {}
+void dcc_admission_begin_compile(const string &job_name) {}
+void dcc_admission_end_compile(unsigned msecs, unsigned long max_rss_kb) {}
+void dcc_admission_release(pid_t kid) {}
+bool dcc_admission_cgroup(const char *dir, unsigned limit_mb) { return false; }
+int dcc_admission_slot() { return -1; }
+
+#endif // ! __linux__
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
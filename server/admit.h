@@ -0,0 +1,62 @@
+
+#ifndef _distcc_server_admit_h_
+#define _distcc_server_admit_h_
+
+#include <string>
+
+#include "common/distcc.h"
+
+namespace distcc
+{
+
+using std::string;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+// Admission control for the standalone server.
+//
+// Jobs are admitted right after the request header has been read.
+// At most max_jobs compilers run at any time; up to max_queue further admitted jobs wait
+// for a compile slot (meanwhile receiving their input).
+// Anything beyond that is refused with a BUSY reply so that the client may try another host.
+//
+// The state lives in memory shared by all preforked workers, so dcc_admission_init() must be
+// called by the parent before forking.  If it was never called, everything is admitted.
+//
+// Memory is taken into account too, if dcc_admission_limit_memory() was called after 
+// dcc_admission_init().  A compiler is then started only while the system keeps @p reserve_mb 
+// of memory available on top of what the job is expected to need (learnt from the peak memory 
+// of earlier compilations of the same output, or of all jobs), and while memory pressure 
+// (Linux PSI "some avg10") stays below @p pressure percent.  Either limit may be zero.  
+// One compiler is always allowed to run.  While memory is tight, new clients that can 
+// handle a refusal are told we're busy.
+
+void dcc_admission_init(int max_jobs, int max_queue);
+void dcc_admission_limit_memory(unsigned reserve_mb, unsigned pressure);
+
+// Returns false if the job should be refused; @p wait_secs then holds the estimated wait.
+// Clients that cannot handle a refusal are always admitted (and may queue beyond the limit).
+bool dcc_admission_enter(bool can_refuse, unsigned &wait_secs);
+void dcc_admission_leave();
+
+// Bracket the run of the compiler.  Blocks until a compile slot (and the memory) is free.
+// @p job_name identifies the job for the estimate of its memory use.
+void dcc_admission_begin_compile(const string &job_name);
+void dcc_admission_end_compile(unsigned msecs, unsigned long max_rss_kb);
+
+// Called by the parent when child @p kid has exited: give back the admission and the compile
+// slot it still held, if it died without leaving
+void dcc_admission_release(pid_t kid);
+
+// The compile slot (0 to max_jobs-1) held between those calls, or -1 if not known
+int dcc_admission_slot();
+
+// Put the compilers into the cgroup (v2) @p dir, limiting them to @p limit_mb together (if 
+// nonzero).  The cgroup must exist and be writable by distccd.
+bool dcc_admission_cgroup(const char *dir, unsigned limit_mb);
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
+
+#endif // _distcc_server_admit_h_
@@ -0,0 +1,218 @@
+/**
+ * @file
+ *
+ * Mapping of compile slots to CPUs and NUMA nodes.
+ **/
+
+#include "common/config.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <dirent.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <vector>
+#include <string>
+
+#include "common/distcc.h"
+#include "common/trace.h"
+#include "common/exec.h"
+
+#include "server/affinity.h"
+
+#include "rvfc/text/defs.h"
+
+namespace distcc
+{
+
+using namespace rvfc::Text;
+using std::vector;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+bool dcc_parse_affinity_mode(const char *mode, enum dcc_affinity_mode &result)
+{
+	if (!strcmp(mode, "none"))
+		result = DCC_AFFINITY_NONE;
+	else if (!strcmp(mode, "numa"))
+		result = DCC_AFFINITY_NUMA;
+	else if (!strcmp(mode, "cores"))
+		result = DCC_AFFINITY_CORES;
+	else
+		return false;
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+
+#ifdef __linux__
+
+// for each slot; empty if there is no placement
+static vector<vector<int> > slot_cpus;
+static vector<int> slot_node;
+
+//---------------------------------------------------------------------------------------------
+
+// Read a kernel CPU list like "0-15,32-47"
+
+static vector<int> dcc_read_cpu_list(const string &path)
+{
+	vector<int> cpus;
+	FILE *f = fopen(path.c_str(), "r");
+	if (!f)
+		return cpus;
+
+	int first, last;
+	char sep;
+	for (;;)
+	{
+		if (fscanf(f, "%d", &first) != 1)
+			break;
+		last = first;
+		if (fscanf(f, "%c", &sep) == 1 && sep == '-')
+		{
+			if (fscanf(f, "%d", &last) != 1)
+				break;
+			if (fscanf(f, "%c", &sep) != 1)
+				sep = '\n';
+		}
+		for (int cpu = first; cpu <= last; ++cpu)
+			cpus.push_back(cpu);
+		if (sep != ',')
+			break;
+	}
+
+	fclose(f);
+	return cpus;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// The CPUs of each NUMA node that has any, by node number
+
+static void dcc_read_numa_nodes(vector<int> &nodes, vector<vector<int> > &node_cpus)
+{
+	DIR *dir = opendir("/sys/devices/system/node");
+	if (!dir)
+		return;
+
+	struct dirent *de;
+	while ((de = readdir(dir)) != NULL)
+	{
+		int node;
+		char rest;
+		if (sscanf(de->d_name, "node%d%c", &node, &rest) != 1)
+			continue;
+
+		vector<int> cpus = dcc_read_cpu_list(stringf("/sys/devices/system/node/%s/cpulist", de->d_name));
+		if (cpus.empty())
+			continue; // memory-only node
+
+		// keep them ordered by node number
+		vector<int>::iterator i = nodes.begin();
+		while (i != nodes.end() && *i < node)
+			++i;
+		node_cpus.insert(node_cpus.begin() + (i - nodes.begin()), cpus);
+		nodes.insert(i, node);
+	}
+
+	closedir(dir);
+}
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_affinity_init(enum dcc_affinity_mode mode, int n_slots, bool bind_memory)
+{
+	if (mode == DCC_AFFINITY_NONE || n_slots < 1)
+		return;
+
+	vector<int> nodes;
+	vector<vector<int> > node_cpus;
+	dcc_read_numa_nodes(nodes, node_cpus);
+
+	vector<int> online = dcc_read_cpu_list("/sys/devices/system/cpu/online");
+	if (nodes.empty())
+	{
+		if (online.empty())
+		{
+			rs_log_warning("can't tell which CPUs are online; compile slots are not pinned");
+			return;
+		}
+
+		// No NUMA: a single node with all the CPUs
+		nodes.push_back(-1);
+		node_cpus.push_back(online);
+	}
+
+	slot_cpus.assign(n_slots, vector<int>());
+	slot_node.assign(n_slots, -1);
+
+	if (mode == DCC_AFFINITY_NUMA)
+	{
+		for (int slot = 0; slot < n_slots; ++slot)
+		{
+			int i = slot % nodes.size();
+			slot_cpus[slot] = node_cpus[i];
+			slot_node[slot] = bind_memory ? nodes[i] : -1;
+		}
+		rs_log_info("%d compile slots spread over %d NUMA nodes%s", n_slots, (int) nodes.size(),
+			bind_memory ? ", memory bound to the node" : "");
+	}
+	else
+	{
+		// Going node by node keeps each group within a node where possible
+		vector<int> cpus;
+		for (size_t i = 0; i < node_cpus.size(); ++i)
+			cpus.insert(cpus.end(), node_cpus[i].begin(), node_cpus[i].end());
+
+		int n_cpus = cpus.size();
+		for (int slot = 0; slot < n_slots; ++slot)
+		{
+			if (n_slots >= n_cpus)
+			{
+				slot_cpus[slot].push_back(cpus[slot % n_cpus]);
+			}
+			else
+			{
+				int first = slot * n_cpus / n_slots, last = (slot + 1) * n_cpus / n_slots;
+				slot_cpus[slot].assign(cpus.begin() + first, cpus.begin() + last);
+			}
+		}
+		if (bind_memory)
+			rs_log_warning("memory binding only applies to numa slot affinity");
+		rs_log_info("%d compile slots spread over %d CPUs", n_slots, n_cpus);
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_affinity_for_slot(int slot)
+{
+	if (slot < 0 || slot >= (int) slot_cpus.size())
+	{
+		// not bound, rather than bound where the previous job was
+		dcc_set_child_cpus(std::vector<int>(), -1);
+		return;
+	}
+
+	rs_trace("compile slot %d: %d CPUs, memory node %d", slot, (int) slot_cpus[slot].size(), slot_node[slot]);
+	dcc_set_child_cpus(slot_cpus[slot], slot_node[slot]);
+}
+
+//---------------------------------------------------------------------------------------------
+
+#else // ! __linux__
+
+void dcc_affinity_init(enum dcc_affinity_mode mode, int n_slots, bool bind_memory) {}
+void dcc_affinity_for_slot(int slot) {}
+
+#endif // ! __linux__
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
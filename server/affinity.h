@@ -0,0 +1,37 @@
+
+#ifndef _distcc_server_affinity_h_
+#define _distcc_server_affinity_h_
+
+namespace distcc
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+// CPU (and memory) placement of compile slots (--slot-affinity).
+//
+// Each compile slot is mapped to a set of CPUs: either a NUMA node (slots are dealt out to
+// the nodes in turn), or a group of cores (the CPUs are split evenly among the slots).
+// The compiler of a job running in a slot is bound to the slot's CPUs before it execs, and
+// with numa placement optionally also to the node's memory.
+//
+// dcc_affinity_init() is called by the parent before forking; dcc_affinity_for_slot() by the
+// worker once it has a slot (see dcc_admission_slot()), before it starts the compiler.
+
+enum dcc_affinity_mode
+{
+	DCC_AFFINITY_NONE,
+	DCC_AFFINITY_NUMA,
+	DCC_AFFINITY_CORES
+};
+
+// Returns false if @p mode isn't "numa", "cores" or "none"
+bool dcc_parse_affinity_mode(const char *mode, enum dcc_affinity_mode &result);
+
+void dcc_affinity_init(enum dcc_affinity_mode mode, int n_slots, bool bind_memory);
+void dcc_affinity_for_slot(int slot);
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
+
+#endif // _distcc_server_affinity_h_
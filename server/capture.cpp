@@ -0,0 +1,306 @@
+
+/**
+ * @file
+ *
+ * Capture of compiler output through pipes into memory, rather than through
+ * temporary files that are written and then read back.
+ **/
+
+#include "common/config.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#endif
+#ifdef _WIN32
+#include <io.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+
+#include "common/distcc.h"
+#include "common/trace.h"
+#include "common/exitcode.h"
+#include "common/bulk.h"
+#include "common/exec.h"
+
+#include "server/capture.h"
+
+#include "rvfc/text/defs.h"
+
+namespace distcc
+{
+
+using namespace rvfc::Text;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+OutputCapture::OutputCapture(const char *suffix) : _suffix(suffix), _spill_fd(-1), _complaining(false)
+{
+	_pipe[0] = _pipe[1] = -1;
+}
+
+//---------------------------------------------------------------------------------------------
+
+OutputCapture::~OutputCapture()
+{
+	for (int i = 0; i < 2; ++i)
+		if (_pipe[i] != -1)
+			close(_pipe[i]);
+	if (_spill_fd != -1)
+		close(_spill_fd);
+}
+
+//---------------------------------------------------------------------------------------------
+
+bool OutputCapture::open_pipe()
+{
+#ifdef __linux__
+	if (pipe(_pipe) == -1)
+	{
+		rs_log_warning("failed to create pipe: %s", strerror(errno));
+		_pipe[0] = _pipe[1] = -1;
+		return false;
+	}
+
+	// The child reopens the writing end as stdout or stderr before it execs
+	fcntl(_pipe[0], F_SETFD, FD_CLOEXEC);
+	fcntl(_pipe[1], F_SETFD, FD_CLOEXEC);
+	return true;
+#else
+	return false;
+#endif
+}
+
+//---------------------------------------------------------------------------------------------
+
+File OutputCapture::child_end()
+{
+	if (_pipe[1] != -1)
+		return File(stringf("/proc/self/fd/%d", _pipe[1]));
+	return file();
+}
+
+//---------------------------------------------------------------------------------------------
+
+void OutputCapture::close_child_end()
+{
+	if (_pipe[1] != -1)
+	{
+		close(_pipe[1]);
+		_pipe[1] = -1;
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
+void OutputCapture::write_spill(const char *data, size_t len)
+{
+	while (len > 0)
+	{
+		int n = write(_spill_fd, data, len);
+		if (n == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			_complaining = true;
+			rs_log_error("failed to write %s: %s", +_spill.path(), strerror(errno));
+			_complaining = false;
+			return;
+		}
+		data += n;
+		len -= n;
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
+void OutputCapture::append(const char *data, size_t len)
+{
+	if (_complaining)
+		return;
+
+	if (_spill_fd == -1 && _buf.size() + len > limit)
+		file();
+
+	if (_spill_fd != -1)
+		write_spill(data, len);
+	else
+		_buf.append(data, len);
+}
+
+//---------------------------------------------------------------------------------------------
+
+void OutputCapture::reset()
+{
+	_buf.clear();
+	if (_spill_fd == -1)
+		return;
+
+	close(_spill_fd);
+	_spill_fd = open(+_spill.path(), O_WRONLY|O_TRUNC|O_APPEND|O_BINARY);
+	if (_spill_fd == -1)
+		rs_trace("failed to reopen %s: %s", +_spill.path(), strerror(errno));
+}
+
+//---------------------------------------------------------------------------------------------
+
+void OutputCapture::erase(const string &s)
+{
+	if (s.empty())
+		return;
+	for (size_t at = _buf.find(s); at != string::npos; at = _buf.find(s, at))
+		_buf.erase(at, s.length());
+}
+
+//---------------------------------------------------------------------------------------------
+
+const File &OutputCapture::file()
+{
+	if (_spill_fd != -1 || !!_spill)
+		return _spill;
+
+	_spill = dcc_make_tmpnam("distccd", _suffix);
+	_spill_fd = open(+_spill.path(), O_WRONLY|O_APPEND|O_BINARY);
+	if (_spill_fd == -1)
+	{
+		// keep going in memory
+		rs_log_error("failed to open %s: %s", +_spill.path(), strerror(errno));
+		return _spill;
+	}
+
+	write_spill(_buf.data(), _buf.size());
+	string().swap(_buf);
+	return _spill;
+}
+
+//---------------------------------------------------------------------------------------------
+
+int OutputCapture::send(fd_t ofd, const char *token, enum dcc_compress compr)
+{
+	if (_spill_fd != -1)
+		return dcc_x_file(ofd, _spill, token, compr, NULL);
+	return dcc_x_buf(ofd, _buf.data(), _buf.size(), token, compr);
+}
+
+//---------------------------------------------------------------------------------------------
+
+#ifdef __linux__
+
+// The client has nothing more to say until it has our reply, so anything readable is the end
+static bool dcc_client_hung_up(int fd, short revents)
+{
+	if (revents & (POLLHUP|POLLERR|POLLRDHUP))
+		return true;
+
+	char c;
+	ssize_t n = recv(fd, &c, 1, MSG_PEEK|MSG_DONTWAIT);
+	return n == 0 || (n == -1 && errno != EAGAIN && errno != EINTR && errno != ENOTSOCK);
+}
+
+#endif // __linux__
+
+//---------------------------------------------------------------------------------------------
+
+bool dcc_drain_captures(OutputCapture &out, OutputCapture &err, fd_t client_fd, const proc_t &cc_pid)
+{
+#ifdef __linux__
+	OutputCapture *captures[2] = { &out, &err };
+	char buf[65536];
+	bool watch_client = client_fd.fd != -1;
+
+	for (;;)
+	{
+		struct pollfd fds[3];
+		OutputCapture *owner[3];
+		int n = 0;
+		for (int i = 0; i < 2; ++i)
+			if (captures[i]->_pipe[0] != -1)
+			{
+				fds[n].fd = captures[i]->_pipe[0];
+				fds[n].events = POLLIN;
+				owner[n++] = captures[i];
+			}
+		int pipes = n;
+		if (watch_client)
+		{
+			fds[n].fd = client_fd.fd;
+			fds[n].events = POLLIN|POLLRDHUP;
+			owner[n++] = 0;
+		}
+
+		if (!pipes)
+		{
+			// The output goes to files, so look for the compiler's exit instead
+			siginfo_t info;
+			info.si_pid = 0;
+			if (!watch_client 
+				|| waitid(P_PID, cc_pid.pid, &info, WEXITED|WNOHANG|WNOWAIT) == -1 
+				|| info.si_pid)
+			{
+				return true;
+			}
+		}
+
+		if (poll(fds, n, pipes ? -1 : 100) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			rs_log_error("poll failed: %s", strerror(errno));
+			return true;
+		}
+
+		for (int k = 0; k < n; ++k)
+		{
+			if (!fds[k].revents)
+				continue;
+
+			if (!owner[k])
+			{
+				if (!dcc_client_hung_up(fds[k].fd, fds[k].revents))
+				{
+					// not what we expected, but not our business either
+					watch_client = false;
+					continue;
+				}
+
+				rs_log_warning("client disconnected; killing compiler %d", (int) cc_pid.pid);
+				dcc_kill_child(cc_pid, SIGKILL);
+				for (int i = 0; i < 2; ++i)
+					if (captures[i]->_pipe[0] != -1)
+					{
+						close(captures[i]->_pipe[0]);
+						captures[i]->_pipe[0] = -1;
+					}
+				return false;
+			}
+
+			int &fd = owner[k]->_pipe[0];
+			ssize_t len = read(fd, buf, sizeof(buf));
+			if (len > 0)
+			{
+				owner[k]->append(buf, len);
+			}
+			else if (len == 0 || errno != EINTR)
+			{
+				// end of output
+				close(fd);
+				fd = -1;
+			}
+		}
+	}
+#else
+	return true;
+#endif // __linux__
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
@@ -0,0 +1,81 @@
+
+#ifndef _distcc_server_capture_h_
+#define _distcc_server_capture_h_
+
+#include <string>
+
+#include "common/distcc.h"
+
+#include "rvfc/filesys/defs.h"
+
+namespace distcc
+{
+
+using std::string;
+using rvfc::File;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+// Collects one output stream of the compiler (stdout or stderr) for sending back to the client.
+//
+// The compiler writes into a pipe and the output is kept in memory.  Past a size limit, or
+// when somebody needs it as a file (the cache, or a compiler that can't be drained while it
+// runs), everything goes to a temporary file instead.
+
+class OutputCapture
+{
+	string _buf;
+	const char *_suffix;
+	File _spill;
+	int _spill_fd;
+	int _pipe[2];
+
+	// Set while complaining about the spill file, which may come back here through the log 
+	// capture (rs_logger_capture) and must not go into the file that just failed
+	bool _complaining;
+
+	void write_spill(const char *data, size_t len);
+
+public:
+	// In-memory limit for each stream
+	enum { limit = 1 << 20 };
+
+	OutputCapture(const char *suffix);
+	~OutputCapture();
+
+	// Set up the pipe; without one, the compiler writes to the file
+	bool open_pipe();
+
+	// Where the compiler's stream should go (for dcc_spawn_child), and when it's started
+	File child_end();
+	void close_child_end();
+
+	void append(const char *data, size_t len);
+
+	// Forget what was captured so far, for a compiler that's run again
+	void reset();
+
+	// Move the output to the temporary file and return that.  Further output is appended to it.
+	const File &file();
+
+	// Whether the output has gone to the temporary file
+	bool spilled() const { return _spill_fd != -1; }
+
+	// Take every occurrence of @p s out of the output kept in memory
+	void erase(const string &s);
+
+	int send(fd_t ofd, const char *token, enum dcc_compress compr);
+
+	friend bool dcc_drain_captures(OutputCapture &out, OutputCapture &err, fd_t client_fd, const proc_t &cc_pid);
+};
+
+// Read from the pipes until the compiler (and anything it started) has closed both, or, without
+// pipes, until the compiler exits.  Meanwhile, watch the client's connection: if it goes away,
+// kill the compiler and return false.
+bool dcc_drain_captures(OutputCapture &out, OutputCapture &err, fd_t client_fd, const proc_t &cc_pid);
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
+
+#endif // _distcc_server_capture_h_
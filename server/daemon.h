@@ -21,6 +21,11 @@
  */
 
 #include "config.h"
+
+#include <set>
+#include <map>
+#include <vector>
+
 #include "rvfc/defs.h"
 
 namespace distcc
@@ -30,6 +35,7 @@ namespace distcc
 int dcc_refuse_root();
 int dcc_set_lifetime();
 int dcc_log_daemon_started(const char *role);
+void dcc_start_log_buffer();
 
 // service.c
 void dcc_win32_service(int argc, char *argv[]);
@@ -147,11 +153,40 @@ class StandaloneServer : public GeneralServer
 	int dcc_nkids;
 	// In forking or prefork mode, the maximum number of connections we want to allow at any time
 	int dcc_max_kids;
+	// Number of preforked workers; exceeds dcc_max_kids when jobs may be queued
+	int dcc_max_workers;
 
 	int listen_fd;
 
     int n_cpus;
 
+#ifndef _WIN32
+	// Workers announce on this pipe that they're about to retire, so that a replacement can
+	// be started while they finish their last job
+	int retire_pipe[2];
+	std::set<pid_t> retiring_kids;
+
+	void setup_retire_pipe();
+	void collect_retirements();
+	void wait_for_kids();
+
+	// With --listen-shards, each worker accepts on one of several SO_REUSEPORT sockets.
+	// Workers are assigned to the socket with the fewest (non-retiring) workers.
+	std::vector<int> shard_fds;
+	std::vector<int> shard_kids;
+	std::map<pid_t, int> kid_shard;
+
+	void setup_listen_shards();
+	int pick_shard() const;
+	void release_shard(pid_t kid);
+	void pin_to_shard(int shard) const;
+
+	// With --metrics-port or --metrics-socket, the parent answers scrapes while it waits
+	int metrics_fd;
+
+	void setup_metrics_socket();
+#endif
+
 #ifdef _WIN32
 	Job _job;
 #endif
@@ -201,11 +236,20 @@ class WorkerProcess
 	int listen_fd;
 	bool dcc_term_flag;
 
+#ifndef _WIN32
+	int retire_fd;
+	time_t born;
+
+	bool wait_for_connection();
+	bool worn_out(int nreq, const char *&why) const;
+	void retire(const char *why);
+#endif
+
 public:
 #if defined(_WIN32)
 	WorkerProcess(const std::string &serverId);
 #else
-	WorkerProcess(int listen_fd);
+	WorkerProcess(int listen_fd, int retire_fd);
 #endif
 
 	void run();
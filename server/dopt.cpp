@@ -46,6 +46,7 @@
 #include "server/access.h"
 #include "server/dopt.h"
 #include "server/daemon.h"
+#include "server/affinity.h"
 
 #include "contrib/popt/popt.h"
 
@@ -66,6 +67,19 @@ int opt_niceness = 5;           // default
 // If zero (recommended), then dynamically set from the number of CPUs.
 int arg_max_jobs = 0;
 
+// Number of jobs allowed to wait for a compile slot before new clients are told we're busy.
+// If zero, admission control is off and excess connections just wait in the listen queue.
+int arg_max_queue = 0;
+
+// Number of workers started per second while filling up the pool.  If zero, start them all at once.
+int arg_spawn_rate = 10;
+
+// A worker is replaced once it served this many requests, grew beyond this many MB, 
+// or reached this age in seconds.  Zero disables the respective limit.
+int arg_worker_requests = 50;
+int arg_worker_rss = 0;
+int arg_worker_age = 0;
+
 int arg_port = DISTCC_DEFAULT_PORT;
 
 // If true, serve all requests directly from listening process without forking.  Better for debugging.
@@ -74,11 +88,59 @@ int opt_no_fork = 0;
 int opt_worker = 0;
 char *opt_server_id = 0;
 int opt_inetd_mode = 0;
+// If true, always receive the whole input before starting the compiler, 
+// rather than feeding it to the compiler through a fifo as it arrives
 int opt_no_fifo = 0;
 
 // If non-NULL, listen on only this address
 char *opt_listen_addr = NULL;
 
+// Size limit of the compilation cache in MB; zero turns the cache off.
+// The cache lives in arg_cache_dir, or under the temporary directory if that's not given.
+int arg_cache_size = 0;
+char *arg_cache_dir = NULL;
+
+// Size limit in MB for keeping received sources, so that clients offering their digest 
+// (host option "dedup") needn't send them again.  Zero turns it off.
+int arg_input_cache_size = 0;
+
+// Size limit in MB for keeping the headers of jobs preprocessed here (host option "pump"),
+// so that each client sends each header once.  Zero turns it off.
+int arg_header_cache_size = 0;
+
+// If given, take compilers shipped by clients (host option "ship"), and keep them here
+char *arg_toolchain_dir = NULL;
+
+// If nonzero, keep the temporary files of jobs in memory (a tmpfs) as long as it has this
+// many MB free; otherwise they go to the temporary directory on disk.
+int arg_mem_workspace = 0;
+
+// Memory admission: don't start a compiler unless this many MB would remain available, 
+// or while memory pressure (PSI "some avg10", percent) is at or above arg_mem_pressure.  
+// Zero turns the respective check off.
+int arg_mem_reserve = 0;
+int arg_mem_pressure = 0;
+
+// If given, run compilers in this cgroup, limited to arg_cgroup_mem MB together (if nonzero)
+char *arg_cgroup = NULL;
+int arg_cgroup_mem = 0;
+
+// Placement of compile slots: "numa", "cores" or "none" (see affinity.h), and whether to 
+// bind compilers to the memory of their slot's NUMA node as well
+char *arg_slot_affinity = NULL;
+int opt_bind_memory = 0;
+
+// If nonzero, open this many SO_REUSEPORT listening sockets and spread the workers over them,
+// rather than having all workers accept on a single socket.
+int arg_listen_shards = 0;
+
+// If true, pin the workers of each listening socket to their own group of CPUs
+int opt_pin_shards = 0;
+
+// If given, serve metrics (see metrics.h) on this port of 127.0.0.1, or on this Unix socket
+int arg_metrics_port = 0;
+char *arg_metrics_socket = NULL;
+
 list<dcc_allow_spec> opt_allowed;
 
 // If true, run as service (linux: detach from the parent)
@@ -98,12 +160,26 @@ int opt_lifetime = 0;
 char *arg_pid_file = NULL;
 char *arg_log_file = NULL;
 
+// If nonzero, messages to a log file or stderr are buffered (up to this many KB) and written 
+// by a background thread
+int arg_log_buffer = 0;
+
 // Enumeration values for options that don't have single-letter name.  
 // These must be numerically above all the ascii letters.
 enum 
 {
     opt_log_to_file = 300,
-    opt_log_level
+    opt_log_level,
+    opt_log_buffer,
+    opt_max_queue,
+    opt_spawn_rate,
+    opt_worker_limit,
+    opt_listen_shards,
+    opt_cache_size,
+    opt_mem_workspace,
+    opt_mem_limit,
+    opt_slot_affinity,
+    opt_metrics
 };
 
 //---------------------------------------------------------------------------------------------
@@ -111,17 +187,32 @@ enum
 const struct poptOption options[] = 
 {
     { "allow", 'a',      POPT_ARG_STRING, 0, 'a', 0, 0 },
+    { "bind-memory", 0,  POPT_ARG_NONE, &opt_bind_memory, 0, 0, 0 },
     { "jobs", 'j',       POPT_ARG_INT, &arg_max_jobs, 'j', 0, 0 },
 #ifdef _WIN32
 	{ "worker", 0,       POPT_ARG_STRING, &opt_server_id, 0, 0, 0 },
 #endif
+    { "cache-dir", 0,    POPT_ARG_STRING, &arg_cache_dir, 0, 0, 0 },
+    { "cgroup", 0,       POPT_ARG_STRING, &arg_cgroup, opt_mem_limit, 0, 0 },
+    { "cgroup-mem", 0,   POPT_ARG_INT, &arg_cgroup_mem, opt_mem_limit, 0, 0 },
+    { "cache-size", 0,   POPT_ARG_INT, &arg_cache_size, opt_cache_size, 0, 0 },
+    { "input-cache", 0,  POPT_ARG_INT, &arg_input_cache_size, opt_cache_size, 0, 0 },
+    { "header-cache", 0, POPT_ARG_INT, &arg_header_cache_size, opt_cache_size, 0, 0 },
     { "help", 0,         POPT_ARG_NONE, 0, '?', 0, 0 },
     { "inetd", 0,        POPT_ARG_NONE, &opt_inetd_mode, 0, 0, 0 },
     { "lifetime", 0,     POPT_ARG_INT, &opt_lifetime, 0, 0, 0 },
     { "listen", 0,       POPT_ARG_STRING, &opt_listen_addr, 0, 0, 0 },
+    { "listen-shards", 0, POPT_ARG_INT, &arg_listen_shards, opt_listen_shards, 0, 0 },
+    { "log-buffer", 0,   POPT_ARG_INT, &arg_log_buffer, opt_log_buffer, 0, 0 },
     { "log-file", 0,     POPT_ARG_STRING, &arg_log_file, 0, 0, 0 },
     { "log-level", 0,    POPT_ARG_STRING, 0, opt_log_level, 0, 0 },
     { "log-stderr", 0,   POPT_ARG_NONE, &opt_log_stderr, 0, 0, 0 },
+    { "max-queue", 0,    POPT_ARG_INT, &arg_max_queue, opt_max_queue, 0, 0 },
+    { "mem-pressure", 0, POPT_ARG_INT, &arg_mem_pressure, opt_mem_limit, 0, 0 },
+    { "mem-reserve", 0,  POPT_ARG_INT, &arg_mem_reserve, opt_mem_limit, 0, 0 },
+    { "mem-workspace", 0, POPT_ARG_INT, &arg_mem_workspace, opt_mem_workspace, 0, 0 },
+    { "metrics-port", 0, POPT_ARG_INT, &arg_metrics_port, opt_metrics, 0, 0 },
+    { "metrics-socket", 0, POPT_ARG_STRING, &arg_metrics_socket, opt_metrics, 0, 0 },
     { "nice", 'N',       POPT_ARG_INT,  &opt_niceness,  0, 0, 0 },
 #ifndef _WIN32
     { "no-detach", 0,    POPT_ARG_NONE, &opt_no_detach, 0, 0, 0 },
@@ -129,14 +220,21 @@ const struct poptOption options[] =
     { "no-fifo", 0,      POPT_ARG_NONE, &opt_no_fifo, 0, 0, 0 },
     { "no-fork", 0,      POPT_ARG_NONE, &opt_no_fork, 0, 0, 0 },
     { "pid-file", 'P',   POPT_ARG_STRING, &arg_pid_file, 0, 0, 0 },
+    { "pin-shards", 0,   POPT_ARG_NONE, &opt_pin_shards, 0, 0, 0 },
     { "port", 'p',       POPT_ARG_INT, &arg_port,      0, 0, 0 },
     { "service", 0,      POPT_ARG_NONE, &opt_service, 0, 0, 0 },
+    { "slot-affinity", 0, POPT_ARG_STRING, &arg_slot_affinity, opt_slot_affinity, 0, 0 },
+    { "spawn-rate", 0,   POPT_ARG_INT, &arg_spawn_rate, opt_spawn_rate, 0, 0 },
+    { "toolchain-dir", 0, POPT_ARG_STRING, &arg_toolchain_dir, 0, 0, 0 },
 #ifndef _WIN32
 	{ "user", 0,         POPT_ARG_STRING, &opt_user, 'u', 0, 0 },
 #endif
     { "verbose", 0,      POPT_ARG_NONE, 0, 'v', 0, 0 },
     { "version", 0,      POPT_ARG_NONE, 0, 'V', 0, 0 },
     { "wizard", 'W',     POPT_ARG_NONE, 0, 'W', 0, 0 },
+    { "worker-age", 0,   POPT_ARG_INT, &arg_worker_age, opt_worker_limit, 0, 0 },
+    { "worker-requests", 0, POPT_ARG_INT, &arg_worker_requests, opt_worker_limit, 0, 0 },
+    { "worker-rss", 0,   POPT_ARG_INT, &arg_worker_rss, opt_worker_limit, 0, 0 },
     { 0, 0, 0, 0, 0, 0, 0 }
 };
 
@@ -156,10 +254,37 @@ static void distccd_show_usage()
 "    -N, --nice LEVEL           lower priority, 20=most nice\n"
 "    --user USER                if run by root, change to this persona\n"
 "    --jobs, -j LIMIT           maximum tasks at any time\n"
+"    --max-queue DEPTH          queued tasks before refusing clients as busy\n"
+"    --cache-size MB            keep up to MB megabytes of compilation results\n"
+"    --cache-dir DIR            directory for the compilation cache\n"
+"    --input-cache MB           keep up to MB megabytes of received sources\n"
+"    --header-cache MB          keep up to MB megabytes of headers sent by clients\n"
+"    --toolchain-dir DIR        take compilers sent by clients, and keep them in DIR\n"
+"    --mem-workspace MB         keep job files in memory while MB megabytes are free\n"
+"    --no-fifo                  receive all input before starting the compiler\n"
+"  Memory:\n"
+"    --mem-reserve MB           start compilers only while MB megabytes stay free\n"
+"    --mem-pressure PCT         hold compilers while memory pressure is at PCT%%\n"
+"    --cgroup DIR               run compilers in this (v2) cgroup\n"
+"    --cgroup-mem MB            limit the compilers in the cgroup to MB megabytes\n"
+"  Placement:\n"
+"    --slot-affinity MODE       bind each compile slot to a NUMA node or to cores\n"
+"      modes: numa, cores, none\n"
+"    --bind-memory              with numa, also bind compilers to the node's memory\n"
+"  Worker processes:\n"
+"    --spawn-rate N             start up to N workers per second, 0=no limit\n"
+"    --worker-requests N        replace a worker after N requests, 0=never\n"
+"    --worker-rss MB            replace a worker grown beyond MB megabytes\n"
+"    --worker-age SECS          replace a worker after SECS seconds\n"
 "  Networking:\n"
 "    -p, --port PORT            TCP port to listen on\n"
 "    --listen ADDRESS           IP address to listen on\n"
+"    --listen-shards N          spread workers over N SO_REUSEPORT sockets\n"
+"    --pin-shards               pin each socket's workers to a group of CPUs\n"
 "    -a, --allow IP[/BITS]      client address access control\n"
+"  Metrics:\n"
+"    --metrics-port PORT        serve metrics to Prometheus on 127.0.0.1:PORT\n"
+"    --metrics-socket PATH      serve metrics on a Unix socket instead\n"
 "  Debug and trace:\n"
 "    --log-level=LEVEL          set detail level for log file\n"
 "      levels: critical, error, warning, notice, info, debug\n"
@@ -167,6 +292,7 @@ static void distccd_show_usage()
 "    --no-detach                don't detach from parent (for daemontools, etc)\n" 
 "    --log-file=FILE            send messages here instead of syslog\n"
 "    --log-stderr               send messages to stderr\n"
+"    --log-buffer KB            write messages from a buffer in the background\n"
 "    --wizard                   for running under gdb\n"
 "  Mode of operation:\n"
 "    --inetd                    serve client connected to stdin\n"
@@ -176,6 +302,10 @@ static void distccd_show_usage()
 "files submitted by the distcc client.\n"
 "\n"
 "distccd should only run on trusted networks.\n"
+"With --toolchain-dir, clients can make it run programs of their own.\n"
+"\n"
+"With $DISTCC_TIMELINE set to a directory, the phases of each job are appended\n"
+"to a trace there, for distcc-trace-merge.\n"
 );
 }
 
@@ -265,6 +395,99 @@ Configuration::parse_options(int argc, char *argv[])
             }
             break;
 
+        case opt_max_queue:
+            if (arg_max_queue < 0 || arg_max_queue > 1000) 
+			{
+                rs_log_error("--max-queue argument must be between 0 and 1000");
+                throw std::runtime_error("bad arguments");
+            }
+            break;
+
+        case opt_listen_shards:
+            if (arg_listen_shards < 0 || arg_listen_shards > 256) 
+			{
+                rs_log_error("--listen-shards argument must be between 0 and 256");
+                throw std::runtime_error("bad arguments");
+            }
+            break;
+
+        case opt_cache_size:
+            if (arg_cache_size < 0 || arg_input_cache_size < 0 || arg_header_cache_size < 0) 
+			{
+                rs_log_error("cache sizes must not be negative");
+                throw std::runtime_error("bad arguments");
+            }
+            break;
+
+        case opt_mem_workspace:
+            if (arg_mem_workspace < 0) 
+			{
+                rs_log_error("--mem-workspace argument must not be negative");
+                throw std::runtime_error("bad arguments");
+            }
+#ifndef __linux__
+            if (arg_mem_workspace)
+                rs_log_warning("--mem-workspace is not supported on this platform");
+#endif
+            break;
+
+        case opt_mem_limit:
+            if (arg_mem_reserve < 0 || arg_mem_pressure < 0 || arg_mem_pressure > 100 || arg_cgroup_mem < 0) 
+			{
+                rs_log_error("memory limits must not be negative, nor pressure above 100%%");
+                throw std::runtime_error("bad arguments");
+            }
+            if (arg_cgroup_mem && !arg_cgroup)
+			{
+                rs_log_error("--cgroup-mem requires --cgroup");
+                throw std::runtime_error("bad arguments");
+            }
+#ifndef __linux__
+            rs_log_warning("memory limits are not supported on this platform");
+#endif
+            break;
+
+        case opt_slot_affinity:
+		{
+			enum dcc_affinity_mode mode;
+            if (!dcc_parse_affinity_mode(arg_slot_affinity, mode)) 
+			{
+                rs_log_error("--slot-affinity must be numa, cores or none");
+                throw std::runtime_error("bad arguments");
+            }
+#ifndef __linux__
+            rs_log_warning("--slot-affinity is not supported on this platform");
+#endif
+            break;
+		}
+
+        case opt_metrics:
+            if (arg_metrics_port < 0 || arg_metrics_port > 65535) 
+			{
+                rs_log_error("--metrics-port argument must be a port number");
+                throw std::runtime_error("bad arguments");
+            }
+#ifndef __linux__
+            rs_log_warning("metrics are not supported on this platform");
+#endif
+            break;
+
+        case opt_spawn_rate:
+            if (arg_spawn_rate < 0) 
+			{
+                rs_log_error("--spawn-rate argument must not be negative");
+                throw std::runtime_error("bad arguments");
+            }
+            break;
+
+        case opt_worker_limit:
+            if (arg_worker_requests < 0 || arg_worker_rss < 0 || arg_worker_age < 0) 
+			{
+                rs_log_error("worker limits must not be negative");
+                throw std::runtime_error("bad arguments");
+            }
+            break;
+
         case 'u':
 #ifdef __linux__
 			if (getuid() != 0 && geteuid() != 0) 
@@ -291,6 +514,17 @@ Configuration::parse_options(int argc, char *argv[])
             }
             break;
 
+        case opt_log_buffer:
+            if (arg_log_buffer < 0 || arg_log_buffer > 1024 * 1024) 
+			{
+                rs_log_error("--log-buffer argument must be between 0 and 1048576");
+                throw std::runtime_error("bad arguments");
+            }
+#ifndef __linux__
+            rs_log_warning("--log-buffer is not supported on this platform");
+#endif
+            break;
+
         case 'v':
             rs_trace_set_level(RS_LOG_DEBUG);
             break;
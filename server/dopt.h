@@ -36,16 +36,35 @@ int distccd_parse_options(int argc, const char *argv[]);
 
 extern int arg_port;
 extern int arg_max_jobs;
+extern int arg_max_queue;
+extern int arg_spawn_rate;
+extern int arg_worker_requests, arg_worker_rss, arg_worker_age;
+extern int arg_cache_size;
+extern char *arg_cache_dir;
+extern int arg_input_cache_size;
+extern int arg_header_cache_size;
+extern char *arg_toolchain_dir;
+extern int arg_mem_workspace;
+extern int arg_mem_reserve, arg_mem_pressure;
+extern char *arg_cgroup;
+extern int arg_cgroup_mem;
+extern char *arg_slot_affinity;
+extern int opt_bind_memory;
 extern char *arg_pid_file;
 extern int opt_no_fork;
 extern int opt_no_prefork;
 extern int opt_no_detach;
 extern int opt_service, opt_inetd_mode;
 extern char *arg_log_file;
+extern int arg_log_buffer;
 extern int opt_no_fifo;
 extern int opt_log_stderr;
 extern int opt_lifetime;
 extern char *opt_listen_addr;
+extern int arg_listen_shards;
+extern int opt_pin_shards;
+extern int arg_metrics_port;
+extern char *arg_metrics_socket;
 extern int opt_niceness;
 extern char *opt_server_id;
 
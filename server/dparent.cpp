@@ -76,6 +76,10 @@
 #include "types.h"
 #include "daemon.h"
 #include "netutil.h"
+#include "admit.h"
+#include "usage.h"
+#include "affinity.h"
+#include "metrics.h"
 
 namespace distcc
 {
@@ -100,9 +104,15 @@ StandaloneServer::StandaloneServer(bool noFork, bool runAsService) : no_fork(noF
 	dcc_term_flag = false;
 #ifdef _WIN32
 	termination_event = CreateEvent(0, TRUE, FALSE, 0); 
+#else
+	retire_pipe[0] = retire_pipe[1] = -1;
+	metrics_fd = -1;
 #endif
-	setup_listen_socket();
 	determine_worker_count();
+	setup_listen_socket();
+#ifndef _WIN32
+	setup_metrics_socket();
+#endif
 
 #ifdef _WIN32
 	_job += CurrentProcess();
@@ -125,6 +135,14 @@ StandaloneServer::~StandaloneServer()
 void 
 StandaloneServer::setup_listen_socket()
 {
+#ifndef _WIN32
+	if (arg_listen_shards && !no_fork)
+	{
+		setup_listen_shards();
+		return;
+	}
+#endif
+
 	if (dcc_socket_listen(arg_port, &listen_fd, opt_listen_addr) != 0)
 		throw std::runtime_error("listen to socket failed");
 	dcc_defer_accept(listen_fd);
@@ -133,6 +151,55 @@ StandaloneServer::setup_listen_socket()
 
 //---------------------------------------------------------------------------------------------
 
+#ifndef _WIN32
+
+void 
+StandaloneServer::setup_listen_shards()
+{
+	int n_shards = arg_listen_shards;
+	if (n_shards > dcc_max_workers)
+	{
+		rs_log_warning("only %d workers: reducing listening sockets from %d", dcc_max_workers, n_shards);
+		n_shards = dcc_max_workers;
+	}
+
+	for (int i = 0; i < n_shards; ++i)
+	{
+		int fd;
+		if (dcc_socket_listen(arg_port, &fd, opt_listen_addr, true) != 0)
+			throw std::runtime_error("listen to socket failed");
+		dcc_defer_accept(fd);
+		set_cloexec_flag(fd, 1);
+		shard_fds.push_back(fd);
+		shard_kids.push_back(0);
+	}
+
+	listen_fd = shard_fds[0];
+	rs_log_info("accepting on %d SO_REUSEPORT sockets", n_shards);
+}
+
+//---------------------------------------------------------------------------------------------
+
+void 
+StandaloneServer::setup_metrics_socket()
+{
+	if (!arg_metrics_port && !arg_metrics_socket)
+		return;
+
+	if (no_fork)
+	{
+		rs_log_warning("metrics are only served by the preforking daemon");
+		return;
+	}
+
+	if ((metrics_fd = dcc_metrics_listen(arg_metrics_port, arg_metrics_socket)) == -1)
+		throw std::runtime_error("cannot serve metrics");
+}
+
+#endif // ! _WIN32
+
+//---------------------------------------------------------------------------------------------
+
 void
 StandaloneServer::determine_worker_count()
 {
@@ -144,6 +211,34 @@ StandaloneServer::determine_worker_count()
 	// machine is not idle waiting for disk or network IO.
 	dcc_nkids = 0;
 	dcc_max_kids = arg_max_jobs ? arg_max_jobs : 2 + n_cpus;
+	dcc_max_workers = dcc_max_kids;
+
+#ifndef _WIN32
+	if (arg_max_queue && !no_fork)
+	{
+		// Queued jobs each hold a worker, and one more is kept free to turn clients away
+		dcc_max_workers += arg_max_queue + 1;
+		dcc_admission_init(dcc_max_kids, arg_max_queue);
+	}
+	else if ((arg_mem_reserve || arg_mem_pressure || arg_slot_affinity) && !no_fork)
+	{
+		// the memory checks and the numbering of compile slots need the shared state
+		dcc_admission_init(dcc_max_kids, 0);
+	}
+	dcc_admission_limit_memory(arg_mem_reserve, arg_mem_pressure);
+
+	enum dcc_affinity_mode affinity = DCC_AFFINITY_NONE;
+	if (arg_slot_affinity && dcc_parse_affinity_mode(arg_slot_affinity, affinity))
+		dcc_affinity_init(affinity, dcc_max_kids, !!opt_bind_memory);
+
+	if (arg_cgroup && !dcc_admission_cgroup(arg_cgroup, arg_cgroup_mem))
+		throw std::runtime_error("cannot set up cgroup");
+
+	dcc_usage_init();
+
+	if ((arg_metrics_port || arg_metrics_socket) && !no_fork)
+		dcc_metrics_init(dcc_max_kids);
+#endif // ! _WIN32
 
 #ifdef _WIN32
 	child_threads = (HANDLE *) calloc(dcc_max_kids, sizeof(HANDLE));
@@ -182,6 +277,7 @@ StandaloneServer::run()
 
     // This is called in the master daemon, whether that is detached or not
     dcc_master_pid = getpid();
+    dcc_start_log_buffer();
 #endif // ! _WIN32
 
     if (no_fork) 
@@ -281,6 +377,8 @@ StandaloneServer::reap_kids(bool must_reap)
 	}
 
 #else // ! _WIN32
+	collect_retirements();
+
     for (;;)
 	{
         int status;
@@ -292,8 +390,13 @@ StandaloneServer::reap_kids(bool must_reap)
         }
 		else if (kid != -1) 
 		{
-            // child exited
+            // child exited; its notice, if it sent one, is in the pipe by now, and must be read
+            // before forgetting it, or it would count as retiring forever
+            collect_retirements();
             --dcc_nkids;
+            retiring_kids.erase(kid);
+            release_shard(kid);
+            dcc_admission_release(kid);
             rs_trace("down to %d children", dcc_nkids);
 
             dcc_log_child_exited(kid, status);
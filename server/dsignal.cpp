@@ -141,6 +141,11 @@ static RETSIGTYPE dcc_daemon_terminate(int whichsig)
         kill(0, whichsig);
 #endif
     }
+	else
+	{
+		// the compiler is in a group of its own
+		dcc_kill_running_child(whichsig);
+	}
 
     raise(whichsig);
 }
@@ -73,12 +73,15 @@ Log::Log()
 
 void Log::setupRealLog()
 {
+    // Messages are only buffered once dcc_start_log_buffer() has been called in the process
+    rs_logger_fn *file_logger = arg_log_buffer ? rs_logger_async : rs_logger_file;
+
     // Even in inetd mode, we might want to log to stderr, because that will work OK for ssh connections
     
     if (opt_log_stderr) 
 	{
         rs_remove_all_loggers();
-        rs_add_logger(rs_logger_file, RS_LOG_DEBUG, 0, STDERR_FILENO);
+        rs_add_logger(file_logger, RS_LOG_DEBUG, 0, STDERR_FILENO);
         return;
     }
     
@@ -94,7 +97,7 @@ void Log::setupRealLog()
 		else 
 		{
             rs_remove_all_loggers();
-            rs_add_logger(rs_logger_file, RS_LOG_DEBUG, NULL, fd);
+            rs_add_logger(file_logger, RS_LOG_DEBUG, NULL, fd);
             return;
         }
     }
@@ -114,5 +117,17 @@ int dcc_log_daemon_started(const char *role)
     return 0;
 }
 
+//---------------------------------------------------------------------------------------------
+
+// Start the background writer of the log (--log-buffer) in this process.  
+// It doesn't survive fork(), so each long-lived process calls this; in the compilers' 
+// children, messages are written as they come.
+
+void dcc_start_log_buffer()
+{
+    if (arg_log_buffer)
+        rs_async_log_start((size_t) arg_log_buffer << 10);
+}
+
 
 } // namespace distcc
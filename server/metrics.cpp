@@ -0,0 +1,391 @@
+/**
+ * @file
+ *
+ * Server metrics, shared by the workers and served in the Prometheus text format.
+ **/
+
+#include "common/config.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>
+#endif
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <string>
+
+#include "common/distcc.h"
+#include "common/trace.h"
+#include "common/util.h"
+#include "common/netutil.h"
+#include "common/timeval.h"
+
+#include "server/metrics.h"
+
+#include "rvfc/text/defs.h"
+
+namespace distcc
+{
+
+using std::string;
+using namespace rvfc::Text;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef __linux__
+
+// Upper bounds of the histogram buckets, in msecs; the last bucket is +Inf
+static const unsigned bucket_msecs[] = { 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000 };
+
+enum
+{
+	n_buckets = sizeof(bucket_msecs) / sizeof(bucket_msecs[0]) + 1,
+	n_codecs = 2 // none, lzo
+};
+
+static const char *outcome_names[DCC_JOB_OUTCOMES] = { "done", "failed", "cached", "busy", "client_gone", "wrong_toolchain", "error" };
+static const char *phase_names[DCC_METRIC_PHASES] = { "receive", "queue", "compile", "send" };
+static const char *codec_names[n_codecs] = { "none", "lzo" };
+static const char *cache_names[DCC_METRIC_CACHES] = { "object", "input", "header" };
+
+struct dcc_metrics_state
+{
+	int max_jobs;
+
+	volatile unsigned long long jobs[DCC_JOB_OUTCOMES];
+	volatile int active, waiting, compiling;
+
+	struct
+	{
+		volatile unsigned long long buckets[n_buckets];
+		volatile unsigned long long count, sum_msecs;
+	} phases[DCC_METRIC_PHASES];
+
+	volatile unsigned long long bytes_in[n_codecs], bytes_out[n_codecs];
+
+	// [cache][hit]
+	volatile unsigned long long cache[DCC_METRIC_CACHES][2];
+};
+
+static dcc_metrics_state *metrics = 0;
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_metrics_init(int max_jobs)
+{
+	void *p = mmap(0, sizeof(dcc_metrics_state), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+	{
+		// not worth failing over
+		rs_log_warning("failed to map metrics: %s", strerror(errno));
+		return;
+	}
+
+	metrics = (dcc_metrics_state *) p;
+	metrics->max_jobs = max_jobs;
+}
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_metrics_job_begin()
+{
+	if (metrics)
+		__sync_add_and_fetch(&metrics->active, 1);
+}
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_metrics_job_end(enum dcc_job_outcome outcome, enum dcc_compress compr, fd_t sock)
+{
+	if (!metrics)
+		return;
+
+	__sync_add_and_fetch(&metrics->jobs[outcome], 1);
+	__sync_sub_and_fetch(&metrics->active, 1);
+
+	// Counting at the socket catches every way the data goes (sendfile, fifos, pipes),
+	// protocol included.  Sent data counts once the client has acknowledged it.
+	// Connections over ssh or inetd pipes aren't counted.
+	if (!sock.socket)
+		return;
+
+	struct tcp_info info;
+	memset(&info, 0, sizeof(info));
+	socklen_t len = sizeof(info);
+	if (getsockopt(sock.fd, IPPROTO_TCP, TCP_INFO, &info, &len) == -1
+		|| len < offsetof(struct tcp_info, tcpi_bytes_received) + sizeof(info.tcpi_bytes_received))
+	{
+		return;
+	}
+
+	int codec = compr == DCC_COMPRESS_LZO1X ? 1 : 0;
+	__sync_add_and_fetch(&metrics->bytes_in[codec], (unsigned long long) info.tcpi_bytes_received);
+	__sync_add_and_fetch(&metrics->bytes_out[codec], (unsigned long long) info.tcpi_bytes_acked);
+}
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_metrics_waiting(int delta)
+{
+	if (metrics)
+		__sync_add_and_fetch(&metrics->waiting, delta);
+}
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_metrics_compiling(int delta)
+{
+	if (metrics)
+		__sync_add_and_fetch(&metrics->compiling, delta);
+}
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_metrics_phase(enum dcc_job_phase phase, const struct timeval &start, const struct timeval &end)
+{
+	if (!metrics)
+		return;
+
+	struct timeval elapsed;
+	if (timeval_subtract(elapsed, end, start))
+		return; // the clock went back
+
+	unsigned long long msecs = (unsigned long long) elapsed.tv_sec * 1000 + elapsed.tv_usec / 1000;
+	int b = 0;
+	while (b < n_buckets - 1 && msecs > bucket_msecs[b])
+		++b;
+
+	__sync_add_and_fetch(&metrics->phases[phase].buckets[b], 1);
+	__sync_add_and_fetch(&metrics->phases[phase].sum_msecs, msecs);
+	__sync_add_and_fetch(&metrics->phases[phase].count, 1);
+}
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_metrics_cache(enum dcc_metric_cache cache, bool hit)
+{
+	if (metrics)
+		__sync_add_and_fetch(&metrics->cache[cache][hit ? 1 : 0], 1);
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void dcc_metric_header(string &s, const char *name, const char *type, const char *help)
+{
+	s += stringf("# HELP distccd_%s %s\n# TYPE distccd_%s %s\n", name, help, name, type);
+}
+
+//---------------------------------------------------------------------------------------------
+
+static string dcc_metrics_text()
+{
+	// The counters are read while the workers update them; a scrape may be off by a job
+	dcc_metrics_state m = *metrics;
+	string s;
+
+	dcc_metric_header(s, "jobs_total", "counter", "Jobs finished, by outcome.");
+	for (int i = 0; i < DCC_JOB_OUTCOMES; ++i)
+		s += stringf("distccd_jobs_total{outcome=\"%s\"} %llu\n", outcome_names[i], m.jobs[i]);
+
+	dcc_metric_header(s, "jobs_active", "gauge", "Jobs being served.");
+	s += stringf("distccd_jobs_active %d\n", m.active);
+	dcc_metric_header(s, "jobs_waiting", "gauge", "Jobs waiting for a compile slot.");
+	s += stringf("distccd_jobs_waiting %d\n", m.waiting);
+	dcc_metric_header(s, "jobs_compiling", "gauge", "Jobs holding a compile slot.");
+	s += stringf("distccd_jobs_compiling %d\n", m.compiling);
+	dcc_metric_header(s, "compile_slots", "gauge", "Compilers allowed to run at once.");
+	s += stringf("distccd_compile_slots %d\n", m.max_jobs);
+
+	dcc_metric_header(s, "job_phase_seconds", "histogram", "Time spent in each phase of a job.");
+	for (int p = 0; p < DCC_METRIC_PHASES; ++p)
+	{
+		unsigned long long n = 0;
+		for (int b = 0; b < n_buckets; ++b)
+		{
+			n += m.phases[p].buckets[b];
+			string le = b < n_buckets - 1 ? stringf("%g", bucket_msecs[b] / 1000.0) : string("+Inf");
+			s += stringf("distccd_job_phase_seconds_bucket{phase=\"%s\",le=\"%s\"} %llu\n",
+				phase_names[p], le.c_str(), n);
+		}
+		s += stringf("distccd_job_phase_seconds_sum{phase=\"%s\"} %.3f\n", phase_names[p], m.phases[p].sum_msecs / 1000.0);
+		s += stringf("distccd_job_phase_seconds_count{phase=\"%s\"} %llu\n", phase_names[p], m.phases[p].count);
+	}
+
+	dcc_metric_header(s, "network_bytes_total", "counter", "Bytes received from and sent to clients, by codec.");
+	for (int c = 0; c < n_codecs; ++c)
+	{
+		s += stringf("distccd_network_bytes_total{direction=\"in\",codec=\"%s\"} %llu\n", codec_names[c], m.bytes_in[c]);
+		s += stringf("distccd_network_bytes_total{direction=\"out\",codec=\"%s\"} %llu\n", codec_names[c], m.bytes_out[c]);
+	}
+
+	dcc_metric_header(s, "cache_lookups_total", "counter", "Lookups in the result, input and header caches.");
+	for (int c = 0; c < DCC_METRIC_CACHES; ++c)
+	{
+		s += stringf("distccd_cache_lookups_total{cache=\"%s\",result=\"hit\"} %llu\n", cache_names[c], m.cache[c][1]);
+		s += stringf("distccd_cache_lookups_total{cache=\"%s\",result=\"miss\"} %llu\n", cache_names[c], m.cache[c][0]);
+	}
+
+	return s;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static int dcc_metrics_listen_unix(const char *path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		rs_log_error("metrics socket name too long: %s", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+	{
+		rs_log_error("failed to create metrics socket: %s", strerror(errno));
+		return -1;
+	}
+
+	// left over from an earlier run
+	unlink(path);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(fd, 8) == -1)
+	{
+		rs_log_error("failed to listen on %s: %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+//---------------------------------------------------------------------------------------------
+
+int dcc_metrics_listen(int port, const char *socket_path)
+{
+	if (!metrics)
+		return -1;
+
+	int fd;
+	if (socket_path)
+	{
+		if ((fd = dcc_metrics_listen_unix(socket_path)) == -1)
+			return -1;
+		rs_log_info("serving metrics on %s", socket_path);
+	}
+	else
+	{
+		// Only locally: the metrics aren't for the clients
+		if (dcc_socket_listen(port, &fd, "127.0.0.1") != 0)
+			return -1;
+		rs_log_info("serving metrics on 127.0.0.1:%d", port);
+	}
+
+	set_cloexec_flag(fd, 1);
+	dcc_set_nonblocking(fd);
+	return fd;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Wait until @p fd is ready for @p events, or @p deadline has passed
+
+static bool dcc_metrics_wait(int fd, short events, const struct timeval &deadline)
+{
+	for (;;)
+	{
+		struct timeval now, left;
+		gettimeofday(&now, NULL);
+		if (timeval_subtract(left, deadline, now))
+			return false;
+
+		struct pollfd pfd = { fd, events, 0 };
+		int n = poll(&pfd, 1, left.tv_sec * 1000 + left.tv_usec / 1000);
+		if (n == -1 && errno == EINTR)
+			continue;
+		return n > 0;
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
+// This runs in the parent, which does nothing else meanwhile, so the whole exchange has to be 
+// over within a second, however slowly the scraper talks
+
+void dcc_metrics_answer(int listen_fd)
+{
+	int fd = accept(listen_fd, NULL, NULL);
+	if (fd == -1)
+		return;
+	dcc_set_nonblocking(fd);
+
+	struct timeval deadline;
+	gettimeofday(&deadline, NULL);
+	deadline.tv_sec += 1;
+
+	// Any request gets the metrics; just read its header so that closing doesn't reset it
+	char buf[4096];
+	size_t got = 0;
+	ssize_t n;
+	while (got < sizeof(buf) - 1 && dcc_metrics_wait(fd, POLLIN, deadline)
+		&& (n = read(fd, buf + got, sizeof(buf) - 1 - got)) > 0)
+	{
+		got += n;
+		buf[got] = '\0';
+		if (strstr(buf, "\r\n\r\n") || strstr(buf, "\n\n"))
+			break;
+	}
+
+	string body = dcc_metrics_text();
+	string reply = stringf("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %u\r\nConnection: close\r\n\r\n", (unsigned) body.size()) + body;
+
+	for (size_t sent = 0; sent < reply.size(); sent += n)
+	{
+		if (!dcc_metrics_wait(fd, POLLOUT, deadline))
+		{
+			rs_trace("timed out sending metrics");
+			break;
+		}
+		if ((n = write(fd, reply.data() + sent, reply.size() - sent)) <= 0)
+		{
+			rs_trace("failed to send metrics: %s", strerror(errno));
+			break;
+		}
+	}
+	close(fd);
+}
+
+//---------------------------------------------------------------------------------------------
+
+#else // ! __linux__
+
+// Workers are not forked on Windows; there are no shared metrics.
+
+void dcc_metrics_init(int max_jobs) {}
+void dcc_metrics_job_begin() {}
+void dcc_metrics_job_end(enum dcc_job_outcome outcome, enum dcc_compress compr, fd_t sock) {}
+void dcc_metrics_waiting(int delta) {}
+void dcc_metrics_compiling(int delta) {}
+void dcc_metrics_phase(enum dcc_job_phase phase, const struct timeval &start, const struct timeval &end) {}
+void dcc_metrics_cache(enum dcc_metric_cache cache, bool hit) {}
+int dcc_metrics_listen(int port, const char *socket_path) { return -1; }
+void dcc_metrics_answer(int listen_fd) {}
+
+#endif // ! __linux__
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
@@ -0,0 +1,77 @@
+
+#ifndef _distcc_server_metrics_h_
+#define _distcc_server_metrics_h_
+
+#ifdef __linux__
+#include <sys/time.h>
+#endif
+
+#include "common/distcc.h"
+
+namespace distcc
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+// Server metrics: jobs by outcome, jobs in progress, latency histograms of the phases of a
+// job, bytes on the wire by codec, and hits of the caches.
+//
+// The counters live in memory shared by all preforked workers, so dcc_metrics_init() must be
+// called by the parent before forking.  If it was never called, nothing is counted.
+// The parent serves them in the Prometheus text format (over a minimal HTTP) on a local port
+// or Unix socket (--metrics-port, --metrics-socket).
+
+enum dcc_job_outcome
+{
+	DCC_JOB_DONE,            // compiled, whatever the compiler said
+	DCC_JOB_FAILED,          // the compiler failed
+	DCC_JOB_CACHED,          // result taken from the cache
+	DCC_JOB_BUSY,            // refused by admission control
+	DCC_JOB_CLIENT_GONE,     // the client went away while compiling
+	DCC_JOB_WRONG_TOOLCHAIN, // our compiler isn't the client's
+	DCC_JOB_ERROR,           // anything else
+	DCC_JOB_OUTCOMES
+};
+
+enum dcc_job_phase
+{
+	DCC_METRIC_RECEIVE,     // from accepting to having the input (not with a fifo)
+	DCC_METRIC_QUEUE,       // waiting for a compile slot
+	DCC_METRIC_COMPILE,
+	DCC_METRIC_SEND,        // sending the results
+	DCC_METRIC_PHASES
+};
+
+enum dcc_metric_cache
+{
+	DCC_METRIC_OBJECT_CACHE,
+	DCC_METRIC_INPUT_CACHE,
+	DCC_METRIC_HEADER_CACHE, // counted per file of a job preprocessed here
+	DCC_METRIC_CACHES
+};
+
+void dcc_metrics_init(int max_jobs);
+
+// Bracket a job.  The bytes the job moved are taken from the socket's TCP statistics, so
+// dcc_metrics_job_end() must be called before it is closed.
+void dcc_metrics_job_begin();
+void dcc_metrics_job_end(enum dcc_job_outcome outcome, enum dcc_compress compr, fd_t sock);
+
+// The job is waiting for a compile slot (delta 1), or has stopped waiting (-1)
+void dcc_metrics_waiting(int delta);
+void dcc_metrics_compiling(int delta);
+
+void dcc_metrics_phase(enum dcc_job_phase phase, const struct timeval &start, const struct timeval &end);
+void dcc_metrics_cache(enum dcc_metric_cache cache, bool hit);
+
+// Open the listening socket (in the parent).  Returns -1 on failure.
+int dcc_metrics_listen(int port, const char *socket_path);
+
+// Answer a request waiting on the listening socket
+void dcc_metrics_answer(int listen_fd);
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
+
+#endif // _distcc_server_metrics_h_
@@ -0,0 +1,353 @@
+/**
+ * @file
+ *
+ * Copies of the client's directory tree, holding just what a job preprocessed here reads.
+ **/
+
+#include "common/config.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <ftw.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/stat.h>
+
+#include <vector>
+
+#include "common/distcc.h"
+#include "common/trace.h"
+#include "common/util.h"
+#include "common/rpc1.h"
+#include "common/bulk.h"
+#include "common/hash.h"
+#include "common/objcache.h"
+#include "common/compiler.h"
+#include "common/cc-options.h"
+#include "common/toolchain.h"
+
+#include "server/dopt.h"
+#include "server/metrics.h"
+#include "server/capture.h"
+#include "server/mirror.h"
+
+#include "rvfc/text/defs.h"
+
+namespace distcc
+{
+
+using std::vector;
+using namespace rvfc::Text;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef __linux__
+
+// Headers sent by clients, by digest, kept in a subdirectory of the compilation cache like
+// the sources of dcc_input_store().  They're shared by all clients: a header is the same
+// whoever sends it.
+
+static ObjectCache &dcc_header_store()
+{
+	static ObjectCache *store = 0;
+	if (!store)
+	{
+		string top = arg_cache_dir ? string(arg_cache_dir) : dcc_get_tmp_top() + "/distccd-cache";
+		if (arg_header_cache_size)
+			mkdir(+top, 0777);
+		store = new ObjectCache(Directory(top + "/headers"), (unsigned long long) arg_header_cache_size << 20);
+	}
+	return *store;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Whether @p path is absolute and doesn't lead out of the directory it's put under.  We make
+// no links there, so ".." goes where it seems to.
+
+static bool dcc_path_stays_inside(const string &path)
+{
+	if (path.empty() || path[0] != '/')
+		return false;
+
+	int depth = 0;
+	for (size_t i = 1, j; i < path.length(); i = j + 1)
+	{
+		j = path.find('/', i);
+		if (j == string::npos)
+			j = path.length();
+		string part = path.substr(i, j - i);
+		if (part == "..")
+		{
+			if (--depth < 0)
+				return false;
+		}
+		else if (!part.empty() && part != ".")
+		{
+			++depth;
+		}
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static int dcc_remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+	if ((type == FTW_DP ? rmdir(path) : unlink(path)) == -1)
+		rs_trace("failed to remove %s: %s", path, strerror(errno));
+	return 0;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// mkdir -p, for a directory under the root
+
+void MirrorRoot::make_dirs(const string &dir) const
+{
+	for (size_t i = _root.length() + 1; i <= dir.length(); ++i)
+	{
+		if (i == dir.length() || dir[i] == '/')
+			mkdir(+dir.substr(0, i), 0755);
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
+int MirrorRoot::receive(fd_t in_fd, fd_t out_fd, Directory &compile_dir, enum dcc_compress compr)
+{
+	int ret;
+	unsigned n;
+	if ((ret = dcc_r_token_string(in_fd, "CDIR", _cwd))
+		|| (ret = dcc_r_token_int(in_fd, "NFIL", n)))
+	{
+		return ret;
+	}
+
+	if (!dcc_path_stays_inside(_cwd) || n > 100000)
+	{
+		rs_log_error("bad request for a mirrored job: directory %s, %u files", +_cwd, n);
+		return EXIT_PROTOCOL_ERROR;
+	}
+	while (_cwd.length() > 1 && _cwd[_cwd.length() - 1] == '/')
+		_cwd.erase(_cwd.length() - 1);
+
+	vector<string> names(n), digests(n);
+	for (unsigned i = 0; i < n; ++i)
+	{
+		if ((ret = dcc_r_token_string(in_fd, "NAME", names[i]))
+			|| (ret = dcc_r_token_string(in_fd, "FDIG", digests[i])))
+		{
+			return ret;
+		}
+		if (!dcc_path_stays_inside(names[i]))
+		{
+			rs_log_error("client sent a file outside its tree: %s", +names[i]);
+			return EXIT_PROTOCOL_ERROR;
+		}
+	}
+
+	// The file is only a name for the directory, which goes with it at cleanup
+	File dir = dcc_make_tmpnam("distccd", ".root");
+	_root = dir.path();
+	unlink(+_root);
+	if (mkdir(+_root, 0700) == -1)
+	{
+		rs_log_error("failed to create %s: %s", +_root, strerror(errno));
+		_root = "";
+		return EXIT_IO_ERROR;
+	}
+	make_dirs(_root + _cwd);
+	compile_dir = Directory(_root + _cwd);
+
+	ObjectCache &store = dcc_header_store();
+	string have(n, '0');
+	for (unsigned i = 0; i < n; ++i)
+	{
+		string path = _root + names[i];
+		make_dirs(path.substr(0, path.rfind('/')));
+
+		int status;
+		bool got = !!store && digests[i].length() == 2 * Digest::size
+			&& store.fetch(digests[i], status, File(path), File(), dcc_fd(-1, 0), dcc_fd(-1, 0));
+		if (!!store)
+			dcc_metrics_cache(DCC_METRIC_HEADER_CACHE, got);
+		if (got)
+			have[i] = '1';
+	}
+
+	if ((ret = dcc_x_token_string(out_fd, "FHAV", have)))
+		return ret;
+	tcp_cork_sock(out_fd, 0);
+	tcp_cork_sock(out_fd, 1);
+
+	unsigned received = 0;
+	for (unsigned i = 0; i < n; ++i)
+	{
+		if (have[i] == '1')
+			continue;
+
+		File file(_root + names[i]);
+		unsigned size;
+		if ((ret = dcc_r_token_file(in_fd, "FILE", file, size, compr)))
+			return ret;
+		++received;
+
+		// Only keep what really has the digest the client claimed
+		if (!!store && digests[i].length() == 2 * Digest::size)
+		{
+			if (dcc_hash_file(file) == digests[i])
+				store.store(digests[i], 0, file, File(), File(), File());
+			else
+				rs_log_warning("%s does not match its digest %s", +names[i], +digests[i]);
+		}
+	}
+
+	rs_trace("mirrored %u files in %s, %u of them sent", n, +_root, received);
+	return 0;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// @p path as the compiler should see it, and if it names a directory, make that, so that
+// the compiler doesn't warn about a missing one
+
+string MirrorRoot::root_path(const string &path, bool is_dir) const
+{
+	string full = path[0] == '/' ? path : _cwd + "/" + path;
+	if (is_dir && dcc_path_stays_inside(full))
+		make_dirs(_root + full);
+	return path[0] == '/' ? _root + path : path;
+}
+
+//---------------------------------------------------------------------------------------------
+
+void MirrorRoot::root_args(Arguments &args) const
+{
+	const OptionTable &options = dcc_compiler->options();
+
+	Arguments::Iterator i = args;
+	for (++i; !!i; ++i)
+	{
+		if (*i == args.input_file)
+		{
+			*i = root_path(*i, false);
+			continue;
+		}
+
+		const CompilerOption *opt = options.find(*i);
+		if (!opt || !opt->is(CompilerOption::Opt_Path))
+			continue;
+
+		string name = opt->name;
+		bool is_dir = name != "-include" && name != "-imacros";
+		if (!opt->separate(*i))
+			*i = name + root_path(opt->value(*i), is_dir);
+		else if (!!(++i))
+			*i = root_path(*i, is_dir);
+		else
+			break;
+	}
+
+	// The compiler's directory goes into the debugging information, and the headers' paths
+	// into __FILE__ (which gcc can only be told about from version 8)
+	args << "-fdebug-prefix-map=" + _root + "=";
+	if (atoi(+dcc_toolchain_fingerprint(args[0])) >= 8)
+		args << "-fmacro-prefix-map=" + _root + "=";
+
+	args.trace("mirrored command");
+}
+
+//---------------------------------------------------------------------------------------------
+
+void MirrorRoot::unroot_file(const File &file) const
+{
+	if (_root.empty() || !file)
+		return;
+
+	FILE *f = fopen(+file.path(), "rb");
+	if (!f)
+		return;
+	string s;
+	char buf[65536];
+	size_t len;
+	while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+		s.append(buf, len);
+	fclose(f);
+
+	size_t at = s.find(_root);
+	if (at == string::npos)
+		return;
+	for (; at != string::npos; at = s.find(_root, at))
+		s.erase(at, _root.length());
+
+	// The messages are appended to (O_APPEND), so they can be rewritten in place
+	int fd = open(+file.path(), O_WRONLY|O_TRUNC|O_BINARY);
+	if (fd == -1 || write(fd, s.data(), s.size()) != (ssize_t) s.size())
+		rs_log_warning("failed to rewrite %s: %s", +file.path(), strerror(errno));
+	if (fd != -1)
+		close(fd);
+}
+
+//---------------------------------------------------------------------------------------------
+
+void MirrorRoot::unroot(OutputCapture &capture) const
+{
+	if (capture.spilled())
+		unroot_file(capture.file());
+	else
+		capture.erase(_root);
+}
+
+//---------------------------------------------------------------------------------------------
+
+void MirrorRoot::remove()
+{
+	if (_root.empty())
+		return;
+
+	if (!dcc_getenv_bool("DISTCC_SAVE_TEMPS", 0)
+		&& nftw(+_root, dcc_remove_entry, 16, FTW_DEPTH | FTW_PHYS) == -1)
+	{
+		rs_log_warning("failed to remove %s: %s", +_root, strerror(errno));
+	}
+	_root = "";
+}
+
+//---------------------------------------------------------------------------------------------
+
+#else // ! __linux__
+
+int MirrorRoot::receive(fd_t in_fd, fd_t out_fd, Directory &compile_dir, enum dcc_compress compr)
+{
+	rs_log_error("jobs can't be preprocessed on this platform");
+	return EXIT_DISTCC_FAILED;
+}
+
+void MirrorRoot::root_args(Arguments &args) const
+{
+}
+
+void MirrorRoot::unroot_file(const File &file) const
+{
+}
+
+void MirrorRoot::unroot(OutputCapture &capture) const
+{
+}
+
+void MirrorRoot::remove()
+{
+}
+
+#endif // ! __linux__
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
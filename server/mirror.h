@@ -0,0 +1,69 @@
+
+#ifndef _distcc_server_mirror_h_
+#define _distcc_server_mirror_h_
+
+#include <string>
+
+#include "common/distcc.h"
+#include "common/arg.h"
+
+#include "rvfc/filesys/defs.h"
+
+namespace distcc
+{
+
+using std::string;
+using rvfc::File;
+using rvfc::Directory;
+
+class OutputCapture;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+// Jobs the client doesn't preprocess (CMD_FLAGS_PUMP, host option "pump").
+//
+// After ARGV, and the compiler if it's checked, the client sends CDIR, its working directory,
+// and NFIL n, followed by NAME and FDIG for each of the n files the compiler may read: the
+// source and the headers, by absolute path, with the digests of their contents.  We answer
+// FHAV, a '1' or a '0' for each file by whether we still have its contents from an earlier
+// job (--header-cache), and the client then sends those we lack, each as FILE.
+//
+// The files are put at the same paths under a directory of the job's own, and the compiler
+// is run there, in the client's working directory, with the absolute paths in its arguments
+// moved under the directory too.  What it writes that names files (messages, dependencies)
+// has the directory taken out again.
+
+class MirrorRoot
+{
+	string _root, _cwd;
+
+	void make_dirs(const string &dir) const;
+	string root_path(const string &path, bool is_dir) const;
+
+public:
+	~MirrorRoot() { remove(); }
+
+	bool operator!() const { return _root.empty(); }
+
+	// Make the directory and read the client's files into it.  @p compile_dir is set to the
+	// client's working directory there.
+	int receive(fd_t in_fd, fd_t out_fd, Directory &compile_dir, enum dcc_compress compr);
+
+	// Move the input and the paths of options like -I and -include under the directory, and
+	// have the compiler take it out of what it records in the object
+	void root_args(Arguments &args) const;
+
+	// Take the directory out of the names in @p file
+	void unroot_file(const File &file) const;
+
+	// ... or in what the compiler printed, going to the file only if the output is in one
+	void unroot(OutputCapture &capture) const;
+
+	void remove();
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
+
+#endif // _distcc_server_mirror_h_
@@ -30,10 +30,12 @@
 
 #ifdef __linux__
 #include <unistd.h>
+#include <sched.h>
 #include <syslog.h>
 #include <sys/wait.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/select.h>
 #endif
 
 #include <stdio.h>
@@ -42,10 +44,13 @@
 #include <errno.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <time.h>
 
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <algorithm>
+
 #include "exitcode.h"
 #include "distcc.h"
 #include "trace.h"
@@ -55,6 +60,8 @@
 #include "srvnet.h"
 #include "types.h"
 #include "daemon.h"
+#include "netutil.h"
+#include "metrics.h"
 #include "lzo/minilzo.h"
 
 #include "rvfc/defs.h"
@@ -66,13 +73,9 @@ using namespace rvfc;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
-// TODO:
-// It might be nice if killing a child, or dropping the socket caused its compiler to be killed too.  
-// This would probably require running the compiler in a separate process group, and 
-// remembering to kill it when the child is signalled.
-// I can only think of a few cases where this would be a big deal: 
-// a runaway compiler, where you probably can just manually kill that process, and a client 
-// interrupt, in which case allowing the compiler to run to completion is not such a big deal.
+// Each compiler runs in a process group of its own.  When the client drops the connection 
+// while it's running, or the child is signalled, the whole group is killed, so an 
+// interrupted build doesn't leave compilers running on the server.
 
 //---------------------------------------------------------------------------------------------
 
@@ -81,22 +84,46 @@ UINT32 ticks_accept, ticks_spawn, ticks_collect, ticks_endsend, ticks_close, tim
 
 //---------------------------------------------------------------------------------------------
 
+// Pause between starting workers, so as not to overwhelm a machine that's having trouble.
+// The rate is set by --spawn-rate.
+
+static void dcc_spawn_pause()
+{
+	if (arg_spawn_rate <= 0)
+		return;
+#ifdef _WIN32
+	Sleep(1000 / arg_spawn_rate);
+#else
+	usleep(1000000 / arg_spawn_rate);
+#endif
+}
+
+//---------------------------------------------------------------------------------------------
+
 // Main loop for the parent process with the new preforked implementation.
 // The parent is just responsible for keeping a pool of children and they
 // accept connections themselves.
+//
+// Workers that are about to retire don't count towards the pool, so their replacements 
+// are started while they're still finishing their last job.
 
 void
 StandaloneServer::preforking_parent()
 {
 	dcc_log_daemon_started("preforking daemon");
 
+#ifndef _WIN32
+	setup_retire_pipe();
+#endif
+
 	while (!dcc_term_flag)
 	{
 #ifndef _WIN32
         pid_t kid;
+		while (dcc_nkids - (int) retiring_kids.size() < dcc_max_workers && !dcc_term_flag)
+#else
+		while (dcc_nkids < dcc_max_workers && !dcc_term_flag)
 #endif
-
-		while (dcc_nkids < dcc_max_kids && !dcc_term_flag)
 		{
 #ifdef _WIN32
 			try
@@ -112,6 +139,7 @@ StandaloneServer::preforking_parent()
 			}
 
 #else // ! _WIN32
+            int shard = pick_shard();
             if ((kid = fork()) == -1) 
 			{
 				rs_log_error("StandaloneServer: fork failed");
@@ -120,35 +148,197 @@ StandaloneServer::preforking_parent()
 			if (kid == 0)
 			{
 				// in child
-				WorkerProcess worker(listen_fd);
+				dcc_start_log_buffer();
+				close(retire_pipe[0]);
+				if (metrics_fd != -1)
+					close(metrics_fd);
+				if (shard != -1 && opt_pin_shards)
+					pin_to_shard(shard);
+				WorkerProcess worker(shard == -1 ? listen_fd : shard_fds[shard], retire_pipe[1]);
 				worker.run();
 				dcc_exit(0);
 			}
+			if (shard != -1)
+			{
+				kid_shard[kid] = shard;
+				++shard_kids[shard];
+			}
 
 #endif // ! _WIN32
 
 			++dcc_nkids;
 			rs_trace("up to %d children", dcc_nkids);
 
-			// Don't start them too quickly, or we might overwhelm a machine that's having trouble
-			sleep(1);
+			dcc_spawn_pause();
 
 			reap_kids(false);
 		}
 
+#ifdef _WIN32
         // wait for any children to exit, and then start some more
 		reap_kids(true);
 
         // Another little safety brake here: since children should not exit
         // too quickly, pausing before starting them should be harmless.
         sleep(1);
+#else
+		// wait for children to retire or exit, and then start some more
+		wait_for_kids();
+#endif
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
+#ifndef _WIN32
+
+void
+StandaloneServer::setup_retire_pipe()
+{
+	if (pipe(retire_pipe) == -1)
+	{
+		rs_log_error("failed to create pipe: %s", strerror(errno));
+		throw std::runtime_error("StandaloneServer: pipe failed");
+	}
+
+	// neither end should leak into the compilers
+	set_cloexec_flag(retire_pipe[0], 1);
+	set_cloexec_flag(retire_pipe[1], 1);
+	dcc_set_nonblocking(retire_pipe[0]);
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Read the retirement notices that workers have sent so far.
+// A worker sends its notice before it exits, so this must be done again after reaping it,
+// before it's taken out of retiring_kids.
+
+void
+StandaloneServer::collect_retirements()
+{
+	if (retire_pipe[0] == -1)
+		return;
+
+	// Each notice is a single pid, which the pipe delivers atomically
+	pid_t pids[64];
+	ssize_t n;
+	while ((n = read(retire_pipe[0], pids, sizeof(pids))) > 0)
+	{
+		for (int i = 0; i < n / (ssize_t) sizeof(pid_t); ++i)
+		{
+			retiring_kids.insert(pids[i]);
+			release_shard(pids[i]);
+			rs_trace("child %d is retiring", (int) pids[i]);
+		}
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Wait until a worker announces its retirement, or at most a second, and collect any 
+// children that have exited meanwhile.  Metrics are served while waiting.
+
+void
+StandaloneServer::wait_for_kids()
+{
+	fd_set fds;
+	FD_ZERO(&fds);
+	FD_SET(retire_pipe[0], &fds);
+	if (metrics_fd != -1)
+		FD_SET(metrics_fd, &fds);
+	struct timeval timeout = { 1, 0 };
+
+	int n = select(std::max(retire_pipe[0], metrics_fd) + 1, &fds, NULL, NULL, &timeout);
+	if (n == -1 && errno != EINTR)
+	{
+		rs_log_error("select failed: %s", strerror(errno));
+		sleep(1);
+	}
+	else if (n > 0 && metrics_fd != -1 && FD_ISSET(metrics_fd, &fds))
+	{
+		dcc_metrics_answer(metrics_fd);
+	}
+
+	reap_kids(false);
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Choose the listening socket for a new worker: the one with the fewest workers.
+// Returns -1 if all workers share a single socket.
+
+int
+StandaloneServer::pick_shard() const
+{
+	if (shard_fds.empty())
+		return -1;
+
+	int shard = 0;
+	for (int i = 1; i < (int) shard_kids.size(); ++i)
+		if (shard_kids[i] < shard_kids[shard])
+			shard = i;
+	return shard;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// A worker retired or exited: its socket may take another one.  
+// Safe to call more than once for the same worker.
+
+void
+StandaloneServer::release_shard(pid_t kid)
+{
+	std::map<pid_t, int>::iterator i = kid_shard.find(kid);
+	if (i == kid_shard.end())
+		return;
+
+	--shard_kids[i->second];
+	kid_shard.erase(i);
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Called in a new worker: bind it to the group of CPUs that belongs to its socket.
+// The CPUs are split evenly among the sockets; with more sockets than CPUs, they wrap around.
+// Compilers started by the worker inherit its affinity.
+
+void
+StandaloneServer::pin_to_shard(int shard) const
+{
+	int n_shards = shard_fds.size();
+	if (n_cpus < 1)
+		return;
+
+	int first, count;
+	if (n_shards >= n_cpus)
+	{
+		first = shard % n_cpus;
+		count = 1;
+	}
+	else
+	{
+		first = shard * n_cpus / n_shards;
+		count = (shard + 1) * n_cpus / n_shards - first;
 	}
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	for (int cpu = first; cpu < first + count; ++cpu)
+		CPU_SET(cpu, &cpus);
+
+	if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1)
+		rs_log_warning("failed to pin worker to CPUs %d-%d: %s", first, first + count - 1, strerror(errno));
+	else
+		rs_trace("pinned to CPUs %d-%d", first, first + count - 1);
 }
 
+#endif // ! _WIN32
+
 //---------------------------------------------------------------------------------------------
 
 // Fork a child to repeatedly accept and handle incoming connections.
-// To protect against leaks, we quit after 50 requests and let the parent recreate us.
+// To protect against leaks, we quit according to the recycling policy (by default after 
+// 50 requests) and let the parent recreate us.
 // (prev. dcc_preforked_child())
 
 #if defined(_WIN32)
@@ -202,19 +392,116 @@ WorkerProcess::run()
 
 //---------------------------------------------------------------------------------------------
 
-WorkerProcess::WorkerProcess(int listenFd) : listen_fd(listenFd)
+WorkerProcess::WorkerProcess(int listenFd, int retireFd) : listen_fd(listenFd), retire_fd(retireFd)
 {
 	dcc_term_flag = false;
+	born = time(NULL);
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Resident size of this process, in kB
+
+static long dcc_worker_rss()
+{
+	long pages_total, pages_resident;
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (!f)
+		return 0;
+	int n = fscanf(f, "%ld %ld", &pages_total, &pages_resident);
+	fclose(f);
+	if (n != 2)
+		return 0;
+	return pages_resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Check the recycling policy (--worker-requests, --worker-rss, --worker-age), 
+// given that we've accepted @p nreq requests so far.
+
+bool WorkerProcess::worn_out(int nreq, const char *&why) const
+{
+	if (arg_worker_requests && nreq >= arg_worker_requests)
+	{
+		why = "served enough requests";
+		return true;
+	}
+
+	if (arg_worker_age && time(NULL) - born >= arg_worker_age)
+	{
+		why = "too old";
+		return true;
+	}
+
+	if (arg_worker_rss && dcc_worker_rss() > (long) arg_worker_rss * 1024)
+	{
+		why = "too big";
+		return true;
+	}
+
+	return false;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Tell the parent we won't accept any more connections, so it can start our replacement.
+
+void WorkerProcess::retire(const char *why)
+{
+	rs_log_info("worn out (%s)", why);
+
+	pid_t pid = getpid();
+	if (write(retire_fd, &pid, sizeof(pid)) != sizeof(pid))
+		rs_log_warning("failed to notify parent of retirement: %s", strerror(errno));
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Wait for a connection to come in, but not beyond our maximum age.
+// Returns false if we got too old waiting.
+
+bool WorkerProcess::wait_for_connection()
+{
+	if (!arg_worker_age)
+		return true;
+
+	for (;;)
+	{
+		long left = born + arg_worker_age - time(NULL);
+		if (left <= 0)
+			return false;
+
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(listen_fd, &fds);
+		struct timeval timeout = { left, 0 };
+
+		int rc = select(listen_fd + 1, &fds, NULL, NULL, &timeout);
+		if (rc > 0)
+			return true;
+		if (rc == -1 && errno != EINTR)
+		{
+			rs_log_error("select failed: %s", strerror(errno));
+			return true; // let accept() sort it out
+		}
+	}
 }
 
 //---------------------------------------------------------------------------------------------
 
 void WorkerProcess::run()
 {
-	const int child_lifetime = 50;
+	const char *why;
 
-	for (int ireq = 0; ireq < child_lifetime; ireq++) 
+	for (int ireq = 0; ; ireq++) 
 	{
+		if (!wait_for_connection())
+		{
+			retire("too old");
+			break;
+		}
+
 		int acc_fd;
 		fd_t _acc_fd;
 		struct dcc_sockaddr_storage cli_addr;
@@ -230,13 +517,26 @@ void WorkerProcess::run()
 			dcc_exit(EXIT_CONNECT_FAILED);
 		}
 
+		// If this is our last job, have the replacement started while we serve it
+		bool last = worn_out(ireq + 1, why);
+		if (last)
+			retire(why);
+
 		_acc_fd = dcc_fd(acc_fd, 1);
 		dcc_service_job(_acc_fd, _acc_fd, (struct sockaddr *) &cli_addr, cli_len);
 
 		dcc_close(_acc_fd);
-	}
 
-	rs_log_info("worn out");
+		if (last)
+			break;
+
+		// Growth (or age) may only show after the job
+		if (worn_out(ireq + 1, why))
+		{
+			retire(why);
+			break;
+		}
+	}
 }
 
 //---------------------------------------------------------------------------------------------
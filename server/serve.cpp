@@ -61,6 +61,7 @@
 #include <sys/param.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
+#include <sys/statvfs.h>
 #endif
 
 #include <stdio.h>
@@ -70,6 +71,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <signal.h>
+#include <time.h>
 #ifdef _WIN32
 #include <io.h>
 #endif
@@ -87,13 +89,29 @@
 #include "common/exec.h"
 #include "common/hosts.h"
 #include "common/compiler.h"
+#include "common/timeval.h"
+#include "common/hash.h"
+#include "common/objcache.h"
+#include "common/timeline.h"
+#include "common/toolchain.h"
 
 #include "server/dopt.h"
 #include "server/srvnet.h"
 #include "server/daemon.h"
+#include "server/admit.h"
+#include "server/affinity.h"
+#include "server/capture.h"
+#include "server/usage.h"
+#include "server/metrics.h"
+#include "server/toolenv.h"
+#include "server/mirror.h"
 
 #include "rvfc/text/defs.h"
 
+#include <set>
+#include <map>
+#include <vector>
+
 namespace distcc
 {
 
@@ -103,33 +121,38 @@ using namespace rvfc::Text;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////
 
-// We copy all serious distccd messages to this file, as well as sending the
-// compiler errors there, so they're visible to the client.
+// We copy all serious distccd messages to the compiler's error output, 
+// so they're visible to the client.
 
-static fd_t dcc_compile_log_fd = { -1, 0 };
+static OutputCapture *dcc_compile_log = 0;
 
 //---------------------------------------------------------------------------------------------
-// Copy all server messages to the error file, so that they can be echoed back to the client if necessary
+
+static void
+rs_logger_capture(int flags, const char *file, int line, char const *fmt, va_list va,
+	void *private_ptr, int)
+{
+	char buf[4096];
+	rs_format_msg(buf, sizeof(buf) - 1, flags, file, line, fmt, va);
+	strcat(buf, "\n");
+	((OutputCapture *) private_ptr)->append(buf, strlen(buf));
+}
+
+//---------------------------------------------------------------------------------------------
+// Copy all server messages to the error output, so that they can be echoed back to the client if necessary
 
 static int 
-dcc_add_log_to_file(const File &err_file)
+dcc_add_log_to_capture(OutputCapture &err)
 {
-	const char *err_fname = +err_file.path();
-	if (dcc_compile_log_fd.fd != -1) 
+	if (dcc_compile_log) 
 	{
 		rs_log_crit("compile log already open?");
 		return 0; // continue?
 	}
 
-	dcc_compile_log_fd.fd = open(err_fname, O_WRONLY|O_CREAT|O_TRUNC, 0600);
-	if (dcc_compile_log_fd.fd == -1) 
-	{
-		rs_log_error("failed to open %s: %s", err_fname, strerror(errno));
-		return EXIT_IO_ERROR;
-	}
-
 	// Only send fairly serious errors back
-	rs_add_logger(rs_logger_file, RS_LOG_WARNING, NULL, dcc_compile_log_fd.fd);
+	dcc_compile_log = &err;
+	rs_add_logger(rs_logger_capture, RS_LOG_WARNING, dcc_compile_log, 0);
 
 	return 0;
 }
@@ -137,20 +160,18 @@ dcc_add_log_to_file(const File &err_file)
 //---------------------------------------------------------------------------------------------
 
 static int 
-dcc_remove_log_to_file()
+dcc_remove_log_to_capture()
 {
-	if (dcc_compile_log_fd.fd == -1) 
+	if (!dcc_compile_log) 
 	{
 		rs_log_warning("compile log not open?");
 		return 0; // continue?
 	}
 
-	// must exactly match call in dcc_add_log_to_file
-	rs_remove_logger(rs_logger_file, RS_LOG_WARNING, NULL, dcc_compile_log_fd.fd);
+	// must exactly match call in dcc_add_log_to_capture
+	rs_remove_logger(rs_logger_capture, RS_LOG_WARNING, dcc_compile_log, 0);
 
-	dcc_close(dcc_compile_log_fd);
-
-	dcc_compile_log_fd.fd = -1;
+	dcc_compile_log = 0;
 
 	return 0;
 }
@@ -168,10 +189,20 @@ public:
 	int result() { return ret; }
 
 	int error, ret;
-	File err_fname, out_fname;
-	text view_name, session_name;
+	bool admitted;
+
+	// for the metrics
+	enum dcc_job_outcome outcome;
+	enum dcc_compress compr;
+
+	// the compiler's stderr (with our own messages) and stdout
+	OutputCapture err, out;
+	text view_name, session_name, job_id, toolchain;
 	Directory compile_dir;
 
+	// where a job preprocessed here finds its files
+	MirrorRoot mirror;
+
 	File pdb_fname, dotd_fname, orig_input, orig_output;
 };
 
@@ -189,6 +220,7 @@ dcc_service_job(fd_t in_fd, fd_t out_fd, struct sockaddr *cli_addr, int cli_len)
 	if (dcc_check_client(cli_addr, cli_len, opt_allowed))
 		return EXIT_ACCESS_DENIED;
 
+	dcc_metrics_job_begin();
 	CompilationJob job;
 	try
 	{
@@ -198,6 +230,7 @@ dcc_service_job(fd_t in_fd, fd_t out_fd, struct sockaddr *cli_addr, int cli_len)
 	{
 		rs_trace("compilation job failed: %s", x);
 	}
+	dcc_metrics_job_end(job.outcome, job.compr, out_fd);
 
 	return job.result();
 }
@@ -222,21 +255,16 @@ static File dcc_input_tmpnam(const Compiler &compiler, const string &orig_input)
 // ccache client that does nothing, so it's not a big deal.  
 // (This could be easy to do if it's on the default PATH and they start the daemon from the command line.)
 //
-// At the moment we don't look for the compiler too.
+// @p searched receives each directory looked at, with its modification time, so the result can be 
+// revalidated later without searching again.
 
-static int 
-dcc_check_compiler_masq(const text &compiler_name)
-{
-	if (compiler_name[0] == '/') 
-		return 0;
-	
-	const char *envpath = getenv("PATH");
-	if (!envpath) 
-	{
-		rs_trace("PATH seems not to be defined");
-		return 0;
-	}
+#ifndef _WIN32
+
+typedef std::vector<std::pair<string, time_t> > SearchedDirs;
 
+static string
+dcc_search_compiler(const text &compiler_name, const char *envpath, SearchedDirs &searched)
+{
 	string buf;
 	const char *n, *p;
 	for (n = p = envpath; *n; p = n) 
@@ -251,43 +279,417 @@ dcc_check_compiler_masq(const text &compiler_name)
 			n = p + len;
 		}
 
-		buf = stringf("%.*s/%s", len, p, +compiler_name);
-
-#ifndef _WIN32
+		string dir(p, len);
 		struct stat sb;
+		searched.push_back(std::make_pair(dir, stat(dir.c_str(), &sb) ? 0 : sb.st_mtime));
+
+		buf = stringf("%s/%s", dir.c_str(), +compiler_name);
+
 		char linkbuf[MAXPATHLEN];
 
-		if (lstat(buf, &sb) == -1)
+		if (lstat(buf.c_str(), &sb) == -1)
 			continue; // ENOENT, EACCESS, etc
+
+		// execvp would pass over anything it can't run, and so do we
+		struct stat target;
+		if (stat(buf.c_str(), &target) == -1 || !S_ISREG(target.st_mode) || access(buf.c_str(), X_OK) == -1)
+		{
+			rs_trace("%s is not an executable file", buf.c_str());
+			continue;
+		}
+
 		if (!S_ISLNK(sb.st_mode)) 
 		{
-			rs_trace("%s is not a symlink", buf);
-			break; // found it
+			rs_trace("%s is not a symlink", buf.c_str());
+			return buf; // found it
 		}
 
-		if ((len = readlink(buf, linkbuf, sizeof linkbuf)) <= 0)
+		if ((len = readlink(buf.c_str(), linkbuf, sizeof linkbuf - 1)) <= 0)
 			continue;
 		linkbuf[len] = '\0';
 		
 		if (strstr(linkbuf, "distcc")) 
 		{
 			rs_log_warning("%s on distccd's path is %s and really a link to %s",
-				compiler_name, buf, linkbuf);
-			break; // but use it anyhow
+				+compiler_name, buf.c_str(), linkbuf);
+			return buf; // but use it anyhow
 		}
 		else 
 		{
-			rs_trace("%s is a safe symlink to %s", buf, linkbuf);
-			break; // found it
+			rs_trace("%s is a safe symlink to %s", buf.c_str(), linkbuf);
+			return buf; // found it
 		}
+	}
+
+	return "";
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Each worker remembers where it found each compiler, so a busy server doesn't walk the PATH 
+// for every job.  An entry holds as long as none of the directories searched for it has 
+// changed (something installed or removed there), which is checked at most once a second.
+
+struct CompilerLocation
+{
+	string path; // empty if not found
+	SearchedDirs searched;
+	time_t checked;
+};
+
+static std::map<string, CompilerLocation> dcc_compiler_locations;
+
+static bool
+dcc_compiler_location_valid(CompilerLocation &loc)
+{
+	time_t now = time(0);
+	if (now == loc.checked)
+		return true;
+
+	for (SearchedDirs::const_iterator i = loc.searched.begin(); i != loc.searched.end(); ++i)
+	{
+		struct stat sb;
+		if ((stat(i->first.c_str(), &sb) ? 0 : sb.st_mtime) != i->second)
+			return false;
+	}
+
+	loc.checked = now;
+	return true;
+}
+
+#endif // _WIN32
+
+//---------------------------------------------------------------------------------------------
+
+// Replaces @p compiler_name with its absolute path, so it's executed without searching the PATH again
+
+static int 
+dcc_check_compiler_masq(text &compiler_name)
+{
+	if (compiler_name[0] == '/' || strchr(+compiler_name, '/')) 
+		return 0;
+	
+	const char *envpath = getenv("PATH");
+	if (!envpath) 
+	{
+		rs_trace("PATH seems not to be defined");
+		return 0;
+	}
+
+#ifndef _WIN32
+	string key = string(compiler_name) + '\0' + envpath;
+	CompilerLocation &loc = dcc_compiler_locations[key];
+	if (loc.searched.empty() || !dcc_compiler_location_valid(loc))
+	{
+		loc.searched.clear();
+		loc.path = dcc_search_compiler(compiler_name, envpath, loc.searched);
+		loc.checked = time(0);
+	}
+
+	// A relative directory on the PATH would mean something else in the compiler's working directory
+	if (!loc.path.empty() && loc.path[0] == '/')
+		compiler_name = loc.path;
 #endif // _WIN32
+
+	return 0;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// The compilation cache is opened by each worker when it gets its first job
+
+static ObjectCache &dcc_server_cache()
+{
+	static ObjectCache *cache = 0;
+	if (!cache)
+	{
+		Directory dir(arg_cache_dir ? string(arg_cache_dir) : dcc_get_tmp_top() + "/distccd-cache");
+		cache = new ObjectCache(dir, (unsigned long long) arg_cache_size << 20);
+	}
+	return *cache;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Sources received from clients, by digest.  Each entry is an ObjectCache entry holding just 
+// the "object", kept in a subdirectory of the compilation cache.
+
+static ObjectCache &dcc_input_store()
+{
+	static ObjectCache *store = 0;
+	if (!store)
+	{
+		string top = arg_cache_dir ? string(arg_cache_dir) : dcc_get_tmp_top() + "/distccd-cache";
+		if (arg_input_cache_size)
+			mkdir(+top, 0777);
+		store = new ObjectCache(Directory(top + "/inputs"), (unsigned long long) arg_input_cache_size << 20);
+	}
+	return *store;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static bool dcc_is_digest(const string &s)
+{
+	return s.length() == 2 * Digest::size && s.find_first_not_of("0123456789abcdef") == string::npos;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Receive the preprocessed source into temp_i.  If the client offered its digest first,
+// tell it whether we still have the source from an earlier job, and only read it if not.
+
+static int 
+dcc_r_input(fd_t in_fd, fd_t out_fd, unsigned cmd_flags, File &temp_i, enum dcc_compress compr)
+{
+	int ret;
+	string digest;
+	if (cmd_flags & CMD_FLAGS_DOTI_DIGEST)
+	{
+		if ((ret = dcc_r_token_string(in_fd, "DIGI", digest)))
+			return ret;
+
+		int status;
+		bool have = dcc_is_digest(digest) 
+			&& dcc_input_store().fetch(digest, status, temp_i, File(), dcc_fd(-1, 0), dcc_fd(-1, 0));
+		if (!!dcc_input_store())
+			dcc_metrics_cache(DCC_METRIC_INPUT_CACHE, have);
+		if ((ret = dcc_x_have_input(out_fd, have)))
+			return ret;
+		tcp_cork_sock(out_fd, 0);
+		tcp_cork_sock(out_fd, 1);
+		if (have)
+		{
+			rs_trace("input %s already here", +digest);
+			return 0;
+		}
 	}
 
+	unsigned int size_i;
+	if ((ret = dcc_r_token_file(in_fd, "DOTI", temp_i, size_i, compr)))
+		return ret;
+
+	// Only keep what really has the digest the client claimed
+	if (dcc_is_digest(digest) && !!dcc_input_store())
+	{
+		if (dcc_hash_file(temp_i) == digest)
+			dcc_input_store().store(digest, 0, temp_i, File(), File(), File());
+		else
+			rs_log_warning("input does not match its digest %s", +digest);
+	}
 	return 0;
 }
 
 //---------------------------------------------------------------------------------------------
 
+static void dcc_replace_all(string &s, const string &from, const string &to)
+{
+	if (from.empty())
+		return;
+	for (size_t i = 0; (i = s.find(from, i)) != string::npos; i += to.length())
+		s.replace(i, from.length(), to);
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Cache key of a job: the preprocessed source, the final command line and the compiler.
+// The command line refers to our temporary files, whose names differ on every run,
+// so they are replaced by fixed placeholders before hashing.
+
+static string dcc_job_cache_key(const Arguments &args, const File &temp_i, const File &temp_o, 
+	const File &temp_d)
+{
+	string compiler = dcc_compiler_fingerprint(args[0]);
+	if (compiler.empty())
+		return "";
+
+	Digest digest;
+	digest.update_field("distccd-cache-1");
+	digest.update_field(compiler);
+	for (Arguments::ConstIterator i = args.begin(); !!i; ++i)
+	{
+		string arg = *i;
+		dcc_replace_all(arg, temp_i.path(), "@I@");
+		dcc_replace_all(arg, temp_o.path(), "@O@");
+		dcc_replace_all(arg, temp_d.path(), "@D@");
+		digest.update_field(arg);
+	}
+	if (!digest.update_file(temp_i))
+		return "";
+	return digest.hex();
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Take a job's results from the cache, as if the compiler had just produced them
+
+static bool dcc_job_from_cache(const string &key, int &status, const File &temp_o, const File &temp_d,
+	const File &err_fname, const File &out_fname)
+{
+	fd_t err_fd = { open(+err_fname.path(), O_WRONLY|O_CREAT|O_APPEND|O_BINARY, 0600), 0 };
+	fd_t out_fd = { open(+out_fname.path(), O_WRONLY|O_CREAT|O_TRUNC|O_BINARY, 0600), 0 };
+
+	bool hit = err_fd.fd != -1 && out_fd.fd != -1
+		&& dcc_server_cache().fetch(key, status, temp_o, temp_d, err_fd, out_fd);
+
+	if (err_fd.fd != -1)
+		close(err_fd.fd);
+	if (out_fd.fd != -1)
+		close(out_fd.fd);
+	return hit;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Put the temporary files of the next job in memory if the tmpfs has room for it, 
+// and on disk otherwise.  A compiler running out of space would fail the job, 
+// so we only go to memory while a comfortable amount is free.
+
+static void dcc_choose_workspace()
+{
+#ifdef __linux__
+	static const char *mem_dir = "/dev/shm/distccd";
+	static bool usable = true;
+
+	if (!arg_mem_workspace || !usable)
+		return;
+
+	// The name is known to everyone, so it's only used if it's a directory of ours that nobody 
+	// else may enter; the sticky /dev/shm keeps it that way once checked
+	static bool checked = false;
+	if (!checked)
+	{
+		struct stat sb;
+		if ((mkdir(mem_dir, 0700) == -1 && errno != EEXIST) || lstat(mem_dir, &sb) == -1)
+		{
+			rs_log_warning("can't use %s for job files: %s", mem_dir, strerror(errno));
+			usable = false;
+		}
+		else if (!S_ISDIR(sb.st_mode) || sb.st_uid != geteuid() || (sb.st_mode & 0777) != 0700)
+		{
+			rs_log_error("not using %s for job files: it is not a directory private to uid %d", 
+				mem_dir, (int) geteuid());
+			usable = false;
+		}
+		checked = true;
+	}
+
+	struct statvfs st;
+	if (!usable || statvfs(mem_dir, &st) == -1)
+	{
+		if (usable)
+			rs_log_warning("can't use %s for job files: %s", mem_dir, strerror(errno));
+		usable = false;
+		dcc_set_workspace("");
+		return;
+	}
+
+	unsigned long long avail = (unsigned long long) st.f_bavail * st.f_frsize;
+	bool room = avail >= (unsigned long long) arg_mem_workspace << 20;
+	if (!room)
+		rs_trace("only %llu MB free in %s: job files go to disk", avail >> 20, mem_dir);
+	dcc_set_workspace(room ? mem_dir : "");
+#endif // __linux__
+}
+
+//---------------------------------------------------------------------------------------------
+
+#ifdef __linux__
+
+// Compilers that turned out not to read their input from a fifo after all
+static std::set<string> dcc_fifo_refusers;
+
+//---------------------------------------------------------------------------------------------
+
+// Whether to start the compiler before the input has arrived and feed it through a fifo.
+// The caches need the whole input before they can decide anything, and compressed input 
+// is only decompressed once it has all arrived, so none of those can be streamed.
+
+static bool dcc_use_fifo(const Arguments &args, unsigned cmd_flags, enum dcc_compress compr)
+{
+	return !opt_no_fifo
+		&& !(cmd_flags & (CMD_FLAGS_ON_SERVER | CMD_FLAGS_DOTI_DIGEST))
+		&& compr == DCC_COMPRESS_NONE
+		&& !dcc_server_cache()
+		&& dcc_compiler->reads_fifo()
+		&& !dcc_fifo_refusers.count(args[0]);
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Run the compiler on fifo_i while the input is still arriving.  The input is also kept in 
+// temp_i, and if the compiler didn't read all of it from the fifo, it's run again on that.
+// The compiler's output goes to files: we're busy feeding it, so it can't be made to wait for 
+// us to take its output.
+
+static int 
+dcc_compile_from_fifo(fd_t in_fd, fd_t out_fd, Arguments &args, const File &temp_i, const File &fifo_i, 
+	Directory &compile_dir, OutputCapture &out, OutputCapture &err, int &status, JobUsage &usage)
+{
+	int ret;
+	proc_t cc_pid;
+	File devnull(DEV_NULL);
+	File out_fname = out.file(), err_fname = err.file();
+
+	// Let the compiler get going while we wait for the input
+	if ((ret = dcc_spawn_child(args, cc_pid, &compile_dir, &devnull, &out_fname, &err_fname)))
+		cc_pid = proc_t();
+
+	unsigned size_i;
+	bool fed = false;
+	int copy_fd = open(+temp_i.path(), O_WRONLY|O_TRUNC|O_BINARY);
+	if (copy_fd == -1)
+	{
+		rs_log_error("failed to open %s: %s", +temp_i.path(), strerror(errno));
+		ret = EXIT_IO_ERROR;
+	}
+	else
+	{
+		if (!(ret = dcc_r_token_int(in_fd, "DOTI", size_i)))
+			ret = dcc_r_fifo(in_fd, fifo_i.path(), size_i, copy_fd, cc_pid.pid, fed);
+		close(copy_fd);
+	}
+
+	if (!!cc_pid)
+	{
+		// Without all of its input, the compiler would wait forever or produce garbage
+		if (ret || !fed)
+			dcc_kill_child(cc_pid, SIGTERM);
+		else if (!dcc_drain_captures(out, err, out_fd, cc_pid))
+			ret = EXIT_IO_ERROR;
+		int compile_ret;
+		if ((compile_ret = dcc_collect_child(args[0], cc_pid, status, &usage)))
+			status = W_EXITCODE(compile_ret, 0);
+	}
+	if (ret)
+		return ret;
+
+	if (!fed)
+	{
+		// What the first run said is no concern of the client's
+		out.reset();
+		err.reset();
+
+		rs_log_warning("%s did not read its input from a fifo; compiling from a file", +args[0]);
+		dcc_fifo_refusers.insert(args[0]);
+		dcc_compiler->set_input(args, temp_i.path());
+
+		int compile_ret;
+		if (!(compile_ret = dcc_spawn_child(args, cc_pid, &compile_dir, &devnull, &out_fname, &err_fname))
+			&& !dcc_drain_captures(out, err, out_fd, cc_pid))
+		{
+			ret = EXIT_IO_ERROR;
+		}
+		if (compile_ret || (compile_ret = dcc_collect_child(args[0], cc_pid, status, &usage))) 
+			status = W_EXITCODE(compile_ret, 0);
+	}
+	return ret;
+}
+
+#endif // __linux__
+
+//---------------------------------------------------------------------------------------------
+
 #if 0
 
 static bool is_dir_exists(const char *dir)
@@ -310,9 +712,26 @@ static bool is_dir_exists(const char *dir)
 
 //---------------------------------------------------------------------------------------------
 
-CompilationJob::CompilationJob()
+// The phase is counted in the metrics, and put on the timeline under the client's job ID
+
+static void dcc_job_phase(enum dcc_job_phase phase, const struct timeval &start, const struct timeval &end,
+	const string &job_id, const string &input_name)
+{
+	static const char *names[DCC_METRIC_PHASES] = { "Receive", "Queue", "Compile", "Send" };
+
+	dcc_metrics_phase(phase, start, end);
+	if (dcc_timeline_enabled())
+		dcc_timeline_span(names[phase], start, end, job_id, +input_name, "");
+}
+
+//---------------------------------------------------------------------------------------------
+
+CompilationJob::CompilationJob() : err(".stderr"), out(".stdout")
 {
 	error = true;
+	admitted = false;
+	outcome = DCC_JOB_ERROR;
+	compr = DCC_COMPRESS_NONE;
 	log_context = ++serial_log_context;
 }
 
@@ -321,15 +740,22 @@ CompilationJob::CompilationJob()
 
 int CompilationJob::run(fd_t in_fd, fd_t out_fd)
 {
-	File err_fname = dcc_make_tmpnam("distccd", ".stderr");
-	File out_fname = dcc_make_tmpnam("distccd", ".stdout");
-	
-	err_fname.remove();
-	out_fname.remove();
+	struct timeval t_accept, t_phase;
+	gettimeofday(&t_accept, NULL);
+
+	dcc_choose_workspace();
+
+	// so that the compiler and whatever it runs can be killed together
+	dcc_set_child_pgrp(true);
 
-	// Capture any messages relating to this compilation to the same file as
+	// Nothing of the previous job (its shipped compiler's PATH and LD_LIBRARY_PATH, its compile 
+	// slot's CPUs) may reach the tools run before this job's compiler is known
+	dcc_set_child_env(std::vector<string>());
+	dcc_set_child_cpus(std::vector<int>(), -1);
+
+	// Capture any messages relating to this compilation along with the 
 	// compiler errors so that they can all be sent back to the client.
-	dcc_add_log_to_file(err_fname);
+	dcc_add_log_to_capture(err);
 
 	// Ignore SIGPIPE; we consistently check error codes and will see the EPIPE.
 	// Note that it is set back to the default behavior when spawning a child, 
@@ -344,16 +770,101 @@ int CompilationJob::run(fd_t in_fd, fd_t out_fd)
 	unsigned cmd_flags;
 	if ((ret = dcc_r_request_header(in_fd, protover))
 		|| (ret = dcc_r_session_name(in_fd, session_name))
-		|| (ret = dcc_r_flags(in_fd, cmd_flags)))
+		|| (ret = dcc_r_flags(in_fd, cmd_flags))
+		|| ((cmd_flags & CMD_FLAGS_JOB_ID) && (ret = dcc_r_job_id(in_fd, job_id)))
+		|| ((cmd_flags & CMD_FLAGS_TOOLCHAIN) && (ret = dcc_r_toolchain(in_fd, toolchain))))
 	{
 		throw "CompilationJob: error";
 	}
+
+	// Decide right away whether we can take this job, so that a client willing to go 
+	// elsewhere doesn't have to sit in our queue.
+	bool accept_busy = !!(cmd_flags & CMD_FLAGS_ACCEPT_BUSY);
+	unsigned wait_secs;
+	admitted = dcc_admission_enter(accept_busy, wait_secs);
+	if (accept_busy)
+	{
+		if ((ret = dcc_x_admission(out_fd, admitted, wait_secs)))
+			throw "CompilationJob: error";
+		// push the answer out now rather than when the cork times out
+		tcp_cork_sock(out_fd, 0);
+		tcp_cork_sock(out_fd, 1);
+	}
+	if (!admitted)
+	{
+		// Consume the arguments the client has already sent, so that closing the socket
+		// doesn't reset the connection before it has read our answer
+		try
+		{
+			dcc_r_argv(in_fd);
+		}
+		catch (const char *x)
+		{
+		}
+		tcp_cork_sock(out_fd, 0);
+		error = false;
+		outcome = DCC_JOB_BUSY;
+		return ret = EXIT_BUSY;
+	}
 	
 	Arguments args = dcc_r_argv(in_fd);
 
 	bool on_server = !!(cmd_flags & CMD_FLAGS_ON_SERVER);
+	bool pump = !on_server && !!(cmd_flags & CMD_FLAGS_PUMP);
 	dcc_set_compiler(args, 0);
 
+	// Tell the client which compiler we would run: our own, or one it sent us before.
+	// If it isn't the client's, the client may send it now (if we take compilers);
+	// otherwise it goes to another host, and has sent nothing more.
+	ToolchainEnv env;
+	string env_root;
+	if (cmd_flags & CMD_FLAGS_TOOLCHAIN)
+	{
+		bool ship = !!(cmd_flags & CMD_FLAGS_SHIP_TOOLCHAIN);
+		string ours = dcc_toolchain_fingerprint(args[0]);
+		if (ours != toolchain && ship && dcc_find_toolchain_env(toolchain, env, env_root))
+			ours = toolchain;
+		if ((ret = dcc_x_toolchain(out_fd, ours)))
+			throw "CompilationJob: error";
+
+		if (ours != toolchain && ship)
+		{
+			if ((ret = dcc_x_token_int(out_fd, "SHIP", arg_toolchain_dir ? 1 : 0)))
+				throw "CompilationJob: error";
+			if (arg_toolchain_dir)
+			{
+				tcp_cork_sock(out_fd, 0);
+				tcp_cork_sock(out_fd, 1);
+				if ((ret = dcc_r_toolchain_env(in_fd, toolchain, env, env_root)))
+					throw "CompilationJob: error";
+				if (!env_root.empty())
+					ours = toolchain;
+				if ((ret = dcc_x_toolchain(out_fd, ours)))
+					throw "CompilationJob: error";
+			}
+		}
+
+		tcp_cork_sock(out_fd, 0);
+		if (ours != toolchain)
+		{
+			rs_log_info("not compiling with %s: have %s, client has %s",
+				+args[0], ours.empty() ? "(none)" : +ours, +toolchain);
+			error = false;
+			outcome = DCC_JOB_WRONG_TOOLCHAIN;
+			return ret = EXIT_WRONG_TOOLCHAIN;
+		}
+		tcp_cork_sock(out_fd, 1);
+
+		// Run the client's compiler from where it's unpacked
+		if (!env_root.empty())
+			args[0] = env_root + env.driver;
+	}
+	dcc_set_child_env(dcc_toolchain_env_vars(env, env_root));
+
+	// From here on the compiler goes by its absolute path, the name dcc_fifo_refusers knows it by
+	if ((ret = dcc_check_compiler_masq(args[0])))
+		throw "CompilationJob: error";
+
 	try
 	{
 		dcc_compiler->scan_args(args, on_server);
@@ -365,28 +876,55 @@ int CompilationJob::run(fd_t in_fd, fd_t out_fd)
 
 	rs_trace("output file %s", +args.output_file);
 
+	// The client's name for the output tells jobs apart for the estimate of their memory use
+	string job_name = +args.output_file;
+	// and the input's, for the timeline; args will name a temporary file
+	string input_name = args.input_file.basename();
+
 	File temp_o, temp_d, temp_pdb;
 	temp_o = dcc_make_tmpnam("distccd", ".o");
-	if (!!dotd_fname)
+	// A job preprocessed here writes the dependencies the client would have
+	if (!!dotd_fname || (pump && !!args.dotd_file))
 		temp_d = dcc_make_tmpnam("distccd", ".d");
 	if (!!pdb_fname)
 		temp_pdb = dcc_make_tmpnam("distccd", ".pdb");
 
-	enum dcc_compress compr = protover == 2 ? DCC_COMPRESS_LZO1X : DCC_COMPRESS_NONE;
+	compr = protover == 2 ? DCC_COMPRESS_LZO1X : DCC_COMPRESS_NONE;
 
 	view_name = "";
 	compile_dir = Directory();
 
-	if (! (cmd_flags & CMD_FLAGS_ON_SERVER))
+	File temp_i, fifo_i;
+	bool use_fifo = false;
+	if (pump)
 	{
-		File temp_i = dcc_input_tmpnam(*dcc_compiler, args.input_file);
+		if ((ret = mirror.receive(in_fd, out_fd, compile_dir, compr)))
+			throw "CompilationJob: error";
+		mirror.root_args(args);
+	}
+	else if (! (cmd_flags & CMD_FLAGS_ON_SERVER))
+	{
+		temp_i = dcc_input_tmpnam(*dcc_compiler, args.input_file);
 
 		try
 		{
-			unsigned int size_i;
-			if ((ret = dcc_r_token_file(in_fd, "DOTI", temp_i, size_i, compr)))
-				throw "CompilationJob: error";;
-			dcc_compiler->set_input(args, temp_i.path());
+#ifdef __linux__
+			if (dcc_use_fifo(args, cmd_flags, compr))
+			{
+				// The input is read once the compiler is running
+				fifo_i = dcc_input_tmpnam(*dcc_compiler, args.input_file);
+				fifo_i.remove();
+				use_fifo = mkfifo(+fifo_i.path(), 0600) == 0;
+				if (!use_fifo)
+					rs_log_warning("failed to make fifo %s: %s", +fifo_i.path(), strerror(errno));
+			}
+#endif
+			if (use_fifo)
+				dcc_compiler->set_input(args, fifo_i.path());
+			else if ((ret = dcc_r_input(in_fd, out_fd, cmd_flags, temp_i, compr)))
+				throw "CompilationJob: error";
+			else
+				dcc_compiler->set_input(args, temp_i.path());
 		}
 		catch (std::exception &x)
 		{
@@ -403,9 +941,6 @@ int CompilationJob::run(fd_t in_fd, fd_t out_fd)
 	if ((ret = dcc_compiler->set_output(args, temp_o.path(), temp_d.path(), temp_pdb.path())))
 		throw "CompilationJob: error";;
 
-	if ((ret = dcc_check_compiler_masq(args[0])))
-		throw "CompilationJob: error";
-
 	dcc_set_compiler(args, 0);
 
 	if (!!view_name)
@@ -434,11 +969,91 @@ int CompilationJob::run(fd_t in_fd, fd_t out_fd)
 	int compile_ret, status;
 	proc_t cc_pid;
 	File devnull(DEV_NULL);
-	if ((compile_ret = dcc_spawn_child(args, cc_pid, &compile_dir, &devnull, &out_fname, &err_fname))
-		|| (compile_ret = dcc_collect_child(args[0], cc_pid, status))) 
+	struct timeval cc_start, cc_end, cc_time;
+
+	// With a fifo, the input arrives while compiling
+	if (!use_fifo)
 	{
-		// We didn't get around to finding a wait status from the actual compiler
-		status = W_EXITCODE(compile_ret, 0);
+		gettimeofday(&t_phase, NULL);
+		dcc_job_phase(DCC_METRIC_RECEIVE, t_accept, t_phase, job_id, input_name);
+	}
+
+	// stays empty if the result comes from the cache
+	JobUsage usage;
+
+	// Jobs compiled in the client's view or from its headers depend on files that aren't 
+	// in the key, and PDBs accumulate across compilations, so none of those can be cached
+	string cache_key;
+	if (!!dcc_server_cache() && !on_server && !pump && !temp_pdb)
+		cache_key = dcc_job_cache_key(args, temp_i, temp_o, temp_d);
+
+	// The cache deals in files
+	bool cached = !cache_key.empty() && dcc_job_from_cache(cache_key, status, temp_o, temp_d, err.file(), out.file());
+	if (!cache_key.empty())
+		dcc_metrics_cache(DCC_METRIC_OBJECT_CACHE, cached);
+	if (cached)
+	{
+		rs_log_info("%s: result taken from cache", +args.input_file);
+	}
+	else
+	{
+		// Queued jobs have already received their input (unless it's fed through a fifo); 
+		// now wait for a compile slot
+		gettimeofday(&t_phase, NULL);
+		dcc_metrics_waiting(1);
+		dcc_admission_begin_compile(job_name);
+		dcc_metrics_waiting(-1);
+		dcc_metrics_compiling(1);
+		dcc_affinity_for_slot(dcc_admission_slot());
+		gettimeofday(&cc_start, NULL);
+		dcc_job_phase(DCC_METRIC_QUEUE, t_phase, cc_start, job_id, input_name);
+		// The input not arriving, or the client going away while compiling
+		int lost_ret = 0;
+#ifdef __linux__
+		if (use_fifo)
+			lost_ret = dcc_compile_from_fifo(in_fd, out_fd, args, temp_i, fifo_i, compile_dir, out, err, status, usage);
+		else
+#endif
+		{
+			out.open_pipe();
+			err.open_pipe();
+			File out_end = out.child_end(), err_end = err.child_end();
+			compile_ret = dcc_spawn_child(args, cc_pid, &compile_dir, &devnull, &out_end, &err_end);
+			out.close_child_end();
+			err.close_child_end();
+			if (!compile_ret && !dcc_drain_captures(out, err, out_fd, cc_pid))
+				lost_ret = EXIT_IO_ERROR;
+
+			if (compile_ret || (compile_ret = dcc_collect_child(args[0], cc_pid, status, &usage))) 
+			{
+				// We didn't get around to finding a wait status from the actual compiler
+				status = W_EXITCODE(compile_ret, 0);
+			}
+		}
+		gettimeofday(&cc_end, NULL);
+		timeval_subtract(cc_time, cc_end, cc_start);
+		usage.wall_msecs = cc_time.tv_sec * 1000 + cc_time.tv_usec / 1000;
+		dcc_admission_end_compile(usage.wall_msecs, usage.max_rss_kb);
+		dcc_metrics_compiling(-1);
+		dcc_job_phase(DCC_METRIC_COMPILE, cc_start, cc_end, job_id, input_name);
+		dcc_usage_record(session_name, usage);
+
+		// nobody to send the results to
+		if ((ret = lost_ret))
+		{
+			outcome = DCC_JOB_CLIENT_GONE;
+			throw "CompilationJob: error";
+		}
+
+		if (!cache_key.empty())
+			dcc_server_cache().store(cache_key, status, temp_o, temp_d, err.file(), out.file());
+	}
+
+	if (!cache_key.empty())
+	{
+		const ObjectCache::Stats &stats = dcc_server_cache().stats();
+		if ((stats.hits + stats.misses) % 100 == 0)
+			dcc_server_cache().log_stats();
 	}
 #ifdef _WIN32
 	ticks_collect = GetTickCount();
@@ -447,10 +1062,18 @@ int CompilationJob::run(fd_t in_fd, fd_t out_fd)
 	if (on_server && !!temp_d)
 		fix_dotd_file(temp_d, temp_o);
 
+	if (pump)
+	{
+		mirror.unroot_file(temp_d);
+		mirror.unroot(err);
+		mirror.unroot(out);
+	}
+
+	gettimeofday(&t_phase, NULL);
 	if ((ret = dcc_x_result_header(out_fd, protover))
 		|| (ret = dcc_x_cc_status(out_fd, status))
-		|| (ret = dcc_x_file(out_fd, err_fname, "SERR", compr, NULL))
-		|| (ret = dcc_x_file(out_fd, out_fname, "SOUT", compr, NULL)))
+		|| (ret = err.send(out_fd, "SERR", compr))
+		|| (ret = out.send(out_fd, "SOUT", compr)))
 	{
 		throw "CompilationJob: error";;
 	}
@@ -462,12 +1085,19 @@ int CompilationJob::run(fd_t in_fd, fd_t out_fd)
 
 		if ((ret = dcc_x_file(out_fd, failed ? File() : temp_o, "DOTO", compr, &size_o))
 			|| (ret = dcc_x_file(out_fd, temp_d, "DOTD", compr, NULL))
-			|| (ret = dcc_x_file(out_fd, temp_pdb, ".PDB", compr, NULL)))
+			|| (ret = dcc_x_file(out_fd, temp_pdb, ".PDB", compr, NULL))
+			|| ((cmd_flags & CMD_FLAGS_RUSAGE) && (ret = dcc_x_usage(out_fd, usage))))
 		{
 			throw "CompilationJob: error";;
 		}
+
+		outcome = cached ? DCC_JOB_CACHED : failed ? DCC_JOB_FAILED : DCC_JOB_DONE;
 	}
 
+	struct timeval t_sent;
+	gettimeofday(&t_sent, NULL);
+	dcc_job_phase(DCC_METRIC_SEND, t_phase, t_sent, job_id, input_name);
+
 #ifdef _WIN32
 	ticks_endsend = GetTickCount();
 #endif
@@ -486,7 +1116,12 @@ CompilationJob::~CompilationJob()
 	if (error)
 		rs_log_error("error occurred during compilation of %s", +orig_input.path());
 
-	dcc_remove_log_to_file();
+	if (admitted)
+		dcc_admission_leave();
+
+	dcc_remove_log_to_capture();
+	// before the name it was made under is unlinked
+	mirror.remove();
 	dcc_cleanup_tempfiles();
 
 #ifdef _WIN32
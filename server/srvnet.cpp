@@ -87,14 +87,37 @@ namespace distcc
 
 // Listen on a predetermined address (often the passive address).  
 // The way in which we get the address depends on the resolver API in use.
+//
+// With @p reuse_port, several sockets may listen on the same address, and the kernel 
+// spreads incoming connections over them.
 
-static int dcc_listen_by_addr(int fd, struct sockaddr *sa, size_t salen)
+static int dcc_listen_by_addr(int fd, struct sockaddr *sa, size_t salen, bool reuse_port)
 {
     int one = 1;
     string sa_buf;
 
     setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *) &one, sizeof(one));
 
+    if (reuse_port)
+	{
+#ifdef SO_REUSEPORT
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (char *) &one, sizeof(one)) == -1)
+		{
+			rs_log_error("failed to set SO_REUSEPORT: %s", strerror(errno));
+			close(fd);
+			return EXIT_BIND_FAILED;
+		}
+#else
+		rs_log_error("SO_REUSEPORT is not supported on this platform");
+#ifdef _WIN32
+		closesocket(fd);
+#else
+		close(fd);
+#endif
+		return EXIT_BIND_FAILED;
+#endif // ! SO_REUSEPORT
+	}
+
     dcc_sockaddr_to_string(sa, salen, sa_buf);
 
     // now we've got a socket - we need to bind it
@@ -138,7 +161,7 @@ static int dcc_listen_by_addr(int fd, struct sockaddr *sa, size_t salen)
 // This version uses getaddrinfo.  
 // It will probably use IPv6 if that's supported by your configuration, kernel, and library.
 
-int dcc_socket_listen(int port, int *fd_out, const char *listen_addr)
+int dcc_socket_listen(int port, int *fd_out, const char *listen_addr, bool reuse_port)
 {
     char portname[20];
     struct addrinfo hints;
@@ -193,7 +216,7 @@ int dcc_socket_listen(int port, int *fd_out, const char *listen_addr)
 			return EXIT_BIND_FAILED;
         }
 
-		ret = dcc_listen_by_addr(*fd_out, res->ai_addr, res->ai_addrlen);
+		ret = dcc_listen_by_addr(*fd_out, res->ai_addr, res->ai_addrlen, reuse_port);
         freeaddrinfo(res);
         return ret;
     }
@@ -206,7 +229,7 @@ int dcc_socket_listen(int port, int *fd_out, const char *listen_addr)
 #else // ! ENABLE_RFC2553
 
 // This version uses inet_aton
-int dcc_socket_listen(int port, int *listen_fd, const char *listen_addr)
+int dcc_socket_listen(int port, int *listen_fd, const char *listen_addr, bool reuse_port)
 {
     struct sockaddr_in sock;
 
@@ -240,7 +263,7 @@ int dcc_socket_listen(int port, int *listen_fd, const char *listen_addr)
 		return EXIT_BIND_FAILED;
     }
 
-    return dcc_listen_by_addr(*listen_fd, (struct sockaddr *) &sock, sizeof sock);
+    return dcc_listen_by_addr(*listen_fd, (struct sockaddr *) &sock, sizeof sock, reuse_port);
 }
 #endif  // ! ENABLE_RFC2553
 
@@ -42,6 +42,7 @@
 #include "common/distcc.h"
 #include "common/trace.h"
 #include "common/util.h"
+#include "common/exec.h"
 #include "common/rpc1.h"
 #include "common/exitcode.h"
 #include "common/hosts.h"
@@ -91,6 +92,13 @@ dcc_exitcode dcc_r_flags(fd_t ifd, unsigned &flags)
 
 //---------------------------------------------------------------------------------------------
 
+dcc_exitcode dcc_r_job_id(fd_t ifd, string &job_id)
+{
+	return dcc_r_token_string(ifd, "JOBI", job_id);
+}
+
+//---------------------------------------------------------------------------------------------
+
 dcc_exitcode dcc_r_view_name(fd_t ifd, string &view_name)
 {
 	return dcc_r_token_string(ifd, "VIEW", view_name);
@@ -106,6 +114,33 @@ dcc_exitcode dcc_r_compile_dir(fd_t ifd, Directory &cdir)
 	return ret;
 }
 
+//---------------------------------------------------------------------------------------------
+// Tell a client that asked for it whether its job was admitted, or else how long we expect
+// to stay busy.
+
+dcc_exitcode dcc_x_admission(fd_t fd, bool admitted, unsigned wait_secs)
+{
+	if (admitted)
+		return dcc_x_token_int(fd, "ADMT", 0);
+	return dcc_x_token_int(fd, "BUSY", wait_secs);
+}
+
+//---------------------------------------------------------------------------------------------
+// Tell a client that sent the digest of its input whether we still need the input itself
+
+dcc_exitcode dcc_x_have_input(fd_t fd, bool have)
+{
+	return dcc_x_token_int(fd, have ? "HAVE" : "NEED", 0);
+}
+
+//---------------------------------------------------------------------------------------------
+// Tell the client what its compilation cost us
+
+dcc_exitcode dcc_x_usage(fd_t fd, const JobUsage &usage)
+{
+	return dcc_x_token_string(fd, "RUSG", usage.to_string());
+}
+
 //---------------------------------------------------------------------------------------------
 // Read an argv[] vector from the network
 
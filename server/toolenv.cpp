@@ -0,0 +1,262 @@
+/**
+ * @file
+ *
+ * Compilers shipped by clients, unpacked and kept for their jobs.
+ **/
+
+#include "common/config.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/stat.h>
+
+#include <map>
+
+#include "common/distcc.h"
+#include "common/trace.h"
+#include "common/exec.h"
+#include "common/rpc1.h"
+#include "common/bulk.h"
+#include "common/hash.h"
+#include "common/toolchain.h"
+
+#include "server/dopt.h"
+#include "server/toolenv.h"
+
+#include "rvfc/text/defs.h"
+
+namespace distcc
+{
+
+using namespace rvfc::Text;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef __linux__
+
+static bool dcc_read_manifest(const string &root, ToolchainEnv &env)
+{
+	string fname = root + "/" + ToolchainEnv::manifest_name;
+	FILE *f = fopen(+fname, "r");
+	if (!f)
+		return false;
+
+	string s;
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		s.append(buf, n);
+	fclose(f);
+
+	if (!env.parse(s))
+	{
+		rs_log_warning("bad manifest %s", +fname);
+		return false;
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Run a system tool.  Tools are named by absolute path, so that a shipped toolchain on 
+// the PATH can't stand in for them.
+
+static int dcc_run(Arguments &args)
+{
+	proc_t pid;
+	int ret, status;
+	File null(DEV_NULL);
+	if ((ret = dcc_spawn_child(args, pid, 0, &null, &null, 0))
+		|| (ret = dcc_collect_child(args[0], pid, status)))
+	{
+		return ret;
+	}
+	return status ? EXIT_DISTCC_FAILED : 0;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void dcc_remove_tree(const string &dir)
+{
+	Arguments rm;
+	rm.append("/bin/rm");
+	rm.append("-rf");
+	rm.append(dir);
+	if (dcc_run(rm))
+		rs_log_warning("failed to remove %s", +dir);
+}
+
+//---------------------------------------------------------------------------------------------
+
+bool dcc_find_toolchain_env(const string &fingerprint, ToolchainEnv &env, string &root)
+{
+	// the compilers don't change once unpacked
+	static std::map<string, std::pair<string, ToolchainEnv> > known;
+
+	root = "";
+	if (!arg_toolchain_dir || fingerprint.empty())
+		return false;
+
+	std::pair<string, ToolchainEnv> &tc = known[fingerprint];
+	if (tc.first.empty())
+	{
+		// resolve the link, so that the job keeps to the same tree whatever happens to it
+		string link = stringf("%s/%s", arg_toolchain_dir, +dcc_toolchain_key(fingerprint));
+		char target[1024];
+		ssize_t len = readlink(+link, target, sizeof(target) - 1);
+		if (len <= 0)
+			return false;
+		target[len] = '\0';
+
+		string dir = stringf("%s/%s", arg_toolchain_dir, target);
+		if (!dcc_read_manifest(dir, tc.second) || tc.second.fingerprint != fingerprint)
+			return false;
+		tc.first = dir;
+	}
+
+	env = tc.second;
+	root = tc.first;
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Unpack the archive with @p digest, unless it already is, and link it by its fingerprint
+
+static void dcc_install_toolchain_env(const File &archive, const string &digest, const string &fingerprint)
+{
+	string top = arg_toolchain_dir;
+	string dir = top + "/" + digest;
+	mkdir(+top, 0755);
+
+	struct stat st;
+	if (stat(+dir, &st) == -1)
+	{
+		string staging = stringf("%s/.%s.%ld", +top, +digest, (long) getpid());
+		if (mkdir(+staging, 0755) == -1)
+		{
+			rs_log_error("failed to create %s: %s", +staging, strerror(errno));
+			return;
+		}
+
+		Arguments tar;
+		tar.append("/bin/tar");
+		tar.append("-xzf");
+		tar.append(archive.path());
+		tar.append("-C");
+		tar.append(staging);
+
+		// Only keep a compiler that is what the client said it is
+		ToolchainEnv env;
+		bool ok = !dcc_run(tar) && dcc_read_manifest(staging, env) && env.fingerprint == fingerprint;
+		if (ok && dcc_toolchain_fingerprint(staging + env.driver) != fingerprint)
+		{
+			rs_log_warning("compiler %s in %s does not have the fingerprint %s",
+				+env.driver, +digest, +fingerprint);
+			ok = false;
+		}
+
+		// someone else may have been quicker
+		if (!ok || rename(+staging, +dir) == -1)
+			dcc_remove_tree(staging);
+		if (!ok)
+			return;
+		rs_log_info("unpacked compiler %s into %s", +fingerprint, +dir);
+	}
+
+	// The link is replaced in one go, in case it points to an older copy
+	string link = top + "/" + dcc_toolchain_key(fingerprint);
+	string temp = stringf("%s.%ld", +link, (long) getpid());
+	unlink(+temp);
+	if (symlink(+digest, +temp) == -1 || rename(+temp, +link) == -1)
+	{
+		rs_log_error("failed to link %s: %s", +link, strerror(errno));
+		unlink(+temp);
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
+int dcc_r_toolchain_env(fd_t in_fd, const string &fingerprint, ToolchainEnv &env, string &root)
+{
+	int ret;
+	string digest;
+
+	root = "";
+	if ((ret = dcc_r_token_string(in_fd, "ENVD", digest)))
+		return ret;
+	if (digest.empty())
+		return 0;
+
+	File archive = dcc_make_tmpnam("distccd", ".tar.gz");
+	unsigned size;
+	if ((ret = dcc_r_token_file(in_fd, "ENVA", archive, size, DCC_COMPRESS_NONE)))
+		return ret;
+
+	if (digest.length() != 2 * Digest::size || digest.find_first_not_of("0123456789abcdef") != string::npos
+		|| dcc_hash_file(archive) != digest)
+	{
+		rs_log_warning("compiler archive does not match its digest %s", +digest);
+		return 0;
+	}
+
+	dcc_install_toolchain_env(archive, digest, fingerprint);
+	dcc_find_toolchain_env(fingerprint, env, root);
+	return 0;
+}
+
+//---------------------------------------------------------------------------------------------
+
+vector<string> dcc_toolchain_env_vars(const ToolchainEnv &env, const string &root)
+{
+	vector<string> vars;
+	if (root.empty())
+		return vars;
+
+	string path, lib;
+	for (size_t i = 0; i < env.path.size(); ++i)
+		path += root + env.path[i] + ":";
+	for (size_t i = 0; i < env.lib.size(); ++i)
+		lib += (lib.empty() ? "" : ":") + root + env.lib[i];
+
+	const char *sys_path = getenv("PATH");
+	vars.push_back("PATH=" + path + (sys_path ? sys_path : "/usr/bin:/bin"));
+	if (!lib.empty())
+		vars.push_back("LD_LIBRARY_PATH=" + lib);
+	return vars;
+}
+
+//---------------------------------------------------------------------------------------------
+
+#else // ! __linux__
+
+bool dcc_find_toolchain_env(const string &fingerprint, ToolchainEnv &env, string &root)
+{
+	root = "";
+	return false;
+}
+
+int dcc_r_toolchain_env(fd_t in_fd, const string &fingerprint, ToolchainEnv &env, string &root)
+{
+	rs_log_error("compilers can't be shipped to this platform");
+	root = "";
+	return EXIT_DISTCC_FAILED;
+}
+
+vector<string> dcc_toolchain_env_vars(const ToolchainEnv &env, const string &root)
+{
+	return vector<string>();
+}
+
+#endif // ! __linux__
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
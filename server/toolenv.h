@@ -0,0 +1,40 @@
+
+#ifndef _distcc_server_toolenv_h_
+#define _distcc_server_toolenv_h_
+
+#include <string>
+#include <vector>
+
+#include "common/distcc.h"
+#include "common/toolchain.h"
+
+namespace distcc
+{
+
+using std::string;
+using std::vector;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+// Compilers shipped by clients (--toolchain-dir).
+//
+// An archive is unpacked into <dir>/<digest of the archive>, once its driver has been found
+// to have the fingerprint the client claimed, and <dir>/<key of the fingerprint> is made a
+// link to it, by which later jobs find it.  Workers unpacking the same archive at the same
+// time each do so in a directory of their own, and the first one to finish wins.
+
+// The compiler with @p fingerprint, if a client has sent it; @p root is where it's unpacked
+bool dcc_find_toolchain_env(const string &fingerprint, ToolchainEnv &env, string &root);
+
+// Read ENVD and ENVA, and unpack the compiler.  @p root is left empty if the client had no
+// compiler to send or it isn't what the client claimed.
+int dcc_r_toolchain_env(fd_t in_fd, const string &fingerprint, ToolchainEnv &env, string &root);
+
+// The environment to run the compiler in (see dcc_set_child_env); none if @p root is empty
+vector<string> dcc_toolchain_env_vars(const ToolchainEnv &env, const string &root);
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
+
+#endif // _distcc_server_toolenv_h_
@@ -0,0 +1,168 @@
+/**
+ * @file
+ *
+ * Per-session totals of the resources used by compilers on this server.
+ **/
+
+#include "common/config.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "common/distcc.h"
+#include "common/trace.h"
+
+#include "server/usage.h"
+
+namespace distcc
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef __linux__
+
+enum
+{
+	max_sessions = 64,
+	idle_secs = 3600, // after which a session's place may be taken
+	log_every = 100 // jobs
+};
+
+struct dcc_session_usage
+{
+	// 0: free, 1: being (re)claimed, 2: in use
+	volatile int state;
+	char name[64];
+
+	volatile time_t last_used;
+	volatile unsigned long long jobs, user_msecs, sys_msecs, wall_msecs;
+	volatile unsigned long max_rss_kb;
+};
+
+static dcc_session_usage *sessions = 0;
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_usage_init()
+{
+	void *p = mmap(0, max_sessions * sizeof(dcc_session_usage), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+	{
+		// not worth failing over
+		rs_log_warning("failed to map session usage: %s", strerror(errno));
+		return;
+	}
+
+	sessions = (dcc_session_usage *) p;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void dcc_claim_session(dcc_session_usage &s, const char *name)
+{
+	s.jobs = s.user_msecs = s.sys_msecs = s.wall_msecs = 0;
+	s.max_rss_kb = 0;
+	strncpy(s.name, name, sizeof(s.name) - 1);
+	s.name[sizeof(s.name) - 1] = '\0';
+	s.last_used = time(0);
+	__sync_synchronize();
+	s.state = 2;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static dcc_session_usage *dcc_find_session(const char *name)
+{
+	unsigned h = 2166136261u;
+	for (const char *p = name; *p; ++p)
+		h = (h ^ (unsigned char) *p) * 16777619u;
+
+	// Names are truncated to fit; sessions sharing a long prefix are counted together
+	dcc_session_usage *oldest = 0;
+	for (int i = 0; i < max_sessions; ++i)
+	{
+		dcc_session_usage &s = sessions[(h + i) % max_sessions];
+		if (s.state == 2 && !strncmp(s.name, name, sizeof(s.name) - 1))
+			return &s;
+
+		if (s.state == 0)
+		{
+			if (!__sync_bool_compare_and_swap(&s.state, 0, 1))
+				continue;
+			dcc_claim_session(s, name);
+			return &s;
+		}
+
+		if (s.state == 2 && (!oldest || s.last_used < oldest->last_used))
+			oldest = &s;
+	}
+
+	if (!oldest || time(0) - oldest->last_used < idle_secs
+		|| !__sync_bool_compare_and_swap(&oldest->state, 2, 1))
+	{
+		return 0;
+	}
+
+	rs_log_info("session %s: %llu jobs, user %.1fs, sys %.1fs, compiling %.1fs, max rss %luMB (idle, forgotten)",
+		oldest->name, oldest->jobs, oldest->user_msecs / 1000.0, oldest->sys_msecs / 1000.0,
+		oldest->wall_msecs / 1000.0, oldest->max_rss_kb / 1024);
+	dcc_claim_session(*oldest, name);
+	return oldest;
+}
+
+//---------------------------------------------------------------------------------------------
+
+void dcc_usage_record(const string &session, const JobUsage &usage)
+{
+	if (!sessions)
+		return;
+
+	const char *name = session.empty() ? "(none)" : session.c_str();
+	dcc_session_usage *s = dcc_find_session(name);
+	if (!s)
+	{
+		rs_trace("no room to account for session %s", name);
+		return;
+	}
+
+	s->last_used = time(0);
+	__sync_add_and_fetch(&s->user_msecs, usage.user_msecs);
+	__sync_add_and_fetch(&s->sys_msecs, usage.sys_msecs);
+	__sync_add_and_fetch(&s->wall_msecs, usage.wall_msecs);
+
+	unsigned long rss = s->max_rss_kb;
+	while (usage.max_rss_kb > rss && !__sync_bool_compare_and_swap(&s->max_rss_kb, rss, usage.max_rss_kb))
+		rss = s->max_rss_kb;
+
+	unsigned long long jobs = __sync_add_and_fetch(&s->jobs, 1);
+	if (jobs % log_every == 0)
+	{
+		rs_log_info("session %s: %llu jobs, user %.1fs, sys %.1fs, compiling %.1fs, max rss %luMB",
+			name, jobs, s->user_msecs / 1000.0, s->sys_msecs / 1000.0, s->wall_msecs / 1000.0,
+			s->max_rss_kb / 1024);
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+
+#else // ! __linux__
+
+// Workers are not forked on Windows; sessions are not accounted for.
+
+void dcc_usage_init() {}
+void dcc_usage_record(const string &session, const JobUsage &usage) {}
+
+#endif // ! __linux__
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
@@ -0,0 +1,31 @@
+
+#ifndef _distcc_server_usage_h_
+#define _distcc_server_usage_h_
+
+#include <string>
+
+#include "common/exec.h"
+
+namespace distcc
+{
+
+using std::string;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+// Resources used by the compilers of each client session (distcc --session), summed up.
+//
+// The totals live in memory shared by all preforked workers, so dcc_usage_init() must be called
+// by the parent before forking.  There is room for a fixed number of sessions; a session that
+// has been idle for an hour gives up its place to a new one.
+
+void dcc_usage_init();
+
+// Add a job's usage to its session, and now and then log the session's totals
+void dcc_usage_record(const string &session, const JobUsage &usage);
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+} // namespace distcc
+
+#endif // _distcc_server_usage_h_
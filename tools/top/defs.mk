@@ -0,0 +1,10 @@
+MODULE=distcc-top
+MODULE_DIR=$(VROOT)/distcc/tools/top
+
+include $(MK)/module/start
+
+MODULE_PRODUCT=prog
+
+MODULE_TARGET_NAME=distcc-top
+
+include $(MK)/module/end
@@ -0,0 +1,4 @@
+define MODULE_DEPENDS.common
+	(distcc-common,$(VROOT)/distcc/common)
+	(distcc-contrib-rvfc,$(VROOT)/distcc/contrib/rvfc)
+endef
@@ -0,0 +1,321 @@
+/**
+ * @file
+ *
+ * distcc-top: a live view of the distcc jobs running on this machine.
+ *
+ * Reads the task table the clients keep in the state directory ($DISTCC_DIR/state, or
+ * ~/.distcc/state) several times a second, and shows for each host the compile slots in use
+ * and how long its jobs take to connect and to compile, along with the number of jobs in
+ * each phase, and rates of jobs and bytes.  Hosts whose jobs take much longer than the others
+ * to connect or to compile are highlighted: they are the ones to look at when tuning -j and
+ * the host list.
+ *
+ * Usage:
+ *   distcc-top [-d SECS] [-n COUNT] [-b]
+ *
+ * -d is the time between updates (default 0.25s), -n stops after COUNT updates, and -b
+ * prints one update after another rather than redrawing the screen.
+ **/
+
+#include "common/config.h"
+
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+#include <map>
+#include <deque>
+#include <string>
+
+#include "common/distcc.h"
+#include "common/trace.h"
+#include "common/state.h"
+
+#include "rvfc/filesys/defs.h"
+
+using namespace distcc;
+using std::vector;
+using std::map;
+using std::deque;
+using std::string;
+
+const char *rs_program_name = "distcc-top";
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+// A host is slow in a phase if its jobs take this much longer than the average of the other
+// hosts, and at least the minimum
+static const double slow_factor = 2.0;
+static const double slow_connect_secs = 0.5, slow_compile_secs = 1.0;
+
+// Rates are averaged over this long
+static const double rate_window_secs = 5.0;
+
+// Average durations of a phase, as seen so far
+struct PhaseTime
+{
+	double avg;     // seconds; decaying, so that it follows changes
+	long n;
+
+	PhaseTime() : avg(0), n(0) {}
+
+	void add(double secs)
+	{
+		avg = n == 0 ? secs : avg + (secs - avg) * 0.2;
+		++n;
+	}
+};
+
+struct HostView
+{
+	int busy;
+	vector<bool> slots;
+	double longest_connect, longest_compile; // of the jobs now in the phase
+	PhaseTime connect, compile;
+
+	HostView() : busy(0), longest_connect(0), longest_compile(0) {}
+};
+
+static map<string, HostView> hosts;
+static map<unsigned long, dcc_task_state> last_tasks;
+static double last_update = 0;
+static deque<std::pair<double, dcc_task_totals> > history;
+
+//---------------------------------------------------------------------------------------------
+
+static double now_secs()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static Directory state_dir()
+{
+	const char *dir = getenv("DISTCC_DIR");
+	if (dir && *dir)
+		return stringf("%s/state", dir);
+
+	const char *home = getenv("HOME");
+	if (!home)
+	{
+		fprintf(stderr, "distcc-top: HOME is not set; can't find distcc directory\n");
+		exit(1);
+	}
+	return stringf("%s/.distcc/state", home);
+}
+
+//---------------------------------------------------------------------------------------------
+
+// A job that has left a phase (or gone away) tells how long the phase took on its host
+
+static void note_phase_end(const dcc_task_state &task, double end)
+{
+	double secs = end - task.phase_start / 1e6;
+	if (secs < 0 || !task.host[0])
+		return;
+
+	if (task.curr_phase == DCC_PHASE_CONNECT)
+		hosts[task.host].connect.add(secs);
+	else if (task.curr_phase == DCC_PHASE_COMPILE)
+		hosts[task.host].compile.add(secs);
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void update(const vector<dcc_task_state> &tasks, double now)
+{
+	for (map<string, HostView>::iterator i = hosts.begin(); i != hosts.end(); ++i)
+	{
+		HostView &h = i->second;
+		h.busy = 0;
+		h.slots.clear();
+		h.longest_connect = h.longest_compile = 0;
+	}
+
+	map<unsigned long, dcc_task_state> seen;
+	for (size_t i = 0; i < tasks.size(); ++i)
+	{
+		const dcc_task_state &task = tasks[i];
+		seen[task.cpid] = task;
+
+		// The phase it was in ended when the next one began, if this is the next one or
+		// one after it; if the job has started afresh, its end isn't known
+		map<unsigned long, dcc_task_state>::iterator last = last_tasks.find(task.cpid);
+		if (last != last_tasks.end() && last->second.curr_phase < task.curr_phase
+			&& last->second.phase_start < task.phase_start)
+		{
+			note_phase_end(last->second, task.phase_start / 1e6);
+		}
+
+		// Jobs holding a slot on a host
+		if (task.curr_phase < DCC_PHASE_CONNECT || task.curr_phase == DCC_PHASE_DONE || !task.host[0])
+			continue;
+		HostView &h = hosts[task.host];
+		++h.busy;
+		if (task.slot >= 0 && task.slot < 1024)
+		{
+			if ((int) h.slots.size() <= task.slot)
+				h.slots.resize(task.slot + 1);
+			h.slots[task.slot] = true;
+		}
+
+		double age = now - task.phase_start / 1e6;
+		if (task.curr_phase == DCC_PHASE_CONNECT && age > h.longest_connect)
+			h.longest_connect = age;
+		if (task.curr_phase == DCC_PHASE_COMPILE && age > h.longest_compile)
+			h.longest_compile = age;
+	}
+
+	// The jobs that finished since last time; the receive is short, so a job that was
+	// compiling finished its compile somewhere in between
+	for (map<unsigned long, dcc_task_state>::iterator i = last_tasks.begin(); i != last_tasks.end(); ++i)
+		if (seen.find(i->first) == seen.end())
+			note_phase_end(i->second, (last_update + now) / 2);
+
+	last_tasks.swap(seen);
+	last_update = now;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static double others_avg(const string &host, PhaseTime HostView::*phase)
+{
+	double sum = 0;
+	long n = 0;
+	for (map<string, HostView>::iterator i = hosts.begin(); i != hosts.end(); ++i)
+	{
+		if (i->first == host)
+			continue;
+		const PhaseTime &t = i->second.*phase;
+		sum += t.avg * t.n;
+		n += t.n;
+	}
+	return n ? sum / n : 0;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static bool slow(double secs, double overall, double min_secs)
+{
+	// nothing to compare with until some jobs have been through the phase
+	return overall > 0 && secs > min_secs && secs > overall * slow_factor;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void show(const vector<dcc_task_state> &tasks, const dcc_task_totals &totals, double now, bool batch)
+{
+	history.push_back(std::make_pair(now, totals));
+	while (history.size() > 2 && now - history[1].first >= rate_window_secs)
+		history.pop_front();
+
+	double dt = now - history.front().first;
+	const dcc_task_totals &then = history.front().second;
+	double jobs_rate = 0, sent_rate = 0, received_rate = 0;
+	if (dt > 0)
+	{
+		jobs_rate = (totals.jobs - then.jobs) / dt;
+		sent_rate = (totals.bytes_sent - then.bytes_sent) / dt / 1e6;
+		received_rate = (totals.bytes_received - then.bytes_received) / dt / 1e6;
+	}
+
+	int phases[DCC_PHASE_DONE + 1];
+	memset(phases, 0, sizeof(phases));
+	for (size_t i = 0; i < tasks.size(); ++i)
+		if (tasks[i].curr_phase >= DCC_PHASE_STARTUP && tasks[i].curr_phase <= DCC_PHASE_DONE)
+			++phases[tasks[i].curr_phase];
+
+	string out;
+	if (!batch)
+		out += "\033[H\033[J";
+
+	char clock[32];
+	time_t t = (time_t) now;
+	strftime(clock, sizeof(clock), "%H:%M:%S", localtime(&t));
+	out += stringf("distcc-top  %s  %d jobs  %.1f jobs/s  sent %.2f MB/s  received %.2f MB/s\n",
+		clock, (int) tasks.size(), jobs_rate, sent_rate, received_rate);
+
+	for (int p = DCC_PHASE_STARTUP; p < DCC_PHASE_DONE; ++p)
+		out += stringf("%s%s %d", p ? "  " : "", dcc_get_phase_name((enum dcc_phase) p), phases[p]);
+	out += "\n\n";
+
+	out += stringf("%-24s %4s  %-16s %9s %9s %9s %9s\n", "HOST", "BUSY", "SLOTS",
+		"CONNECT", "(longest)", "COMPILE", "(longest)");
+
+	for (map<string, HostView>::iterator i = hosts.begin(); i != hosts.end(); ++i)
+	{
+		const HostView &h = i->second;
+		double avg_connect = others_avg(i->first, &HostView::connect);
+		double avg_compile = others_avg(i->first, &HostView::compile);
+
+		string slots;
+		for (size_t s = 0; s < h.slots.size() && s < 16; ++s)
+			slots += h.slots[s] ? '#' : '.';
+
+		bool slow_connect = slow(h.connect.avg, avg_connect, slow_connect_secs)
+			|| slow(h.longest_connect, avg_connect, slow_connect_secs);
+		bool slow_compile = slow(h.compile.avg, avg_compile, slow_compile_secs)
+			|| slow(h.longest_compile, avg_compile, slow_compile_secs);
+
+		string line = stringf("%-24.24s %4d  %-16s %8.2fs %8.2fs %8.2fs %8.2fs%s%s", +i->first, h.busy, +slots,
+			h.connect.avg, h.longest_connect, h.compile.avg, h.longest_compile,
+			slow_connect ? "  slow connect" : "", slow_compile ? "  slow compile" : "");
+		if ((slow_connect || slow_compile) && !batch)
+			line = "\033[7m" + line + "\033[0m";
+		out += line + "\n";
+	}
+	if (batch)
+		out += "\n";
+
+	fwrite(out.data(), 1, out.size(), stdout);
+	fflush(stdout);
+}
+
+//---------------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+	double delay = 0.25;
+	long count = -1;
+	bool batch = false;
+	int c;
+	while ((c = getopt(argc, argv, "d:n:b")) != -1)
+	{
+		switch (c)
+		{
+		case 'd': delay = atof(optarg); break;
+		case 'n': count = atol(optarg); break;
+		case 'b': batch = true; break;
+		default:
+			fprintf(stderr, "usage: distcc-top [-d SECS] [-n COUNT] [-b]\n");
+			return 1;
+		}
+	}
+	if (delay < 0.01)
+		delay = 0.01;
+
+	dcc_state_dir = state_dir();
+
+	vector<dcc_task_state> tasks;
+	dcc_task_totals totals;
+	for (long n = 0; count < 0 || n < count; ++n)
+	{
+		if (n)
+			usleep((useconds_t) (delay * 1e6));
+
+		dcc_read_task_states(tasks, &totals);
+		double now = now_secs();
+		update(tasks, now);
+		show(tasks, totals, now, batch);
+	}
+
+	return 0;
+}
@@ -0,0 +1,10 @@
+MODULE=distcc-trace-merge
+MODULE_DIR=$(VROOT)/distcc/tools/trace-merge
+
+include $(MK)/module/start
+
+MODULE_PRODUCT=prog
+
+MODULE_TARGET_NAME=distcc-trace-merge
+
+include $(MK)/module/end
@@ -0,0 +1,279 @@
+/**
+ * @file
+ *
+ * Merge the timelines written by distcc and distccd into a single trace of the build.
+ *
+ * With $DISTCC_TIMELINE set, each client and server appends the spans of its jobs to a file
+ * of its own, one trace event per line.  This puts them together as a JSON trace that
+ * chrome://tracing and Perfetto can load: a process for each client machine and each server,
+ * a thread for each client process (or server worker), and arrows from the client sending a
+ * job to the server receiving it, and back for the results.
+ *
+ * Usage:
+ *   distcc-trace-merge [-o OUTPUT] FILE|DIR...
+ *
+ * For a directory, all the *.trace files in it are read.  The clocks of the machines are
+ * taken to agree; keep them synchronized (NTP) or the arrows will point backwards.  Arrows 
+ * are only drawn to servers the client knows take the job's id (host option "timeline").
+ **/
+
+#include <unistd.h>
+#include <dirent.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+using std::string;
+using std::vector;
+using std::map;
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Event
+{
+	string name, cat, node, job, args;
+	long long ts, dur;
+	long pid, tid;
+};
+
+// The spans of a job where the arrows start and end, as indexes into events
+struct Job
+{
+	int send, receive, reply, result;
+	Job() : send(-1), receive(-1), reply(-1), result(-1) {}
+};
+
+static vector<Event> events;
+static int n_bad = 0;
+
+//---------------------------------------------------------------------------------------------
+
+static void die(const char *what, const char *name)
+{
+	fprintf(stderr, "distcc-trace-merge: %s %s: %s\n", what, name, strerror(errno));
+	exit(1);
+}
+
+//---------------------------------------------------------------------------------------------
+
+// The string value of "key":"..." in line, still escaped
+
+static bool get_string(const string &line, const char *key, string &value)
+{
+	string k = string("\"") + key + "\":\"";
+	size_t p = line.find(k);
+	if (p == string::npos)
+		return false;
+	p += k.size();
+	size_t q = p;
+	while (q < line.size() && line[q] != '"')
+		q += line[q] == '\\' ? 2 : 1;
+	if (q >= line.size())
+		return false;
+	value = line.substr(p, q - p);
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+
+static bool get_number(const string &line, const char *key, long long &value)
+{
+	string k = string("\"") + key + "\":";
+	size_t p = line.find(k);
+	if (p == string::npos)
+		return false;
+	char *end;
+	value = strtoll(line.c_str() + p + k.size(), &end, 10);
+	return end != line.c_str() + p + k.size();
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void read_file(const string &fname)
+{
+	FILE *f = fopen(fname.c_str(), "r");
+	if (!f)
+		die("can't open", fname.c_str());
+
+	string line;
+	char buf[4096];
+	while (fgets(buf, sizeof(buf), f))
+	{
+		line += buf;
+		if (line.empty() || line[line.size() - 1] != '\n')
+			continue;
+
+		Event e;
+		long long pid, tid;
+		size_t args = line.find("\"args\":{");
+		size_t end = line.rfind('}');
+		if (get_string(line, "name", e.name) && get_string(line, "cat", e.cat)
+			&& get_number(line, "ts", e.ts) && get_number(line, "dur", e.dur)
+			&& get_number(line, "pid", pid) && get_number(line, "tid", tid)
+			&& get_string(line, "node", e.node) && args != string::npos && end > args)
+		{
+			get_string(line, "job", e.job);
+			e.pid = pid;
+			e.tid = tid;
+			e.args = line.substr(args, end - args); // without the event's closing brace
+			events.push_back(e);
+		}
+		else
+		{
+			++n_bad;
+		}
+		line.clear();
+	}
+	if (!line.empty())
+		++n_bad; // cut short
+
+	fclose(f);
+}
+
+//---------------------------------------------------------------------------------------------
+
+static void read_path(const char *path)
+{
+	DIR *dir = opendir(path);
+	if (!dir)
+	{
+		if (errno != ENOTDIR)
+			die("can't read", path);
+		read_file(path);
+		return;
+	}
+
+	vector<string> names;
+	struct dirent *de;
+	while ((de = readdir(dir)) != NULL)
+	{
+		size_t len = strlen(de->d_name);
+		if (len > 6 && !strcmp(de->d_name + len - 6, ".trace"))
+			names.push_back(de->d_name);
+	}
+	closedir(dir);
+
+	std::sort(names.begin(), names.end());
+	for (size_t i = 0; i < names.size(); ++i)
+		read_file(string(path) + "/" + names[i]);
+}
+
+//---------------------------------------------------------------------------------------------
+
+// Where a flow arrow starts or ends: the start of a span, on its thread
+
+static void flow(FILE *out, const char *ph, int id, const Event &e, long pid, long long t0)
+{
+	fprintf(out, ",\n{\"name\":\"job\",\"cat\":\"flow\",\"ph\":\"%s\",%s\"id\":%d,\"ts\":%lld,\"pid\":%ld,\"tid\":%ld}",
+		ph, *ph == 'f' ? "\"bp\":\"e\"," : "", id, e.ts - t0, pid, e.tid);
+}
+
+//---------------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+	const char *out_name = 0;
+	int c;
+	while ((c = getopt(argc, argv, "o:")) != -1)
+	{
+		switch (c)
+		{
+		case 'o': out_name = optarg; break;
+		default:
+			fprintf(stderr, "usage: distcc-trace-merge [-o OUTPUT] FILE|DIR...\n");
+			return 1;
+		}
+	}
+	if (optind == argc)
+	{
+		fprintf(stderr, "usage: distcc-trace-merge [-o OUTPUT] FILE|DIR...\n");
+		return 1;
+	}
+
+	for (int i = optind; i < argc; ++i)
+		read_path(argv[i]);
+	if (n_bad)
+		fprintf(stderr, "distcc-trace-merge: %d malformed lines skipped\n", n_bad);
+	if (events.empty())
+	{
+		fprintf(stderr, "distcc-trace-merge: no events\n");
+		return 1;
+	}
+
+	FILE *out = stdout;
+	if (out_name && !(out = fopen(out_name, "w")))
+		die("can't create", out_name);
+
+	// A process for each program on each machine: the clients first, then the servers
+	map<string, long> nodes;
+	for (size_t i = 0; i < events.size(); ++i)
+		nodes[(events[i].cat == "distcc" ? "0" : "1") + events[i].cat + " " + events[i].node] = 0;
+
+	long n = 0;
+	for (map<string, long>::iterator i = nodes.begin(); i != nodes.end(); ++i)
+	{
+		i->second = ++n;
+		fprintf(out, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%ld,\"args\":{\"name\":\"%s\"}}",
+			n == 1 ? "{\"traceEvents\":[\n" : ",\n", n, i->first.c_str() + 1);
+		fprintf(out, ",\n{\"name\":\"process_sort_index\",\"ph\":\"M\",\"pid\":%ld,\"args\":{\"sort_index\":%ld}}", n, n);
+	}
+
+	long long t0 = events[0].ts;
+	for (size_t i = 0; i < events.size(); ++i)
+		t0 = std::min(t0, events[i].ts);
+
+	// The spans, and for each job, where it was sent from and received at
+	map<string, Job> jobs;
+	vector<long> pids(events.size());
+	for (size_t i = 0; i < events.size(); ++i)
+	{
+		const Event &e = events[i];
+		bool client = e.cat == "distcc";
+		pids[i] = nodes[(client ? "0" : "1") + e.cat + " " + e.node];
+		fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%ld,\"tid\":%ld,%s}",
+			e.name.c_str(), e.cat.c_str(), e.ts - t0, e.dur, pids[i], e.tid, e.args.c_str());
+
+		if (e.job.empty())
+			continue;
+		Job &j = jobs[e.job];
+		if (client && e.name == "Send")
+			j.send = i;
+		else if (client && e.name == "Receive")
+			j.result = i;
+		else if (!client && (j.receive == -1 || e.ts < events[j.receive].ts))
+			j.receive = i;
+		if (!client && e.name == "Send")
+			j.reply = i;
+	}
+
+	int id = 0;
+	for (map<string, Job>::iterator i = jobs.begin(); i != jobs.end(); ++i)
+	{
+		const Job &j = i->second;
+		if (j.send != -1 && j.receive != -1)
+		{
+			flow(out, "s", ++id, events[j.send], pids[j.send], t0);
+			flow(out, "f", id, events[j.receive], pids[j.receive], t0);
+		}
+		if (j.reply != -1 && j.result != -1)
+		{
+			flow(out, "s", ++id, events[j.reply], pids[j.reply], t0);
+			flow(out, "f", id, events[j.result], pids[j.result], t0);
+		}
+	}
+
+	fprintf(out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	if (out != stdout && fclose(out) != 0)
+		die("can't write", out_name);
+
+	fprintf(stderr, "distcc-trace-merge: %d spans of %d jobs on %d nodes\n",
+		(int) events.size(), (int) jobs.size(), (int) nodes.size());
+	return 0;
+}